@@ -7,6 +7,7 @@ extern uint64_t __bss_end;
 
 // Forward declaration for set_page_table_base, which is likely in vm_pages.c or a related file
 void set_page_table_base(uint64_t base_addr);
+void mmu_enable(void);
 
 static void clear_bss(void) {
     uint64_t* bss_start = &__bss_start;
@@ -53,6 +54,13 @@ void setup_mmu(void) {
     
     __asm__ volatile("dsb sy");
     
+    mmu_enable();
+}
+
+// secondary cores reuse the tables the boot core built
+void mmu_enable(void) {
+    uint64_t* ttbr0_l1 = (uint64_t*)0x1000;
+    
     uint64_t tcr = (16ULL << 0) |
                    (16ULL << 16) |
                    (1ULL << 8) |
@@ -36,12 +36,35 @@ skip_bss:
     msr sctlr_el1, x0
     isb
 
+    bl enable_fpu
     bl kernel_main
 
 halt:
     wfi
     b halt
 
+.globl secondary_entry
+
+// psci cpu_on lands here with the cpu number in x0
+secondary_entry:
+    ldr x1, =secondary_stacks
+    add x2, x0, #1
+    mov x3, #16384
+    madd x1, x2, x3, x1
+    mov sp, x1
+    bl enable_fpu
+    bl secondary_main
+    b halt
+
+// cpacr_el1.fpen = 0b11, fp/simd traps at el1 otherwise and the compiler
+// and the neon paths in the drivers use those registers. keeps x0
+enable_fpu:
+    mrs x1, cpacr_el1
+    orr x1, x1, #(3 << 20)
+    msr cpacr_el1, x1
+    isb
+    ret
+
 .section .data
 .align 12
 page_table_l0:
@@ -52,3 +75,7 @@ page_table_l0:
 stack_bottom:
     .space 16384
 stack_top:
+
+.align 16
+secondary_stacks:
+    .space 16384 * 4
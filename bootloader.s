@@ -17,6 +17,7 @@ _bootloader_start:
 
 el3_entry:
     msr scr_el3, xzr
+    msr cptr_el3, xzr
     
     ldr x0, =0x3c9
     msr spsr_el3, x0
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_CPUS 4
+
+// the irq mask bit in daif
+#define DAIF_I (1 << 7)
+
+static inline uint32_t smp_processor_id(void) {
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & 3;
+}
+
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile(
+        "mrs %0, daif\n"
+        "msr daifset, #2\n"
+        : "=r"(flags) : : "memory"
+    );
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    __asm__ volatile("msr daif, %0" : : "r"(flags) : "memory");
+}
+
+static inline bool irqs_disabled_flags(uint64_t flags) {
+    return flags & DAIF_I;
+}
+
+static inline void local_irq_enable(void) {
+    __asm__ volatile("msr daifclr, #2" ::: "memory");
+}
+
+static inline void local_irq_disable(void) {
+    __asm__ volatile("msr daifset, #2" ::: "memory");
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("yield" ::: "memory");
+}
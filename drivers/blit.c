@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <../timer.h>
+#include <gfx.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define BENCH_WIDTH 320
+#define BENCH_HEIGHT 200
+
+static uint32_t palette32[256];
+
+#if defined(__ARM_NEON)
+// one byte plane per channel, split into the four 64-byte tables tbl can index
+static uint8x16x4_t pal_b[4];
+static uint8x16x4_t pal_g[4];
+static uint8x16x4_t pal_r[4];
+#endif
+
+// destination column/row -> source column/row, rebuilt when the geometry changes
+static uint16_t xmap[GFX_MAX_WIDTH];
+static uint16_t ymap[GFX_MAX_WIDTH];
+static uint8_t row_idx[GFX_MAX_WIDTH] __attribute__((aligned(16)));
+static uint32_t map_sw, map_sh, map_dw, map_dh;
+static uint32_t out_x, out_y, out_w, out_h;
+
+static uint8_t bench_src[BENCH_WIDTH * BENCH_HEIGHT];
+
+void gfx_set_palette(const uint8_t* rgb) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t r = rgb[i * 3];
+        uint8_t g = rgb[i * 3 + 1];
+        uint8_t b = rgb[i * 3 + 2];
+        palette32[i] = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    }
+    
+#if defined(__ARM_NEON)
+    uint8_t planes[3][256] __attribute__((aligned(16)));
+    for (int i = 0; i < 256; i++) {
+        planes[0][i] = (uint8_t)palette32[i];
+        planes[1][i] = (uint8_t)(palette32[i] >> 8);
+        planes[2][i] = (uint8_t)(palette32[i] >> 16);
+    }
+    for (int t = 0; t < 4; t++) {
+        pal_b[t] = vld1q_u8_x4(&planes[0][t * 64]);
+        pal_g[t] = vld1q_u8_x4(&planes[1][t * 64]);
+        pal_r[t] = vld1q_u8_x4(&planes[2][t * 64]);
+    }
+#endif
+}
+
+// biggest integer factor that fits, nearest neighbour when the source is larger
+static void build_maps(struct gfx_surface* dst, uint32_t sw, uint32_t sh) {
+    if (sw == map_sw && sh == map_sh && dst->width == map_dw && dst->height == map_dh) return;
+    
+    uint32_t kx = dst->width / sw;
+    uint32_t ky = dst->height / sh;
+    uint32_t k = kx < ky ? kx : ky;
+    if (k >= 1) {
+        out_w = sw * k;
+        out_h = sh * k;
+    } else if ((uint64_t)dst->width * sh <= (uint64_t)dst->height * sw) {
+        out_w = dst->width;
+        out_h = (uint32_t)((uint64_t)sh * dst->width / sw);
+    } else {
+        out_h = dst->height;
+        out_w = (uint32_t)((uint64_t)sw * dst->height / sh);
+    }
+    if (out_w > GFX_MAX_WIDTH) out_w = GFX_MAX_WIDTH;
+    if (out_h > GFX_MAX_WIDTH) out_h = GFX_MAX_WIDTH;
+    out_x = (dst->width - out_w) / 2;
+    out_y = (dst->height - out_h) / 2;
+    
+    for (uint32_t x = 0; x < out_w; x++) {
+        xmap[x] = (uint16_t)((uint64_t)x * sw / out_w);
+    }
+    for (uint32_t y = 0; y < out_h; y++) {
+        ymap[y] = (uint16_t)((uint64_t)y * sh / out_h);
+    }
+    
+    map_sw = sw;
+    map_sh = sh;
+    map_dw = dst->width;
+    map_dh = dst->height;
+}
+
+#if defined(__ARM_NEON)
+static inline uint8x16_t lookup(const uint8x16x4_t* table, uint8x16_t i0, uint8x16_t i1, uint8x16_t i2, uint8x16_t i3) {
+    // out-of-range indices leave the lane untouched, so each quarter fills its own lanes
+    uint8x16_t v = vqtbl4q_u8(table[0], i0);
+    v = vqtbx4q_u8(v, table[1], i1);
+    v = vqtbx4q_u8(v, table[2], i2);
+    return vqtbx4q_u8(v, table[3], i3);
+}
+#endif
+
+static void convert_row(uint32_t* dst, const uint8_t* idx, uint32_t count) {
+    uint32_t i = 0;
+    
+#if defined(__ARM_NEON)
+    uint8x16_t quarter = vdupq_n_u8(64);
+    uint8x16_t zero = vdupq_n_u8(0);
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t i0 = vld1q_u8(idx + i);
+        uint8x16_t i1 = vsubq_u8(i0, quarter);
+        uint8x16_t i2 = vsubq_u8(i1, quarter);
+        uint8x16_t i3 = vsubq_u8(i2, quarter);
+        
+        uint8x16x4_t px;
+        px.val[0] = lookup(pal_b, i0, i1, i2, i3);
+        px.val[1] = lookup(pal_g, i0, i1, i2, i3);
+        px.val[2] = lookup(pal_r, i0, i1, i2, i3);
+        px.val[3] = zero;
+        vst4q_u8((uint8_t*)(dst + i), px);
+    }
+#endif
+    
+    for (; i < count; i++) {
+        dst[i] = palette32[idx[i]];
+    }
+}
+
+static void copy_row(uint32_t* dst, const uint32_t* src, uint32_t count) {
+    uint32_t i = 0;
+    if (!((uint64_t)dst & 7) && !((uint64_t)src & 7)) {
+        for (; i + 2 <= count; i += 2) {
+            *(uint64_t*)(dst + i) = *(const uint64_t*)(src + i);
+        }
+    }
+    for (; i < count; i++) {
+        dst[i] = src[i];
+    }
+}
+
+// scale and palette-convert in one pass; rows repeated by the scale are copied
+void gfx_blit_indexed(struct gfx_surface* dst, const uint8_t* src, uint32_t width, uint32_t height) {
+    if (!dst || !src || width == 0 || height == 0) return;
+    build_maps(dst, width, height);
+    
+    uint32_t* prev = NULL;
+    uint32_t prev_src = 0;
+    for (uint32_t y = 0; y < out_h; y++) {
+        uint32_t* out = dst->pixels + (out_y + y) * dst->pitch + out_x;
+        uint32_t sy = ymap[y];
+        
+        if (prev && sy == prev_src) {
+            copy_row(out, prev, out_w);
+        } else {
+            const uint8_t* line = src + sy * width;
+            for (uint32_t x = 0; x < out_w; x++) {
+                row_idx[x] = line[xmap[x]];
+            }
+            convert_row(out, row_idx, out_w);
+        }
+        prev = out;
+        prev_src = sy;
+    }
+}
+
+// plain per-pixel version, kept to check and benchmark the fast path against
+void gfx_blit_indexed_ref(struct gfx_surface* dst, const uint8_t* src, uint32_t width, uint32_t height) {
+    if (!dst || !src || width == 0 || height == 0) return;
+    build_maps(dst, width, height);
+    
+    for (uint32_t y = 0; y < out_h; y++) {
+        uint32_t* out = dst->pixels + (out_y + y) * dst->pitch + out_x;
+        const uint8_t* line = src + ymap[y] * width;
+        for (uint32_t x = 0; x < out_w; x++) {
+            out[x] = palette32[line[xmap[x]]];
+        }
+    }
+}
+
+// blits a synthetic 320x200 frame, returns the average ns per frame
+uint64_t gfx_bench_blit(struct gfx_surface* dst, uint32_t frames, int reference) {
+    if (!dst || frames == 0) return 0;
+    
+    for (uint32_t i = 0; i < BENCH_WIDTH * BENCH_HEIGHT; i++) {
+        bench_src[i] = (uint8_t)(i * 7 + i / BENCH_WIDTH);
+    }
+    
+    uint64_t start = ktime_get_ns();
+    for (uint32_t i = 0; i < frames; i++) {
+        if (reference) {
+            gfx_blit_indexed_ref(dst, bench_src, BENCH_WIDTH, BENCH_HEIGHT);
+        } else {
+            gfx_blit_indexed(dst, bench_src, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+    }
+    return (ktime_get_ns() - start) / frames;
+}
@@ -0,0 +1,415 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../vm_pages.h>
+#include <../timer.h>
+#include <../sched/sched.h>
+#include <blk.h>
+#include <virtio_blk.h>
+
+#define BLK_BENCH_DEPTH 32
+#define BLK_BENCH_MAX_IO (64 * 1024)
+
+static struct blk_request requests[BLK_MAX_REQUESTS];
+static struct blk_request* free_requests = NULL;
+static struct blk_request* pending_head = NULL;
+static struct blk_request* pending_tail = NULL;
+static struct bio* waiting_head = NULL;
+static struct bio* waiting_tail = NULL;
+static spinlock_t blk_lock = SPINLOCK_INIT;
+
+static const struct blk_ops* dev_ops = NULL;
+static uint64_t dev_capacity = 0;
+static uint32_t dev_max_segments = BLK_MAX_SEGMENTS;
+static bool dev_read_only = false;
+static uint32_t inflight = 0;
+static struct blk_stats stats;
+
+static struct blk_request* alloc_request(void) {
+    struct blk_request* rq = free_requests;
+    if (rq) free_requests = rq->next;
+    return rq;
+}
+
+static bool can_merge(struct blk_request* rq, struct bio* bio) {
+    uint32_t sectors = bio->len >> BLK_SECTOR_SHIFT;
+    return rq->op == bio->op &&
+           rq->nr_bios < dev_max_segments &&
+           rq->nr_sectors + sectors <= BLK_MAX_SECTORS;
+}
+
+// called with blk_lock held. only requests still waiting for the device
+// can grow, a bio that continues or precedes one joins it
+static bool try_merge(struct bio* bio) {
+    uint32_t sectors = bio->len >> BLK_SECTOR_SHIFT;
+    
+    for (struct blk_request* rq = pending_head; rq; rq = rq->next) {
+        if (!can_merge(rq, bio)) continue;
+        
+        if (rq->sector + rq->nr_sectors == bio->sector) {
+            bio->next = NULL;
+            rq->tail->next = bio;
+            rq->tail = bio;
+        } else if (bio->sector + sectors == rq->sector) {
+            bio->next = rq->bios;
+            rq->bios = bio;
+            rq->sector = bio->sector;
+        } else {
+            continue;
+        }
+        rq->nr_sectors += sectors;
+        rq->nr_bios++;
+        stats.merges++;
+        return true;
+    }
+    return false;
+}
+
+// called with blk_lock held, false when every request is in use
+static bool new_request(struct bio* bio) {
+    struct blk_request* rq = alloc_request();
+    if (!rq) return false;
+    
+    bio->next = NULL;
+    rq->op = bio->op;
+    rq->sector = bio->sector;
+    rq->nr_sectors = bio->len >> BLK_SECTOR_SHIFT;
+    rq->nr_bios = 1;
+    rq->bios = bio;
+    rq->tail = bio;
+    rq->next = NULL;
+    if (pending_tail) {
+        pending_tail->next = rq;
+    } else {
+        pending_head = rq;
+    }
+    pending_tail = rq;
+    return true;
+}
+
+// called with blk_lock held. a bio that joins nothing and finds no free
+// request waits in line for one instead of failing, and whatever already
+// waits keeps its place
+static void queue_bio(struct bio* bio) {
+    if (try_merge(bio)) return;
+    if (!waiting_head && new_request(bio)) return;
+    
+    bio->next = NULL;
+    if (waiting_tail) {
+        waiting_tail->next = bio;
+    } else {
+        waiting_head = bio;
+    }
+    waiting_tail = bio;
+}
+
+// called with blk_lock held once requests are back on the free list
+static void queue_waiting(void) {
+    while (waiting_head) {
+        struct bio* bio = waiting_head;
+        struct bio* next = bio->next;
+        if (!try_merge(bio) && !new_request(bio)) break;
+        
+        waiting_head = next;
+        if (!waiting_head) waiting_tail = NULL;
+    }
+}
+
+// called with blk_lock held, hands pending requests to the driver until it
+// runs out of room and rings the doorbell once for the lot
+static void dispatch(void) {
+    if (!dev_ops) return;
+    
+    bool queued = false;
+    while (pending_head) {
+        struct blk_request* rq = pending_head;
+        rq->submitted_ns = ktime_get_ns();
+        if (dev_ops->queue_rq(rq) < 0) break;
+        
+        pending_head = rq->next;
+        if (!pending_head) pending_tail = NULL;
+        rq->next = NULL;
+        inflight++;
+        stats.requests++;
+        queued = true;
+    }
+    if (inflight > stats.inflight_max) stats.inflight_max = inflight;
+    
+    if (queued) dev_ops->commit();
+}
+
+int blk_init(void) {
+    free_requests = NULL;
+    for (int i = BLK_MAX_REQUESTS - 1; i >= 0; i--) {
+        requests[i].next = free_requests;
+        free_requests = &requests[i];
+    }
+    pending_head = NULL;
+    pending_tail = NULL;
+    waiting_head = NULL;
+    waiting_tail = NULL;
+    inflight = 0;
+    stats = (struct blk_stats){ 0 };
+    
+    return virtio_blk_init();
+}
+
+void blk_register(const struct blk_ops* ops, uint64_t capacity, uint32_t max_segments, bool read_only) {
+    dev_capacity = capacity;
+    dev_max_segments = max_segments < BLK_MAX_SEGMENTS ? max_segments : BLK_MAX_SEGMENTS;
+    dev_read_only = read_only;
+    dev_ops = ops;
+}
+
+bool blk_ready(void) {
+    return dev_ops != NULL;
+}
+
+uint64_t blk_capacity(void) {
+    return dev_capacity;
+}
+
+static int check_bio(struct bio* bio, blk_callback done) {
+    if (!dev_ops) return BLK_ENODEV;
+    if (bio->len == 0 || (bio->len & (BLK_SECTOR_SIZE - 1))) return BLK_EINVAL;
+    if ((bio->len >> BLK_SECTOR_SHIFT) > BLK_MAX_SECTORS) return BLK_EINVAL;
+    if (bio->sector + (bio->len >> BLK_SECTOR_SHIFT) > dev_capacity) return BLK_EINVAL;
+    if (bio->op == BLK_WRITE && dev_read_only) return BLK_EINVAL;
+    
+    bio->done = done;
+    bio->status = BLK_OK;
+    bio->next = NULL;
+    return BLK_OK;
+}
+
+int blk_submit(struct bio* bio, blk_callback done) {
+    int err = check_bio(bio, done);
+    if (err != BLK_OK) return err;
+    
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    stats.bios++;
+    queue_bio(bio);
+    dispatch();
+    spin_unlock_irqrestore(&blk_lock, flags);
+    return BLK_OK;
+}
+
+void blk_plug(struct blk_plug* plug) {
+    plug->head = NULL;
+    plug->tail = NULL;
+}
+
+int blk_submit_plugged(struct blk_plug* plug, struct bio* bio, blk_callback done) {
+    if (!plug) return blk_submit(bio, done);
+    
+    int err = check_bio(bio, done);
+    if (err != BLK_OK) return err;
+    
+    if (plug->tail) {
+        plug->tail->next = bio;
+    } else {
+        plug->head = bio;
+    }
+    plug->tail = bio;
+    return BLK_OK;
+}
+
+// the whole list is queued before anything is dispatched, so it merges
+// with itself and the doorbell rings once
+void blk_unplug(struct blk_plug* plug) {
+    struct bio* bio = plug->head;
+    plug->head = NULL;
+    plug->tail = NULL;
+    if (!bio) return;
+    
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    while (bio) {
+        struct bio* next = bio->next;
+        stats.bios++;
+        queue_bio(bio);
+        bio = next;
+    }
+    dispatch();
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+// from the driver's completion path, finishes every bio the request carried
+void blk_complete(struct blk_request* rq, int status) {
+    uint64_t bytes = (uint64_t)rq->nr_sectors << BLK_SECTOR_SHIFT;
+    
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    inflight--;
+    if (status != BLK_OK) {
+        stats.errors++;
+    } else if (rq->op == BLK_READ) {
+        stats.reads++;
+        stats.read_bytes += bytes;
+    } else {
+        stats.writes++;
+        stats.write_bytes += bytes;
+    }
+    spin_unlock_irqrestore(&blk_lock, flags);
+    
+    struct bio* bio = rq->bios;
+    while (bio) {
+        // the callback may resubmit the bio, which reuses next
+        struct bio* next = bio->next;
+        bio->status = status;
+        if (bio->done) bio->done(bio);
+        bio = next;
+    }
+    
+    flags = spin_lock_irqsave(&blk_lock);
+    rq->next = free_requests;
+    free_requests = rq;
+    queue_waiting();
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+void blk_run_queue(void) {
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    dispatch();
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+void blk_get_stats(struct blk_stats* out) {
+    uint64_t flags = spin_lock_irqsave(&blk_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+struct sync_wait {
+    volatile uint32_t done;
+    uint32_t waiter;
+};
+
+static void sync_done(struct bio* bio) {
+    struct sync_wait* wait = bio->private;
+    __atomic_store_n(&wait->done, 1, __ATOMIC_RELEASE);
+    if (wait->waiter) task_wake(wait->waiter);
+}
+
+static int blk_rw(uint32_t op, uint64_t sector, void* buf, uint32_t count) {
+    struct sync_wait wait = { 0, get_current_tid() };
+    struct bio bio = {
+        .sector = sector,
+        .buf = buf,
+        .len = count << BLK_SECTOR_SHIFT,
+        .op = op,
+        .private = &wait,
+    };
+    
+    int ret = blk_submit(&bio, sync_done);
+    if (ret < 0) return ret;
+    
+    while (!__atomic_load_n(&wait.done, __ATOMIC_ACQUIRE)) {
+        task_block();
+    }
+    return bio.status;
+}
+
+int blk_read(uint64_t sector, void* buf, uint32_t count) {
+    return blk_rw(BLK_READ, sector, buf, count);
+}
+
+int blk_write(uint64_t sector, const void* buf, uint32_t count) {
+    return blk_rw(BLK_WRITE, sector, (void*)buf, count);
+}
+
+// keeps depth bios in flight for ms milliseconds. every finished bio is
+// resubmitted from its callback at the next offset, so the queue never drains
+static struct bio bench_bios[BLK_BENCH_DEPTH];
+static uint64_t bench_started[BLK_BENCH_DEPTH];
+static volatile uint32_t bench_active;
+static volatile bool bench_stop;
+static uint64_t bench_next;
+static uint64_t bench_seed;
+static uint64_t bench_ios;
+static uint64_t bench_latency_ns;
+static bool bench_random;
+static uint32_t bench_waiter;
+
+static uint64_t bench_pick(uint32_t sectors) {
+    uint64_t span = dev_capacity - sectors;
+    if (bench_random) {
+        bench_seed = bench_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return ((bench_seed >> 16) % (span / sectors + 1)) * sectors;
+    }
+    uint64_t sector = bench_next;
+    bench_next = bench_next + sectors > span ? 0 : bench_next + sectors;
+    return sector;
+}
+
+static void bench_done(struct bio* bio) {
+    uint32_t slot = bio - bench_bios;
+    uint64_t now = ktime_get_ns();
+    if (bio->status == BLK_OK) {
+        bench_ios++;
+        bench_latency_ns += now - bench_started[slot];
+    }
+    
+    if (!bench_stop) {
+        bio->sector = bench_pick(bio->len >> BLK_SECTOR_SHIFT);
+        bench_started[slot] = now;
+        if (blk_submit(bio, bench_done) == BLK_OK) return;
+    }
+    if (__atomic_sub_fetch(&bench_active, 1, __ATOMIC_ACQ_REL) == 0 && bench_waiter) {
+        task_wake(bench_waiter);
+    }
+}
+
+int blk_bench(uint32_t op, uint32_t io_size, uint32_t depth, bool random, uint32_t ms, struct blk_bench_result* result) {
+    if (!dev_ops) return BLK_ENODEV;
+    if (io_size < BLK_SECTOR_SIZE || io_size > BLK_BENCH_MAX_IO || (io_size & (BLK_SECTOR_SIZE - 1))) return BLK_EINVAL;
+    if (depth == 0 || depth > BLK_BENCH_DEPTH) depth = BLK_BENCH_DEPTH;
+    if (dev_capacity < (io_size >> BLK_SECTOR_SHIFT)) return BLK_EINVAL;
+    
+    bench_stop = false;
+    bench_next = 0;
+    bench_seed = ktime_get_ns();
+    bench_ios = 0;
+    bench_latency_ns = 0;
+    bench_random = random;
+    bench_waiter = get_current_tid();
+    bench_active = depth;
+    
+    uint32_t pages = (depth * io_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t mem = alloc_pages(pages);
+    if (!mem) return BLK_EIO;
+    
+    struct blk_plug plug;
+    uint64_t start = ktime_get_ns();
+    blk_plug(&plug);
+    for (uint32_t i = 0; i < depth; i++) {
+        struct bio* bio = &bench_bios[i];
+        bio->buf = (void*)(mem + (uint64_t)i * io_size);
+        bio->len = io_size;
+        bio->op = op;
+        bio->sector = bench_pick(io_size >> BLK_SECTOR_SHIFT);
+        bench_started[i] = start;
+        if (blk_submit_plugged(&plug, bio, bench_done) != BLK_OK) {
+            __atomic_sub_fetch(&bench_active, 1, __ATOMIC_ACQ_REL);
+        }
+    }
+    blk_unplug(&plug);
+    
+    msleep(ms);
+    bench_stop = true;
+    while (__atomic_load_n(&bench_active, __ATOMIC_ACQUIRE)) {
+        task_block();
+    }
+    uint64_t elapsed = ktime_get_ns() - start;
+    
+    for (uint32_t i = 0; i < pages; i++) {
+        free_page(mem + (uint64_t)i * PAGE_SIZE);
+    }
+    
+    result->ios = bench_ios;
+    result->bytes = bench_ios * io_size;
+    result->elapsed_ns = elapsed;
+    result->iops = bench_ios * 1000000000ULL / elapsed;
+    result->kbps = result->bytes * 1000000ULL / elapsed;
+    result->avg_latency_us = bench_ios ? bench_latency_ns / bench_ios / 1000 : 0;
+    return BLK_OK;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BLK_SECTOR_SIZE  512
+#define BLK_SECTOR_SHIFT 9
+
+#define BLK_READ  0
+#define BLK_WRITE 1
+
+// a merged request may not grow past these, both fit one virtqueue chain
+#define BLK_MAX_REQUESTS 64
+#define BLK_MAX_SEGMENTS 32
+#define BLK_MAX_SECTORS  1024
+
+#define BLK_OK      0
+#define BLK_EIO    -1
+#define BLK_EINVAL -2
+#define BLK_ENODEV -3
+
+struct bio;
+typedef void (*blk_callback)(struct bio* bio);
+
+// one contiguous buffer covering whole sectors. the callback runs from
+// softirq context once the device is done with it, with bio->status set
+struct bio {
+    uint64_t sector;
+    void* buf;
+    uint32_t len;
+    uint32_t op;
+    int status;
+    blk_callback done;
+    void* private;
+    struct bio* next;
+};
+
+// adjacent bios merged into one device command
+struct blk_request {
+    uint32_t op;
+    uint64_t sector;
+    uint32_t nr_sectors;
+    uint32_t nr_bios;
+    struct bio* bios;
+    struct bio* tail;
+    uint64_t submitted_ns;
+    struct blk_request* next;
+};
+
+// bios submitted through a plug stay on the caller's list until blk_unplug,
+// so a burst merges before any of it goes out without holding back anyone else
+struct blk_plug {
+    struct bio* head;
+    struct bio* tail;
+};
+
+struct blk_stats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t bios;
+    uint64_t merges;
+    uint64_t requests;
+    uint64_t errors;
+    uint32_t inflight_max;
+};
+
+struct blk_bench_result {
+    uint64_t ios;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+    uint64_t iops;
+    uint64_t kbps;
+    uint64_t avg_latency_us;
+};
+
+// what a driver plugs in underneath the block layer
+struct blk_ops {
+    int (*queue_rq)(struct blk_request* rq);
+    void (*commit)(void);
+};
+
+int blk_init(void);
+bool blk_ready(void);
+uint64_t blk_capacity(void);
+// only fails for a bio the device can never take, a busy queue holds it back
+int blk_submit(struct bio* bio, blk_callback done);
+void blk_plug(struct blk_plug* plug);
+// a NULL plug submits straight away
+int blk_submit_plugged(struct blk_plug* plug, struct bio* bio, blk_callback done);
+// the plug is empty afterwards and can be used again
+void blk_unplug(struct blk_plug* plug);
+int blk_read(uint64_t sector, void* buf, uint32_t count);
+int blk_write(uint64_t sector, const void* buf, uint32_t count);
+void blk_get_stats(struct blk_stats* stats);
+int blk_bench(uint32_t op, uint32_t io_size, uint32_t depth, bool random, uint32_t ms, struct blk_bench_result* result);
+
+// driver side
+void blk_register(const struct blk_ops* ops, uint64_t capacity, uint32_t max_segments, bool read_only);
+void blk_complete(struct blk_request* rq, int status);
+void blk_run_queue(void);
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <fb.h>
+#include <console.h>
+
+// a cell packs the character and 24-bit fg/bg so a compare is one load
+#define CELL(ch, fg, bg) (((uint64_t)(uint8_t)(ch) << 48) | \
+                          ((uint64_t)((fg) & 0xFFFFFF) << 24) | \
+                          ((uint64_t)((bg) & 0xFFFFFF)))
+#define CELL_CH(cell) ((char)((cell) >> 48))
+#define CELL_FG(cell) ((uint32_t)((cell) >> 24) & 0xFFFFFF)
+#define CELL_BG(cell) ((uint32_t)(cell) & 0xFFFFFF)
+
+#define DEFAULT_FG 0xFFFFFF
+#define DEFAULT_BG 0x000000
+
+// text rows live in a ring, scrolling only moves head
+static uint64_t cells[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+// what is currently drawn at each screen position
+static uint64_t shown[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+static bool row_dirty[CONSOLE_MAX_ROWS];
+static bool scrolled = false;
+
+static uint32_t cols = 0;
+static uint32_t rows = 0;
+static uint32_t head = 0;
+static uint32_t cur_x = 0;
+static uint32_t cur_y = 0;
+static uint32_t blank_bg = DEFAULT_BG;
+
+static inline uint64_t* line(uint32_t y) {
+    uint32_t phys = head + y;
+    if (phys >= rows) phys -= rows;
+    return cells[phys];
+}
+
+void console_init(void) {
+    struct fb_info* info = fb_get_info();
+    
+    cols = info->width / CONSOLE_GLYPH_W;
+    rows = info->height / CONSOLE_GLYPH_H;
+    if (cols > CONSOLE_MAX_COLS) cols = CONSOLE_MAX_COLS;
+    if (rows > CONSOLE_MAX_ROWS) rows = CONSOLE_MAX_ROWS;
+    
+    console_clear(DEFAULT_BG);
+}
+
+void console_clear(uint32_t bg) {
+    uint64_t blank = CELL(' ', DEFAULT_FG, bg);
+    
+    for (uint32_t y = 0; y < rows; y++) {
+        for (uint32_t x = 0; x < cols; x++) {
+            cells[y][x] = blank;
+            shown[y][x] = blank;
+        }
+        row_dirty[y] = false;
+    }
+    
+    head = 0;
+    cur_x = 0;
+    cur_y = 0;
+    scrolled = false;
+    blank_bg = bg;
+    fb_clear(bg);
+}
+
+static void scroll(void) {
+    head = (head + 1 == rows) ? 0 : head + 1;
+    
+    uint64_t blank = CELL(' ', DEFAULT_FG, blank_bg);
+    uint64_t* last = line(rows - 1);
+    for (uint32_t x = 0; x < cols; x++) {
+        last[x] = blank;
+    }
+    scrolled = true;
+}
+
+static void newline(void) {
+    cur_x = 0;
+    if (cur_y + 1 < rows) {
+        cur_y++;
+    } else {
+        scroll();
+    }
+}
+
+void console_putc(char c, uint32_t fg, uint32_t bg) {
+    if (rows == 0) return;
+    
+    if (c == '\n') {
+        newline();
+        return;
+    }
+    
+    if (cur_x >= cols) {
+        newline();
+    }
+    line(cur_y)[cur_x++] = CELL(c, fg, bg);
+    row_dirty[cur_y] = true;
+}
+
+void console_write(const char* str, uint32_t fg, uint32_t bg) {
+    while (*str) {
+        console_putc(*str++, fg, bg);
+    }
+}
+
+void console_print(const char* str, uint32_t fg, uint32_t bg) {
+    console_write(str, fg, bg);
+    console_flush();
+}
+
+void console_newline(void) {
+    if (rows == 0) return;
+    newline();
+    console_flush();
+}
+
+// re-render every cell whose content differs from what is on screen,
+// then push the touched spans out in one go
+void console_flush(void) {
+    for (uint32_t y = 0; y < rows; y++) {
+        if (!scrolled && !row_dirty[y]) continue;
+        row_dirty[y] = false;
+        
+        uint64_t* src = line(y);
+        for (uint32_t x = 0; x < cols; x++) {
+            uint64_t cell = src[x];
+            if (cell == shown[y][x]) continue;
+            
+            fb_putchar(CELL_CH(cell), x * CONSOLE_GLYPH_W, y * CONSOLE_GLYPH_H,
+                       CELL_FG(cell), CELL_BG(cell));
+            shown[y][x] = cell;
+        }
+    }
+    scrolled = false;
+    fb_flush();
+}
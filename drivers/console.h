@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#define CONSOLE_MAX_COLS 160
+#define CONSOLE_MAX_ROWS 64
+#define CONSOLE_GLYPH_W  8
+#define CONSOLE_GLYPH_H  16
+
+void console_init(void);
+void console_clear(uint32_t bg);
+void console_putc(char c, uint32_t fg, uint32_t bg);
+void console_write(const char* str, uint32_t fg, uint32_t bg);
+void console_print(const char* str, uint32_t fg, uint32_t bg);
+void console_newline(void);
+void console_flush(void);
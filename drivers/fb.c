@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../timer.h>
+#include <fb.h>
+#include <virtio_gpu.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// spans are kept per scanline, x0 >= x1 means the row is clean
+#define FB_CLEAN_X0 0xFFFF
+
+static struct fb_info fb;
+static uint32_t cursor_x = 0;
+static uint32_t cursor_y = 0;
+
+// the virtio-gpu resource is plain ram, drawing lands here and the dirty
+// spans are handed to the device on flush
+static uint32_t* shadow = NULL;
+static uint16_t dirty_x0[FB_MAX_HEIGHT];
+static uint16_t dirty_x1[FB_MAX_HEIGHT];
+static uint32_t dirty_y0 = 0;
+static uint32_t dirty_y1 = 0;
+
+int fb_detect(void) {
+    if (virtio_gpu_init(&fb) == 0) {
+        return 0;
+    }
+    fb.size = 0;
+    return -1;
+}
+
+static uint8_t font[256][16] = {
+    [' '] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['0'] = {0x00,0x00,0x3C,0x66,0x6E,0x76,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['1'] = {0x00,0x00,0x18,0x18,0x38,0x18,0x18,0x18,0x18,0x18,0x18,0x7E,0x00,0x00,0x00,0x00},
+    ['2'] = {0x00,0x00,0x3C,0x66,0x06,0x0C,0x30,0x60,0x60,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
+    ['3'] = {0x00,0x00,0x3C,0x66,0x06,0x06,0x1C,0x06,0x06,0x06,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['a'] = {0x00,0x00,0x00,0x00,0x3C,0x06,0x3E,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
+    ['b'] = {0x00,0x00,0x60,0x60,0x7C,0x66,0x66,0x66,0x66,0x66,0x66,0x7C,0x00,0x00,0x00,0x00},
+    ['c'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x60,0x60,0x60,0x60,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['d'] = {0x00,0x00,0x06,0x06,0x3E,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
+    ['e'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x66,0x7E,0x60,0x60,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['f'] = {0x00,0x00,0x1C,0x36,0x30,0x30,0x7C,0x30,0x30,0x30,0x30,0x30,0x00,0x00,0x00,0x00},
+    ['g'] = {0x00,0x00,0x00,0x00,0x3E,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x66,0x3C,0x00,0x00},
+    ['h'] = {0x00,0x00,0x60,0x60,0x6C,0x76,0x66,0x66,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['i'] = {0x00,0x00,0x18,0x18,0x00,0x38,0x18,0x18,0x18,0x18,0x18,0x3C,0x00,0x00,0x00,0x00},
+    ['j'] = {0x00,0x00,0x06,0x06,0x00,0x0E,0x06,0x06,0x06,0x06,0x06,0x66,0x66,0x3C,0x00,0x00},
+    ['k'] = {0x00,0x00,0x60,0x60,0x66,0x6C,0x78,0x70,0x78,0x6C,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['l'] = {0x00,0x00,0x38,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x3C,0x00,0x00,0x00,0x00},
+    ['m'] = {0x00,0x00,0x00,0x00,0x66,0xFF,0xDB,0xDB,0xDB,0xDB,0xDB,0xDB,0x00,0x00,0x00,0x00},
+    ['n'] = {0x00,0x00,0x00,0x00,0x7C,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['o'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['p'] = {0x00,0x00,0x00,0x00,0x7C,0x66,0x66,0x66,0x66,0x66,0x7C,0x60,0x60,0x60,0x00,0x00},
+    ['q'] = {0x00,0x00,0x00,0x00,0x3E,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x06,0x06,0x00,0x00},
+    ['r'] = {0x00,0x00,0x00,0x00,0x6C,0x76,0x66,0x60,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00},
+    ['s'] = {0x00,0x00,0x00,0x00,0x3E,0x60,0x60,0x3C,0x06,0x06,0x06,0x7C,0x00,0x00,0x00,0x00},
+    ['t'] = {0x00,0x00,0x18,0x18,0x7E,0x18,0x18,0x18,0x18,0x18,0x18,0x0E,0x00,0x00,0x00,0x00},
+    ['u'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
+    ['v'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x3C,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['w'] = {0x00,0x00,0x00,0x00,0x63,0x63,0x6B,0x6B,0x6B,0x36,0x36,0x36,0x00,0x00,0x00,0x00},
+    ['x'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x3C,0x18,0x3C,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['y'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x66,0x3C,0x00,0x00},
+    ['z'] = {0x00,0x00,0x00,0x00,0x7E,0x06,0x0C,0x18,0x30,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
+    ['-'] = {0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['@'] = {0x00,0x00,0x3C,0x66,0x66,0x6E,0x6E,0x60,0x62,0x60,0x60,0x3C,0x00,0x00,0x00,0x00},
+    ['.'] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x00,0x00},
+    [':'] = {0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['/'] = {0x00,0x00,0x02,0x06,0x0C,0x18,0x30,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00,0x00},
+    ['#'] = {0x00,0x00,0x36,0x36,0x7F,0x36,0x36,0x36,0x7F,0x36,0x36,0x36,0x00,0x00,0x00,0x00},
+    ['~'] = {0x00,0x00,0x00,0x00,0x00,0x76,0xDC,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['4'] = {0x00,0x00,0x0C,0x1C,0x3C,0x6C,0x6C,0x7E,0x0C,0x0C,0x0C,0x0C,0x00,0x00,0x00,0x00},
+    ['5'] = {0x00,0x00,0x7E,0x60,0x60,0x60,0x7C,0x06,0x06,0x06,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['6'] = {0x00,0x00,0x3C,0x66,0x60,0x60,0x7C,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['7'] = {0x00,0x00,0x7E,0x06,0x06,0x0C,0x18,0x18,0x18,0x18,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['8'] = {0x00,0x00,0x3C,0x66,0x66,0x66,0x3C,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['9'] = {0x00,0x00,0x3C,0x66,0x66,0x66,0x66,0x3E,0x06,0x06,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['A'] = {0x00,0x00,0x18,0x3C,0x66,0x66,0x66,0x7E,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['B'] = {0x00,0x00,0x7C,0x66,0x66,0x66,0x7C,0x66,0x66,0x66,0x66,0x7C,0x00,0x00,0x00,0x00},
+    ['C'] = {0x00,0x00,0x3C,0x66,0x60,0x60,0x60,0x60,0x60,0x60,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['D'] = {0x00,0x00,0x78,0x6C,0x66,0x66,0x66,0x66,0x66,0x66,0x6C,0x78,0x00,0x00,0x00,0x00},
+    ['E'] = {0x00,0x00,0x7E,0x60,0x60,0x60,0x7C,0x60,0x60,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
+    ['F'] = {0x00,0x00,0x7E,0x60,0x60,0x60,0x7C,0x60,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00},
+    ['G'] = {0x00,0x00,0x3C,0x66,0x60,0x60,0x6E,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
+    ['H'] = {0x00,0x00,0x66,0x66,0x66,0x66,0x7E,0x66,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['I'] = {0x00,0x00,0x3C,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x3C,0x00,0x00,0x00,0x00},
+    ['J'] = {0x00,0x00,0x1E,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x6C,0x6C,0x38,0x00,0x00,0x00,0x00},
+    ['K'] = {0x00,0x00,0x66,0x66,0x6C,0x78,0x70,0x70,0x78,0x6C,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['L'] = {0x00,0x00,0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
+    ['M'] = {0x00,0x00,0xC6,0xEE,0xFE,0xD6,0xC6,0xC6,0xC6,0xC6,0xC6,0xC6,0x00,0x00,0x00,0x00},
+    ['N'] = {0x00,0x00,0x66,0x76,0x76,0x7E,0x6E,0x6E,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['O'] = {0x00,0x00,0x3C,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['P'] = {0x00,0x00,0x7C,0x66,0x66,0x66,0x7C,0x60,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00},
+    ['Q'] = {0x00,0x00,0x3C,0x66,0x66,0x66,0x66,0x66,0x66,0x6E,0x3C,0x06,0x00,0x00,0x00,0x00},
+    ['R'] = {0x00,0x00,0x7C,0x66,0x66,0x66,0x7C,0x78,0x6C,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['S'] = {0x00,0x00,0x3C,0x66,0x60,0x60,0x3C,0x06,0x06,0x06,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['T'] = {0x00,0x00,0x7E,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['U'] = {0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
+    ['V'] = {0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x3C,0x3C,0x18,0x00,0x00,0x00,0x00},
+    ['W'] = {0x00,0x00,0xC6,0xC6,0xC6,0xC6,0xC6,0xD6,0xD6,0xFE,0xEE,0xC6,0x00,0x00,0x00,0x00},
+    ['X'] = {0x00,0x00,0x66,0x66,0x3C,0x3C,0x18,0x18,0x3C,0x3C,0x66,0x66,0x00,0x00,0x00,0x00},
+    ['Y'] = {0x00,0x00,0x66,0x66,0x66,0x3C,0x18,0x18,0x18,0x18,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['Z'] = {0x00,0x00,0x7E,0x06,0x06,0x0C,0x18,0x30,0x60,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
+    ['!'] = {0x00,0x00,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x00,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['"'] = {0x00,0x00,0x66,0x66,0x24,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['\''] = {0x00,0x00,0x18,0x18,0x30,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['`'] = {0x00,0x00,0x30,0x18,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['('] = {0x00,0x00,0x0C,0x18,0x30,0x30,0x30,0x30,0x30,0x30,0x18,0x0C,0x00,0x00,0x00,0x00},
+    [')'] = {0x00,0x00,0x30,0x18,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x18,0x30,0x00,0x00,0x00,0x00},
+    ['*'] = {0x00,0x00,0x00,0x00,0x66,0x3C,0xFF,0x3C,0x66,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['+'] = {0x00,0x00,0x00,0x00,0x18,0x18,0x7E,0x18,0x18,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    [','] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x30,0x00,0x00,0x00},
+    [';'] = {0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x30,0x00,0x00,0x00,0x00,0x00},
+    ['<'] = {0x00,0x00,0x00,0x06,0x0C,0x18,0x30,0x60,0x30,0x18,0x0C,0x06,0x00,0x00,0x00,0x00},
+    ['='] = {0x00,0x00,0x00,0x00,0x00,0x7E,0x00,0x7E,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['>'] = {0x00,0x00,0x00,0x60,0x30,0x18,0x0C,0x06,0x0C,0x18,0x30,0x60,0x00,0x00,0x00,0x00},
+    ['?'] = {0x00,0x00,0x3C,0x66,0x06,0x0C,0x18,0x18,0x18,0x00,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['$'] = {0x00,0x00,0x18,0x3E,0x60,0x60,0x3C,0x06,0x06,0x7C,0x18,0x18,0x00,0x00,0x00,0x00},
+    ['%'] = {0x00,0x00,0x00,0x63,0x66,0x0C,0x18,0x30,0x60,0xCC,0x8C,0x00,0x00,0x00,0x00,0x00},
+    ['&'] = {0x00,0x00,0x38,0x6C,0x6C,0x38,0x76,0x6E,0x66,0x66,0x6E,0x3B,0x00,0x00,0x00,0x00},
+    ['['] = {0x00,0x00,0x3C,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x3C,0x00,0x00,0x00,0x00},
+    [']'] = {0x00,0x00,0x3C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x3C,0x00,0x00,0x00,0x00},
+    ['\\'] = {0x00,0x00,0x60,0x60,0x30,0x30,0x18,0x18,0x0C,0x0C,0x06,0x06,0x00,0x00,0x00,0x00},
+    ['^'] = {0x00,0x00,0x18,0x3C,0x66,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+    ['_'] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0x00,0x00},
+    ['{'] = {0x00,0x00,0x0E,0x18,0x18,0x18,0x70,0x18,0x18,0x18,0x18,0x0E,0x00,0x00,0x00,0x00},
+    ['}'] = {0x00,0x00,0x70,0x18,0x18,0x18,0x0E,0x18,0x18,0x18,0x18,0x70,0x00,0x00,0x00,0x00},
+    ['|'] = {0x00,0x00,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x00,0x00}
+};
+
+static const uint8_t (*active_font)[16] = font;
+
+// row byte -> per-pixel select mask, shared by the neon and scalar paths
+static uint32_t glyph_mask[256][8] __attribute__((aligned(16)));
+
+static void reset_dirty(void) {
+   for (uint32_t y = 0; y < FB_MAX_HEIGHT; y++) {
+       dirty_x0[y] = FB_CLEAN_X0;
+       dirty_x1[y] = 0;
+   }
+   dirty_y0 = FB_MAX_HEIGHT;
+   dirty_y1 = 0;
+}
+
+static void build_glyph_masks(void) {
+   for (int bits = 0; bits < 256; bits++) {
+       for (int col = 0; col < 8; col++) {
+           glyph_mask[bits][col] = (bits & (0x80 >> col)) ? 0xFFFFFFFF : 0;
+       }
+   }
+}
+
+static uint32_t* fb_target(void) {
+   return shadow ? shadow : (uint32_t*)fb.base_addr;
+}
+
+void fb_init(void) {
+   if (fb.size == 0) return;
+   
+   shadow = (uint32_t*)fb.base_addr;
+   reset_dirty();
+   build_glyph_masks();
+}
+
+void fb_set_font(const uint8_t (*glyphs)[16]) {
+   active_font = glyphs ? glyphs : font;
+}
+
+void fb_mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+   if (!shadow) return;
+   if (x >= fb.width || y >= fb.height) return;
+   if (x + w > fb.width) w = fb.width - x;
+   if (y + h > fb.height) h = fb.height - y;
+   
+   for (uint32_t row = y; row < y + h; row++) {
+       if (x < dirty_x0[row]) dirty_x0[row] = x;
+       if (x + w > dirty_x1[row]) dirty_x1[row] = x + w;
+   }
+   if (y < dirty_y0) dirty_y0 = y;
+   if (y + h > dirty_y1) dirty_y1 = y + h;
+}
+
+// consecutive dirty rows go to the device as one rectangle
+static void flush_virtio(void) {
+   uint32_t band_y = 0, band_x0 = 0, band_x1 = 0;
+   bool in_band = false;
+   
+   for (uint32_t y = dirty_y0; y <= dirty_y1; y++) {
+       bool dirty = y < dirty_y1 && dirty_x0[y] < dirty_x1[y];
+       if (dirty && !in_band) {
+           band_y = y;
+           band_x0 = dirty_x0[y];
+           band_x1 = dirty_x1[y];
+           in_band = true;
+       } else if (dirty) {
+           if (dirty_x0[y] < band_x0) band_x0 = dirty_x0[y];
+           if (dirty_x1[y] > band_x1) band_x1 = dirty_x1[y];
+       } else if (in_band) {
+           virtio_gpu_damage(band_x0, band_y, band_x1 - band_x0, y - band_y);
+           in_band = false;
+       }
+       if (dirty) {
+           dirty_x0[y] = FB_CLEAN_X0;
+           dirty_x1[y] = 0;
+       }
+   }
+   virtio_gpu_present();
+}
+
+void fb_flush(void) {
+   if (!shadow || dirty_y0 >= dirty_y1) return;
+   
+   flush_virtio();
+   dirty_y0 = FB_MAX_HEIGHT;
+   dirty_y1 = 0;
+}
+
+uint32_t* fb_backbuffer(void) {
+   return shadow;
+}
+
+struct fb_info* fb_get_info(void) {
+   return &fb;
+}
+
+void fb_clear(uint32_t color) {
+   uint32_t* fbptr = fb_target();
+   for (uint32_t i = 0; i < fb.width * fb.height; i++) {
+       fbptr[i] = color;
+   }
+   fb_mark_dirty(0, 0, fb.width, fb.height);
+   cursor_x = 0;
+   cursor_y = 0;
+}
+
+static void draw_glyph_clipped(const uint8_t* glyph, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
+   uint32_t* fbptr = fb_target();
+   
+   for (int row = 0; row < 16; row++) {
+       for (int col = 0; col < 8; col++) {
+           if (x + col >= fb.width || y + row >= fb.height) continue;
+           uint32_t color = (glyph[row] & (1 << (7 - col))) ? fg : bg;
+           fbptr[(y + row) * fb.width + (x + col)] = color;
+       }
+   }
+}
+
+// whole glyph on screen: one table lookup and a full-row store per line
+static void draw_glyph_fast(const uint8_t* glyph, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
+   uint32_t* dst = fb_target() + y * fb.width + x;
+   
+#if defined(__ARM_NEON)
+   uint32x4_t vfg = vdupq_n_u32(fg);
+   uint32x4_t vbg = vdupq_n_u32(bg);
+   for (int row = 0; row < 16; row++) {
+       const uint32_t* mask = glyph_mask[glyph[row]];
+       vst1q_u32(dst, vbslq_u32(vld1q_u32(mask), vfg, vbg));
+       vst1q_u32(dst + 4, vbslq_u32(vld1q_u32(mask + 4), vfg, vbg));
+       dst += fb.width;
+   }
+#else
+   uint64_t fg64 = ((uint64_t)fg << 32) | fg;
+   uint64_t bg64 = ((uint64_t)bg << 32) | bg;
+   uint64_t diff = fg64 ^ bg64;
+   for (int row = 0; row < 16; row++) {
+       const uint64_t* mask = (const uint64_t*)glyph_mask[glyph[row]];
+       uint64_t* out = (uint64_t*)dst;
+       out[0] = bg64 ^ (diff & mask[0]);
+       out[1] = bg64 ^ (diff & mask[1]);
+       out[2] = bg64 ^ (diff & mask[2]);
+       out[3] = bg64 ^ (diff & mask[3]);
+       dst += fb.width;
+   }
+#endif
+}
+
+void fb_putchar(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
+   if (x >= fb.width || y >= fb.height) return;
+   
+   const uint8_t* glyph = active_font[(uint8_t)c];
+   
+   // wide stores need the pixel pair aligned, and device memory faults otherwise
+   if (x + 8 <= fb.width && y + 16 <= fb.height && !(x & 1) && shadow) {
+       draw_glyph_fast(glyph, x, y, fg, bg);
+   } else {
+       draw_glyph_clipped(glyph, x, y, fg, bg);
+   }
+   fb_mark_dirty(x, y, 8, 16);
+}
+
+// renders count glyphs into the back buffer, returns glyphs per second
+uint64_t fb_bench_glyphs(uint32_t count) {
+   uint32_t cols = fb.width / 8;
+   uint32_t rows = fb.height / 16;
+   if (!shadow || cols == 0 || rows == 0 || count == 0) return 0;
+   
+   uint64_t start = ktime_get_ns();
+   for (uint32_t i = 0; i < count; i++) {
+       uint32_t cell = i % (cols * rows);
+       fb_putchar((char)(' ' + i % 95), (cell % cols) * 8, (cell / cols) * 16, 0xFFFFFF, 0x000000);
+   }
+   uint64_t ns = ktime_get_ns() - start;
+   
+   if (ns == 0) return 0;
+   return ((uint64_t)count * NSEC_PER_SEC) / ns;
+}
+
+void fb_puts(const char* str, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
+   cursor_x = x;
+   cursor_y = y;
+   while (*str) {
+       if (*str == '\n') {
+           cursor_y += 16;
+           cursor_x = x;
+       } else {
+           if (cursor_x < fb.width && cursor_y < fb.height) {
+               fb_putchar(*str, cursor_x, cursor_y, fg, bg);
+               cursor_x += 8;
+           }
+       }
+       str++;
+   }
+   fb_flush();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#define FB_MAX_HEIGHT 2048
+
+struct fb_info {
+    uint64_t base_addr;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t bpp;
+    uint32_t size;
+};
+
+int fb_detect(void);
+void fb_init(void);
+void fb_clear(uint32_t color);
+void fb_putchar(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg);
+void fb_puts(const char* str, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg);
+void fb_mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void fb_flush(void);
+uint32_t* fb_backbuffer(void);
+struct fb_info* fb_get_info(void);
+void fb_set_font(const uint8_t (*glyphs)[16]);
+uint64_t fb_bench_glyphs(uint32_t count);
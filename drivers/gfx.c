@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../vm_pages.h>
+#include <../cpu.h>
+#include <../timer.h>
+#include <sched.h>
+#include <fb.h>
+#include <virtio_gpu.h>
+#include <gfx.h>
+
+struct gfx_buffer {
+    struct gfx_surface surface;
+    int resource;
+};
+
+static struct gfx_buffer buffers[GFX_MAX_BUFFERS];
+static uint32_t nr_buffers = 0;
+static uint32_t nr_allocated = 0;
+static uint32_t back = 0;
+
+// without a flip-capable display, frames are copied into the console surface
+static bool can_flip = true;
+
+static uint64_t counter_freq = 0;
+static uint64_t frame_period = 0;
+static uint64_t next_deadline = 0;
+static uint64_t last_present = 0;
+static struct gfx_stats stats;
+
+int gfx_init(uint32_t count, uint32_t fps) {
+    struct fb_info* info = fb_get_info();
+    if (info->size == 0) return -1;
+    if (count < 2) count = 2;
+    if (count > GFX_MAX_BUFFERS) count = GFX_MAX_BUFFERS;
+    
+    // host resources can't be given back, so buffers outlive gfx_shutdown
+    for (uint32_t i = nr_allocated; i < count; i++) {
+        uint64_t base = 0;
+        int id = can_flip ? virtio_gpu_create_surface(&base) : -1;
+        if (id < 0) {
+            can_flip = false;
+            base = alloc_pages((info->size + PAGE_SIZE - 1) / PAGE_SIZE);
+            if (!base) return -1;
+        }
+        
+        buffers[i].surface.pixels = (uint32_t*)base;
+        buffers[i].surface.width = info->width;
+        buffers[i].surface.height = info->height;
+        buffers[i].surface.pitch = info->width;
+        buffers[i].resource = id;
+        nr_allocated++;
+    }
+    nr_buffers = count;
+    back = 0;
+    
+    counter_freq = timer_freq();
+    frame_period = fps ? counter_freq / fps : 0;
+    last_present = timer_counter();
+    next_deadline = last_present + frame_period;
+    stats = (struct gfx_stats){ 0 };
+    return 0;
+}
+
+struct gfx_surface* gfx_back_buffer(void) {
+    if (nr_buffers == 0) return NULL;
+    return &buffers[back].surface;
+}
+
+// sleep off whole scheduler ticks, then spin out the remainder
+static void wait_until(uint64_t deadline) {
+    uint64_t per_ms = counter_freq / 1000;
+    uint64_t now = timer_counter();
+    
+    if (deadline > now && (deadline - now) / per_ms > 1) {
+        task_sleep((deadline - now) / per_ms - 1);
+    }
+    while (timer_counter() < deadline) {
+        cpu_relax();
+    }
+}
+
+static int copy_to_console(struct gfx_surface* surface) {
+    uint32_t* dst = fb_backbuffer();
+    if (!dst) return -1;
+    
+    uint32_t words = surface->width * surface->height;
+    uint64_t* d = (uint64_t*)dst;
+    const uint64_t* s = (const uint64_t*)surface->pixels;
+    for (uint32_t i = 0; i < words / 2; i++) {
+        d[i] = s[i];
+    }
+    if (words & 1) {
+        dst[words - 1] = surface->pixels[words - 1];
+    }
+    fb_mark_dirty(0, 0, surface->width, surface->height);
+    fb_flush();
+    return 0;
+}
+
+int gfx_present(void) {
+    if (nr_buffers == 0) return -1;
+    
+    uint64_t now = timer_counter();
+    if (frame_period) {
+        if (now > next_deadline) {
+            // every whole period we overran is a frame the display never got
+            stats.dropped += (now - next_deadline) / frame_period + 1;
+            next_deadline = now;
+        } else {
+            wait_until(next_deadline);
+        }
+    }
+    
+    struct gfx_buffer* buf = &buffers[back];
+    uint64_t start = timer_counter();
+    int ret = can_flip ? virtio_gpu_flip(buf->resource) : copy_to_console(&buf->surface);
+    uint64_t end = timer_counter();
+    
+    uint64_t latency = timer_counter_to_ns(end - start);
+    stats.frames++;
+    stats.last_present_ns = latency;
+    if (latency > stats.max_present_ns) stats.max_present_ns = latency;
+    stats.avg_present_ns = stats.avg_present_ns - stats.avg_present_ns / 8 + latency / 8;
+    stats.last_frame_ns = timer_counter_to_ns(end - last_present);
+    last_present = end;
+    
+    if (frame_period) next_deadline += frame_period;
+    back = (back + 1) % nr_buffers;
+    return ret;
+}
+
+void gfx_get_stats(struct gfx_stats* out) {
+    *out = stats;
+}
+
+// hand the display back to the text console
+void gfx_shutdown(void) {
+    if (nr_buffers == 0) return;
+    if (can_flip) {
+        virtio_gpu_flip(VIRTIO_GPU_CONSOLE_RESOURCE);
+    }
+    nr_buffers = 0;
+}
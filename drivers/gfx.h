@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#define GFX_MAX_BUFFERS 3
+
+struct gfx_surface {
+    uint32_t* pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+};
+
+struct gfx_stats {
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t last_present_ns;
+    uint64_t max_present_ns;
+    uint64_t avg_present_ns;
+    uint64_t last_frame_ns;
+};
+
+int gfx_init(uint32_t buffers, uint32_t fps);
+struct gfx_surface* gfx_back_buffer(void);
+int gfx_present(void);
+void gfx_get_stats(struct gfx_stats* stats);
+void gfx_shutdown(void);
+
+#define GFX_MAX_WIDTH 4096
+
+void gfx_set_palette(const uint8_t* rgb);
+void gfx_blit_indexed(struct gfx_surface* dst, const uint8_t* src, uint32_t width, uint32_t height);
+void gfx_blit_indexed_ref(struct gfx_surface* dst, const uint8_t* src, uint32_t width, uint32_t height);
+uint64_t gfx_bench_blit(struct gfx_surface* dst, uint32_t frames, int reference);
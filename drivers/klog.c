@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <../cpu.h>
+#include <../spinlock.h>
+#include <../timer.h>
+#include <sched.h>
+#include <console.h>
+#include <kprintf.h>
+#include <klog.h>
+
+#define KLOG_DRAIN_PRIORITY 1
+#define KLOG_DRAIN_BATCH 32
+
+// a record's seq is 0 while it is being written and seq + 1 once committed
+static struct klog_record ring[KLOG_RECORDS];
+static uint64_t head = 0;
+
+// one drainer at a time, producers never wait on it. the lock only guards
+// the sink list, sinks are called with it dropped and irqs as the caller had them
+static uint32_t draining = 0;
+static spinlock_t sink_lock = SPINLOCK_INIT;
+static uint64_t tail = 0;
+static uint64_t dropped = 0;
+static struct klog_record batch[KLOG_DRAIN_BATCH];
+
+static struct klog_sink* sinks = NULL;
+static uint32_t drain_tid = 0;
+static uint32_t drain_idle = 0;
+
+void klog_vprintf(const char* format, va_list args) {
+    uint64_t seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct klog_record* rec = &ring[seq % KLOG_RECORDS];
+    
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    int len = kvsnprintf(rec->text, KLOG_LINE_MAX, format, args);
+    rec->len = len < KLOG_LINE_MAX ? len : KLOG_LINE_MAX - 1;
+    rec->cpu = smp_processor_id();
+    rec->timestamp_ns = ktime_get_ns();
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+    
+    if (drain_tid && __atomic_exchange_n(&drain_idle, 0, __ATOMIC_ACQ_REL)) {
+        task_wake(drain_tid);
+    }
+}
+
+// copy out one committed record, false if seq isn't there (yet or any more)
+static bool copy_record(uint64_t seq, struct klog_record* out) {
+    struct klog_record* rec = &ring[seq % KLOG_RECORDS];
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq + 1) return false;
+    
+    *out = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // a producer lapping us mid-copy would have reset seq
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+static uint64_t oldest(void) {
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    return h > KLOG_RECORDS ? h - KLOG_RECORDS : 0;
+}
+
+// returns the number of records handed to the sinks, 0 as well when
+// someone else is already draining
+static uint32_t drain(uint32_t budget) {
+    if (__atomic_exchange_n(&draining, 1, __ATOMIC_ACQUIRE)) return 0;
+    
+    uint64_t flags = spin_lock_irqsave(&sink_lock);
+    struct klog_sink* list = sinks;
+    spin_unlock_irqrestore(&sink_lock, flags);
+    
+    uint32_t done = 0;
+    while (done < budget) {
+        uint32_t n = 0;
+        while (n < KLOG_DRAIN_BATCH && done + n < budget && tail < __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+            uint64_t first = oldest();
+            if (tail < first) {
+                dropped += first - tail;
+                tail = first;
+            }
+            if (!copy_record(tail, &batch[n])) {
+                // still being written, or overwritten under us: retry from oldest next round
+                if (tail >= oldest()) break;
+                continue;
+            }
+            tail++;
+            n++;
+        }
+        if (!n) break;
+        
+        for (uint32_t i = 0; i < n; i++) {
+            for (struct klog_sink* s = list; s; s = s->next) {
+                s->write(batch[i].text, batch[i].len);
+            }
+        }
+        done += n;
+        if (n < KLOG_DRAIN_BATCH) break;
+    }
+    if (done) {
+        for (struct klog_sink* s = list; s; s = s->next) {
+            if (s->flush) s->flush();
+        }
+    }
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    return done;
+}
+
+static bool pending(void) {
+    return tail < __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+static void drain_loop(void) {
+    while (1) {
+        while (drain(KLOG_DRAIN_BATCH) == KLOG_DRAIN_BATCH) {
+            task_yield();
+        }
+        
+        __atomic_store_n(&drain_idle, 1, __ATOMIC_RELEASE);
+        if (pending()) {
+            // a producer claimed a slot but hasn't committed it yet. it may
+            // be below us on this cpu, so get out of its way before retrying
+            __atomic_store_n(&drain_idle, 0, __ATOMIC_RELEASE);
+            task_sleep(1);
+            continue;
+        }
+        task_block();
+    }
+}
+
+static void console_sink_write(const char* text, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        console_putc(text[i], 0xFFFFFF, 0x000000);
+    }
+}
+
+static struct klog_sink console_sink = {
+    .write = console_sink_write,
+    .flush = console_flush,
+    .next = NULL,
+};
+
+void klog_init(void) {
+    klog_register_sink(&console_sink);
+    drain_tid = task_create(drain_loop, KLOG_DRAIN_PRIORITY);
+}
+
+void klog_register_sink(struct klog_sink* sink) {
+    uint64_t flags = spin_lock_irqsave(&sink_lock);
+    sink->next = sinks;
+    sinks = sink;
+    spin_unlock_irqrestore(&sink_lock, flags);
+}
+
+// push everything out from the caller's context, for panics and early boot
+void klog_flush(void) {
+    while (drain(KLOG_RECORDS)) {
+    }
+}
+
+// walks history without consuming it, *seq is advanced past the record read
+int klog_read(uint64_t* seq, struct klog_record* out) {
+    while (*seq < __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        uint64_t first = oldest();
+        if (*seq < first) *seq = first;
+        if (copy_record(*seq, out)) {
+            (*seq)++;
+            return 0;
+        }
+        if (*seq >= oldest()) return -1;
+    }
+    return -1;
+}
+
+size_t dmesg(char* buf, size_t size) {
+    struct klog_record rec;
+    uint64_t seq = 0;
+    size_t len = 0;
+    
+    while (len + 1 < size && klog_read(&seq, &rec) == 0) {
+        len += ksnprintf(buf + len, size - len, "[%5lu.%06lu] %s",
+                         rec.timestamp_ns / 1000000000ULL,
+                         (rec.timestamp_ns / 1000) % 1000000, rec.text);
+    }
+    if (len >= size) len = size ? size - 1 : 0;
+    return len;
+}
+
+uint64_t klog_dropped(void) {
+    return dropped;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#define KLOG_RECORDS  512
+#define KLOG_LINE_MAX 104
+
+struct klog_record {
+    uint64_t seq;
+    uint64_t timestamp_ns;
+    uint16_t cpu;
+    uint16_t len;
+    char text[KLOG_LINE_MAX];
+};
+
+struct klog_sink {
+    void (*write)(const char* text, uint32_t len);
+    void (*flush)(void);
+    struct klog_sink* next;
+};
+
+void klog_init(void);
+void klog_vprintf(const char* format, va_list args);
+void klog_register_sink(struct klog_sink* sink);
+void klog_flush(void);
+int klog_read(uint64_t* seq, struct klog_record* out);
+size_t dmesg(char* buf, size_t size);
+uint64_t klog_dropped(void);
@@ -1,361 +1,190 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include <kprintf.h>
+#include <klog.h>
 
-extern void fb_print(const char* str, uint32_t fg, uint32_t bg);
-extern void fb_putchar(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg);
-extern void fb_newline(void);
+// bounded output cursor, keeps counting past the end like snprintf does
+struct out {
+    char* buf;
+    size_t size;
+    size_t len;
+};
 
-static char* itoa(int value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    unsigned long ud = value;
-    int divisor = 10;
-    
-    if (base == 16) {
-        divisor = 16;
-    } else if (base == 8) {
-        divisor = 8;
-    } else if (base == 2) {
-        divisor = 2;
-    }
-    
-    if (base == 10 && value < 0) {
-        *p++ = '-';
-        buffer++;
-        ud = -value;
+static inline void put(struct out* o, char c) {
+    if (o->len + 1 < o->size) {
+        o->buf[o->len] = c;
     }
-    
-    do {
-        int remainder = ud % divisor;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-    } while (ud /= divisor);
-    
-    *p = 0;
-    
-    p1 = buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
-    }
-    
-    return buffer;
+    o->len++;
 }
 
-static char* utoa(unsigned int value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    unsigned long ud = value;
-    int divisor = 10;
-    
-    if (base == 16) {
-        divisor = 16;
-    } else if (base == 8) {
-        divisor = 8;
-    } else if (base == 2) {
-        divisor = 2;
-    }
-    
-    do {
-        int remainder = ud % divisor;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-    } while (ud /= divisor);
-    
-    *p = 0;
-    
-    p1 = buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
+static void pad(struct out* o, char c, int count) {
+    for (int i = 0; i < count; i++) {
+        put(o, c);
     }
-    
-    return buffer;
 }
 
-static char* ltoa(long value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    unsigned long ud = value;
-    int divisor = 10;
-    
-    if (base == 16) {
-        divisor = 16;
-    } else if (base == 8) {
-        divisor = 8;
-    } else if (base == 2) {
-        divisor = 2;
-    }
-    
-    if (base == 10 && value < 0) {
-        *p++ = '-';
-        buffer++;
-        ud = -value;
-    }
-    
+// digits come out reversed into tmp, returns how many
+static int format_u64(uint64_t value, char* tmp, unsigned base, int upper) {
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    int n = 0;
     do {
-        int remainder = ud % divisor;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-    } while (ud /= divisor);
-    
-    *p = 0;
-    
-    p1 = buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
-    }
-    
-    return buffer;
+        tmp[n++] = digits[value % base];
+        value /= base;
+    } while (value);
+    return n;
 }
 
-static char* ultoa(unsigned long value, char* buffer, int base) {
-    char* p = buffer;
-    char* p1, *p2;
-    unsigned long ud = value;
-    int divisor = 10;
-    
-    if (base == 16) {
-        divisor = 16;
-    } else if (base == 8) {
-        divisor = 8;
-    } else if (base == 2) {
-        divisor = 2;
+static void emit_number(struct out* o, uint64_t value, int negative, unsigned base, int upper,
+                        int width, int left_align, int zero_pad) {
+    char tmp[64];
+    int n = format_u64(value, tmp, base, upper);
+    int len = n + (negative ? 1 : 0);
+    
+    if (!left_align && !zero_pad && width > len) {
+        pad(o, ' ', width - len);
     }
-    
-    do {
-        int remainder = ud % divisor;
-        *p++ = (remainder < 10) ? remainder + '0' : remainder + 'a' - 10;
-    } while (ud /= divisor);
-    
-    *p = 0;
-    
-    p1 = buffer;
-    p2 = p - 1;
-    while (p1 < p2) {
-        char tmp = *p1;
-        *p1 = *p2;
-        *p2 = tmp;
-        p1++;
-        p2--;
+    if (negative) {
+        put(o, '-');
     }
-    
-    return buffer;
-}
-
-static int strlen(const char* str) {
-    int len = 0;
-    while (str[len]) len++;
-    return len;
-}
-
-static void print_padding(char pad_char, int count) {
-    for (int i = 0; i < count; i++) {
-        char c = pad_char;
-        fb_print(&c, 0xFFFFFF, 0x000000);
+    if (!left_align && zero_pad && width > len) {
+        pad(o, '0', width - len);
+    }
+    while (n) {
+        put(o, tmp[--n]);
+    }
+    if (left_align && width > len) {
+        pad(o, ' ', width - len);
     }
 }
 
-void kprintf(const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    
-    char buffer[64];
+int kvsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    struct out o = { buf, size, 0 };
     const char* p = format;
     
     while (*p) {
-        if (*p == '%') {
+        if (*p != '%') {
+            put(&o, *p++);
+            continue;
+        }
+        p++;
+        
+        int width = 0;
+        int precision = -1;
+        int left_align = 0;
+        int zero_pad = 0;
+        int long_flag = 0;
+        
+        if (*p == '-') {
+            left_align = 1;
             p++;
-            int width = 0;
-            int precision = -1;
-            int left_align = 0;
-            int zero_pad = 0;
-            int long_flag = 0;
-            int unsigned_flag = 0;
-            
-            if (*p == '-') {
-                left_align = 1;
+        }
+        
+        if (*p == '0') {
+            zero_pad = 1;
+            p++;
+        }
+        
+        while (*p >= '0' && *p <= '9') {
+            width = width * 10 + (*p - '0');
+            p++;
+        }
+        
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            while (*p >= '0' && *p <= '9') {
+                precision = precision * 10 + (*p - '0');
                 p++;
             }
-            
-            if (*p == '0') {
-                zero_pad = 1;
-                p++;
+        }
+        
+        while (*p == 'l') {
+            long_flag = 1;
+            p++;
+        }
+        
+        switch (*p) {
+            case 'd':
+            case 'i': {
+                int64_t value = long_flag ? va_arg(args, long) : va_arg(args, int);
+                uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+                emit_number(&o, magnitude, value < 0, 10, 0, width, left_align, zero_pad);
+                break;
             }
-            
-            while (*p >= '0' && *p <= '9') {
-                width = width * 10 + (*p - '0');
-                p++;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'b': {
+                uint64_t value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                unsigned base = 10;
+                if (*p == 'x' || *p == 'X') base = 16;
+                else if (*p == 'o') base = 8;
+                else if (*p == 'b') base = 2;
+                emit_number(&o, value, 0, base, *p == 'X', width, left_align, zero_pad);
+                break;
             }
-            
-            if (*p == '.') {
-                p++;
-                precision = 0;
-                while (*p >= '0' && *p <= '9') {
-                    precision = precision * 10 + (*p - '0');
-                    p++;
-                }
+            case 'p': {
+                put(&o, '0');
+                put(&o, 'x');
+                emit_number(&o, (uint64_t)va_arg(args, void*), 0, 16, 0, 0, 0, 0);
+                break;
             }
-            
-            if (*p == 'l') {
-                long_flag = 1;
-                p++;
+            case 'c': {
+                put(&o, (char)va_arg(args, int));
+                break;
             }
-            
-            switch (*p) {
-                case 'd':
-                case 'i': {
-                    int value = long_flag ? va_arg(args, long) : va_arg(args, int);
-                    itoa(value, buffer, 10);
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
-                }
-                case 'u': {
-                    unsigned int value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
-                    utoa(value, buffer, 10);
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
-                }
-                case 'x': {
-                    unsigned int value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
-                    utoa(value, buffer, 16);
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
+            case 's': {
+                const char* str = va_arg(args, const char*);
+                if (!str) str = "(null)";
+                int len = 0;
+                while (str[len] && (precision < 0 || len < precision)) len++;
+                if (!left_align && width > len) {
+                    pad(&o, ' ', width - len);
                 }
-                case 'X': {
-                    unsigned int value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
-                    utoa(value, buffer, 16);
-                    for (int i = 0; buffer[i]; i++) {
-                        if (buffer[i] >= 'a' && buffer[i] <= 'f') {
-                            buffer[i] = buffer[i] - 'a' + 'A';
-                        }
-                    }
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
+                for (int i = 0; i < len; i++) {
+                    put(&o, str[i]);
                 }
-                case 'o': {
-                    unsigned int value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
-                    utoa(value, buffer, 8);
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
-                }
-                case 'b': {
-                    unsigned int value = long_flag ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
-                    utoa(value, buffer, 2);
-                    int len = strlen(buffer);
-                    if (!left_align && width > len) {
-                        print_padding(zero_pad ? '0' : ' ', width - len);
-                    }
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
-                }
-                case 'p': {
-                    void* ptr = va_arg(args, void*);
-                    fb_print("0x", 0xFFFFFF, 0x000000);
-                    ultoa((unsigned long)ptr, buffer, 16);
-                    fb_print(buffer, 0xFFFFFF, 0x000000);
-                    break;
-                }
-                case 'c': {
-                    char c = va_arg(args, int);
-                    char str[2] = {c, 0};
-                    fb_print(str, 0xFFFFFF, 0x000000);
-                    break;
-                }
-                case 's': {
-                    char* str = va_arg(args, char*);
-                    if (!str) str = "(null)";
-                    int len = strlen(str);
-                    if (precision >= 0 && len > precision) {
-                        len = precision;
-                    }
-                    if (!left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    for (int i = 0; i < len; i++) {
-                        char c = str[i];
-                        fb_print(&c, 0xFFFFFF, 0x000000);
-                    }
-                    if (left_align && width > len) {
-                        print_padding(' ', width - len);
-                    }
-                    break;
-                }
-                case 'n': {
-                    int* ptr = va_arg(args, int*);
-                    *ptr = 0;
-                    break;
-                }
-                case '%': {
-                    char c = '%';
-                    fb_print(&c, 0xFFFFFF, 0x000000);
-                    break;
-                }
-                default: {
-                    char c = *p;
-                    fb_print(&c, 0xFFFFFF, 0x000000);
-                    break;
+                if (left_align && width > len) {
+                    pad(&o, ' ', width - len);
                 }
+                break;
+            }
+            case 'n': {
+                int* ptr = va_arg(args, int*);
+                *ptr = (int)o.len;
+                break;
+            }
+            case '\0': {
+                continue;
             }
-        } else {
-            if (*p == '\n') {
-                fb_newline();
-            } else {
-                char c = *p;
-                fb_print(&c, 0xFFFFFF, 0x000000);
+            default: {
+                put(&o, *p);
+                break;
             }
         }
         p++;
     }
     
+    if (size) {
+        buf[o.len < size ? o.len : size - 1] = '\0';
+    }
+    return (int)o.len;
+}
+
+int ksnprintf(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = kvsnprintf(buf, size, format, args);
+    va_end(args);
+    return len;
+}
+
+// formatting happens straight into the log ring, the drain task does the drawing
+void kprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    klog_vprintf(format, args);
     va_end(args);
 }
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdarg.h>
+
+int kvsnprintf(char* buf, size_t size, const char* format, va_list args);
+int ksnprintf(char* buf, size_t size, const char* format, ...);
+void kprintf(const char* format, ...);
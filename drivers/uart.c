@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../vm_pages.h>
+#include <../cpu.h>
+#include <../spinlock.h>
+#include <../irq.h>
+#include <klog.h>
+#include <uart.h>
+
+#define UART_DR    0x00
+#define UART_FR    0x18
+#define UART_IBRD  0x24
+#define UART_FBRD  0x28
+#define UART_LCR_H 0x2C
+#define UART_CR    0x30
+#define UART_IFLS  0x34
+#define UART_IMSC  0x38
+#define UART_MIS   0x40
+#define UART_ICR   0x44
+
+#define FR_BUSY (1 << 3)
+#define FR_RXFE (1 << 4)
+#define FR_TXFF (1 << 5)
+
+#define LCR_FEN   (1 << 4)
+#define LCR_WLEN8 (3 << 5)
+
+#define CR_UARTEN (1 << 0)
+#define CR_TXE    (1 << 8)
+#define CR_RXE    (1 << 9)
+
+#define INT_RX (1 << 4)
+#define INT_TX (1 << 5)
+#define INT_RT (1 << 6)
+
+static char tx_ring[UART_TX_RING];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static char rx_ring[UART_RX_RING];
+static uint32_t rx_head = 0;
+static uint32_t rx_tail = 0;
+static uint32_t rx_dropped = 0;
+
+static spinlock_t tx_lock = SPINLOCK_INIT;
+static spinlock_t rx_lock = SPINLOCK_INIT;
+static uint32_t imsc = 0;
+static bool uart_ready = false;
+
+static inline uint32_t uart_read32(uint32_t offset) {
+    return *(volatile uint32_t*)((uint64_t)UART_BASE + offset);
+}
+
+static inline void uart_write32(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)((uint64_t)UART_BASE + offset) = value;
+}
+
+static void set_tx_irq(bool on) {
+    imsc = on ? (imsc | INT_TX) : (imsc & ~INT_TX);
+    uart_write32(UART_IMSC, imsc);
+}
+
+// move as much of the ring into the fifo as it will take, tx_lock held
+static void tx_fill(void) {
+    while (tx_tail != tx_head && !(uart_read32(UART_FR) & FR_TXFF)) {
+        uart_write32(UART_DR, (uint8_t)tx_ring[tx_tail % UART_TX_RING]);
+        tx_tail++;
+    }
+    set_tx_irq(tx_tail != tx_head);
+}
+
+static void rx_drain(void) {
+    spin_lock(&rx_lock);
+    while (!(uart_read32(UART_FR) & FR_RXFE)) {
+        char c = (char)uart_read32(UART_DR);
+        if (rx_head - rx_tail < UART_RX_RING) {
+            rx_ring[rx_head++ % UART_RX_RING] = c;
+        } else {
+            rx_dropped++;
+        }
+    }
+    spin_unlock(&rx_lock);
+}
+
+static void uart_irq(uint32_t irq, void* data) {
+    (void)irq;
+    (void)data;
+    
+    uint32_t mis = uart_read32(UART_MIS);
+    uart_write32(UART_ICR, mis);
+    
+    if (mis & (INT_RX | INT_RT)) {
+        rx_drain();
+    }
+    if (mis & INT_TX) {
+        spin_lock(&tx_lock);
+        tx_fill();
+        spin_unlock(&tx_lock);
+    }
+}
+
+void uart_putc_sync(char c) {
+    if (!uart_ready) return;
+    while (uart_read32(UART_FR) & FR_TXFF) {
+        cpu_relax();
+    }
+    uart_write32(UART_DR, (uint8_t)c);
+}
+
+void uart_write(const char* buf, uint32_t len) {
+    if (!uart_ready) return;
+    
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    for (uint32_t i = 0; i < len; i++) {
+        // a full ring means we are outrunning the line, push the oldest out by hand
+        while (tx_head - tx_tail >= UART_TX_RING) {
+            while (uart_read32(UART_FR) & FR_TXFF) {
+                cpu_relax();
+            }
+            tx_fill();
+        }
+        tx_ring[tx_head++ % UART_TX_RING] = buf[i];
+    }
+    tx_fill();
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void uart_puts(const char* str) {
+    uint32_t len = 0;
+    while (str[len]) len++;
+    uart_write(str, len);
+}
+
+int uart_getc(void) {
+    int c = -1;
+    uint64_t flags = spin_lock_irqsave(&rx_lock);
+    if (rx_tail != rx_head) {
+        c = (uint8_t)rx_ring[rx_tail++ % UART_RX_RING];
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    return c;
+}
+
+uint32_t uart_read(char* buf, uint32_t len) {
+    uint32_t n = 0;
+    uint64_t flags = spin_lock_irqsave(&rx_lock);
+    while (n < len && rx_tail != rx_head) {
+        buf[n++] = rx_ring[rx_tail++ % UART_RX_RING];
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    return n;
+}
+
+// terminals want \r\n, the log ring only stores \n
+static void uart_sink_write(const char* text, uint32_t len) {
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            uart_write(text + start, i - start);
+            uart_write("\r\n", 2);
+            start = i + 1;
+        }
+    }
+    uart_write(text + start, len - start);
+}
+
+static struct klog_sink uart_sink = {
+    .write = uart_sink_write,
+    .flush = NULL,
+    .next = NULL,
+};
+
+void uart_init(void) {
+    vm_map(UART_BASE, UART_BASE, PROT_READ | PROT_WRITE | PROT_DEVICE);
+    
+    uart_write32(UART_CR, 0);
+    while (uart_read32(UART_FR) & FR_BUSY) {
+        cpu_relax();
+    }
+    uart_write32(UART_ICR, 0x7FF);
+    
+    // 115200 8n1 off the 24 MHz reference clock
+    uart_write32(UART_IBRD, 13);
+    uart_write32(UART_FBRD, 1);
+    uart_write32(UART_LCR_H, LCR_FEN | LCR_WLEN8);
+    
+    // tx fires at 1/8 full, rx at 1/2 full plus the receive timeout
+    uart_write32(UART_IFLS, (2 << 3) | 0);
+    imsc = INT_RX | INT_RT;
+    uart_write32(UART_IMSC, imsc);
+    uart_write32(UART_CR, CR_UARTEN | CR_TXE | CR_RXE);
+    
+    irq_register(UART_IRQ, uart_irq, NULL);
+    irq_enable(UART_IRQ);
+    
+    uart_ready = true;
+    klog_register_sink(&uart_sink);
+}
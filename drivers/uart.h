@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// pl011 on qemu virt
+#define UART_BASE 0x09000000
+#define UART_IRQ  33
+
+#define UART_TX_RING 4096
+#define UART_RX_RING 256
+
+void uart_init(void);
+void uart_write(const char* buf, uint32_t len);
+void uart_puts(const char* str);
+void uart_putc_sync(char c);
+int uart_getc(void);
+uint32_t uart_read(char* buf, uint32_t len);
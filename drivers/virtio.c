@@ -0,0 +1,242 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../vm_pages.h>
+#include <../spinlock.h>
+#include <virtio.h>
+
+#define VIRTIO_LEGACY_ALIGN PAGE_SIZE
+
+static bool transports_mapped = false;
+
+static inline uint32_t vio_read(struct virtio_dev* dev, uint32_t offset) {
+    return *(volatile uint32_t*)(dev->base + offset);
+}
+
+static inline void vio_write(struct virtio_dev* dev, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(dev->base + offset) = value;
+}
+
+static inline void dma_wmb(void) {
+    __asm__ volatile("dmb ishst" ::: "memory");
+}
+
+static inline void dma_rmb(void) {
+    __asm__ volatile("dmb ishld" ::: "memory");
+}
+
+static void map_transports(void) {
+    if (transports_mapped) return;
+    
+    uint64_t end = VIRTIO_MMIO_BASE + VIRTIO_MMIO_SLOTS * VIRTIO_MMIO_STRIDE;
+    for (uint64_t addr = VIRTIO_MMIO_BASE; addr < end; addr += PAGE_SIZE) {
+        vm_map(addr, addr, PROT_READ | PROT_WRITE | PROT_DEVICE);
+    }
+    transports_mapped = true;
+}
+
+int virtio_find(uint32_t device_id, uint32_t instance, struct virtio_dev* dev) {
+    map_transports();
+    
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++) {
+        dev->base = VIRTIO_MMIO_BASE + (uint64_t)slot * VIRTIO_MMIO_STRIDE;
+        if (vio_read(dev, VIRTIO_MMIO_MAGIC) != VIRTIO_MAGIC) continue;
+        if (vio_read(dev, VIRTIO_MMIO_DEVICE_ID) != device_id) continue;
+        if (instance--) continue;
+        
+        dev->version = vio_read(dev, VIRTIO_MMIO_VERSION);
+        dev->device_id = device_id;
+        dev->irq = VIRTIO_MMIO_IRQ_BASE + slot;
+        dev->features = 0;
+        return 0;
+    }
+    return -1;
+}
+
+int virtio_negotiate(struct virtio_dev* dev, uint64_t wanted) {
+    vio_write(dev, VIRTIO_MMIO_STATUS, 0);
+    vio_write(dev, VIRTIO_MMIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    vio_write(dev, VIRTIO_MMIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    
+    vio_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint64_t offered = vio_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    vio_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    offered |= (uint64_t)vio_read(dev, VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+    
+    if (dev->version >= 2) {
+        wanted |= VIRTIO_F_VERSION_1;
+    }
+    dev->features = offered & wanted;
+    
+    vio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    vio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)dev->features);
+    vio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    vio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(dev->features >> 32));
+    
+    uint32_t status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+    if (dev->version >= 2) {
+        status |= VIRTIO_STATUS_FEATURES_OK;
+        vio_write(dev, VIRTIO_MMIO_STATUS, status);
+        if (!(vio_read(dev, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+            vio_write(dev, VIRTIO_MMIO_STATUS, VIRTIO_STATUS_FAILED);
+            return -1;
+        }
+    } else {
+        vio_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+    }
+    return 0;
+}
+
+void virtio_driver_ok(struct virtio_dev* dev) {
+    uint32_t status = vio_read(dev, VIRTIO_MMIO_STATUS);
+    vio_write(dev, VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+uint32_t virtio_ack_irq(struct virtio_dev* dev) {
+    uint32_t pending = vio_read(dev, VIRTIO_MMIO_INTERRUPT_STATUS);
+    vio_write(dev, VIRTIO_MMIO_INTERRUPT_ACK, pending);
+    return pending;
+}
+
+uint32_t virtio_config_read32(struct virtio_dev* dev, uint32_t offset) {
+    return vio_read(dev, VIRTIO_MMIO_CONFIG + offset);
+}
+
+// one contiguous block laid out the legacy way works for both transports
+int virtq_setup(struct virtio_dev* dev, struct virtqueue* vq, uint32_t index, uint32_t size) {
+    vio_write(dev, VIRTIO_MMIO_QUEUE_SEL, index);
+    
+    uint32_t max = vio_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (max == 0) return -1;
+    if (size == 0 || size > max) size = max;
+    if (size > VIRTQ_MAX_SIZE) size = VIRTQ_MAX_SIZE;
+    
+    uint64_t avail_off = 16 * size;
+    uint64_t used_off = (avail_off + 6 + 2 * size + VIRTIO_LEGACY_ALIGN - 1) & ~(uint64_t)(VIRTIO_LEGACY_ALIGN - 1);
+    uint64_t bytes = used_off + 6 + 8 * size;
+    
+    uint64_t mem = alloc_pages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!mem) return -1;
+    
+    vq->dev = dev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (volatile struct virtq_desc*)mem;
+    vq->avail = (volatile struct virtq_avail*)(mem + avail_off);
+    vq->used = (volatile struct virtq_used*)(mem + used_off);
+    vq->free_head = 0;
+    vq->num_free = size;
+    vq->avail_idx = 0;
+    vq->last_used = 0;
+    vq->lock.locked = 0;
+    
+    for (uint32_t i = 0; i < size; i++) {
+        vq->desc[i].next = (i + 1 < size) ? i + 1 : 0;
+        vq->cookies[i] = NULL;
+    }
+    
+    vio_write(dev, VIRTIO_MMIO_QUEUE_NUM, size);
+    if (dev->version >= 2) {
+        uint64_t avail = mem + avail_off;
+        uint64_t used = mem + used_off;
+        vio_write(dev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)mem);
+        vio_write(dev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(mem >> 32));
+        vio_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)avail);
+        vio_write(dev, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(avail >> 32));
+        vio_write(dev, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)used);
+        vio_write(dev, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(used >> 32));
+        vio_write(dev, VIRTIO_MMIO_QUEUE_READY, 1);
+    } else {
+        vio_write(dev, VIRTIO_MMIO_QUEUE_ALIGN, VIRTIO_LEGACY_ALIGN);
+        vio_write(dev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t)(mem / PAGE_SIZE));
+    }
+    return 0;
+}
+
+// out buffers are read by the device, in buffers are written by it
+int virtq_add(struct virtqueue* vq, const struct virtq_buf* bufs, uint32_t out, uint32_t in, void* cookie) {
+    uint32_t total = out + in;
+    if (total == 0) return -1;
+    
+    uint64_t flags = spin_lock_irqsave(&vq->lock);
+    if (vq->num_free < total) {
+        spin_unlock_irqrestore(&vq->lock, flags);
+        return -1;
+    }
+    
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    for (uint32_t i = 0; i < total; i++) {
+        volatile struct virtq_desc* d = &vq->desc[idx];
+        d->addr = bufs[i].addr;
+        d->len = bufs[i].len;
+        d->flags = (i >= out) ? VIRTQ_DESC_F_WRITE : 0;
+        if (i + 1 < total) {
+            d->flags |= VIRTQ_DESC_F_NEXT;
+        }
+        idx = d->next;
+    }
+    
+    vq->free_head = idx;
+    vq->num_free -= total;
+    vq->cookies[head] = cookie;
+    
+    vq->avail->ring[vq->avail_idx % vq->size] = head;
+    dma_wmb();
+    vq->avail_idx++;
+    vq->avail->idx = vq->avail_idx;
+    
+    spin_unlock_irqrestore(&vq->lock, flags);
+    return head;
+}
+
+void virtq_kick(struct virtqueue* vq) {
+    __asm__ volatile("dsb sy" ::: "memory");
+    if (vq->used->flags & VIRTQ_USED_F_NO_NOTIFY) return;
+    vio_write(vq->dev, VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+}
+
+bool virtq_has_used(struct virtqueue* vq) {
+    return vq->last_used != vq->used->idx;
+}
+
+void* virtq_get_used(struct virtqueue* vq, uint32_t* len) {
+    uint64_t flags = spin_lock_irqsave(&vq->lock);
+    if (vq->last_used == vq->used->idx) {
+        spin_unlock_irqrestore(&vq->lock, flags);
+        return NULL;
+    }
+    dma_rmb();
+    
+    volatile struct virtq_used_elem* elem = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = elem->id;
+    if (len) *len = elem->len;
+    vq->last_used++;
+    
+    // hand the chain back to the free list
+    uint16_t idx = head;
+    uint32_t count = 1;
+    while (vq->desc[idx].flags & VIRTQ_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+    
+    void* cookie = vq->cookies[head];
+    vq->cookies[head] = NULL;
+    spin_unlock_irqrestore(&vq->lock, flags);
+    return cookie;
+}
+
+void virtq_disable_irq(struct virtqueue* vq) {
+    vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
+
+// returns true if work slipped in while interrupts were off
+bool virtq_enable_irq(struct virtqueue* vq) {
+    vq->avail->flags = 0;
+    __asm__ volatile("dsb sy" ::: "memory");
+    return virtq_has_used(vq);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+
+// qemu virt: 32 virtio-mmio transports, 0x200 apart, on spi 16 upwards
+#define VIRTIO_MMIO_BASE     0x0A000000
+#define VIRTIO_MMIO_STRIDE   0x200
+#define VIRTIO_MMIO_SLOTS    32
+#define VIRTIO_MMIO_IRQ_BASE 48
+
+#define VIRTIO_MMIO_MAGIC           0x000
+#define VIRTIO_MMIO_VERSION         0x004
+#define VIRTIO_MMIO_DEVICE_ID       0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028
+#define VIRTIO_MMIO_QUEUE_SEL       0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX   0x034
+#define VIRTIO_MMIO_QUEUE_NUM       0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN     0x03C
+#define VIRTIO_MMIO_QUEUE_PFN       0x040
+#define VIRTIO_MMIO_QUEUE_READY     0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY    0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK   0x064
+#define VIRTIO_MMIO_STATUS          0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW  0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW  0x0A0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH 0x0A4
+#define VIRTIO_MMIO_CONFIG          0x100
+
+#define VIRTIO_MAGIC 0x74726976
+
+#define VIRTIO_ID_NET   1
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_ID_GPU   16
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED      128
+
+#define VIRTIO_F_VERSION_1 (1ULL << 32)
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY     1
+
+#define VIRTQ_MAX_SIZE 256
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+};
+
+struct virtio_dev {
+    uint64_t base;
+    uint32_t version;
+    uint32_t device_id;
+    uint32_t irq;
+    uint64_t features;
+};
+
+struct virtqueue {
+    struct virtio_dev* dev;
+    uint32_t index;
+    uint32_t size;
+    volatile struct virtq_desc* desc;
+    volatile struct virtq_avail* avail;
+    volatile struct virtq_used* used;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t avail_idx;
+    uint16_t last_used;
+    void* cookies[VIRTQ_MAX_SIZE];
+    spinlock_t lock;
+};
+
+struct virtq_buf {
+    uint64_t addr;
+    uint32_t len;
+};
+
+int virtio_find(uint32_t device_id, uint32_t instance, struct virtio_dev* dev);
+int virtio_negotiate(struct virtio_dev* dev, uint64_t wanted);
+void virtio_driver_ok(struct virtio_dev* dev);
+uint32_t virtio_ack_irq(struct virtio_dev* dev);
+uint32_t virtio_config_read32(struct virtio_dev* dev, uint32_t offset);
+
+int virtq_setup(struct virtio_dev* dev, struct virtqueue* vq, uint32_t index, uint32_t size);
+int virtq_add(struct virtqueue* vq, const struct virtq_buf* bufs, uint32_t out, uint32_t in, void* cookie);
+void virtq_kick(struct virtqueue* vq);
+void* virtq_get_used(struct virtqueue* vq, uint32_t* len);
+bool virtq_has_used(struct virtqueue* vq);
+void virtq_disable_irq(struct virtqueue* vq);
+bool virtq_enable_irq(struct virtqueue* vq);
@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../irq.h>
+#include <../sched/softirq.h>
+#include <virtio.h>
+#include <virtio_blk.h>
+#include <blk.h>
+
+#define VIRTIO_BLK_F_SEG_MAX  (1ULL << 2)
+#define VIRTIO_BLK_F_RO       (1ULL << 5)
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_S_OK  0
+
+struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+// header and status byte for every request the ring can hold
+struct vblk_cmd {
+    struct virtio_blk_req_hdr hdr;
+    uint8_t status;
+    bool busy;
+    struct blk_request* rq;
+};
+
+static struct virtio_dev blk_dev;
+static struct virtqueue requestq;
+static struct vblk_cmd cmds[BLK_MAX_REQUESTS];
+static uint32_t seg_max = BLK_MAX_SEGMENTS;
+
+static struct vblk_cmd* get_cmd(void) {
+    for (int i = 0; i < BLK_MAX_REQUESTS; i++) {
+        if (!cmds[i].busy) {
+            cmds[i].busy = true;
+            return &cmds[i];
+        }
+    }
+    return NULL;
+}
+
+// called under the block layer lock, -1 tells it the ring is full for now
+static int vblk_queue_rq(struct blk_request* rq) {
+    if (requestq.num_free < rq->nr_bios + 2) return -1;
+    
+    struct vblk_cmd* cmd = get_cmd();
+    if (!cmd) return -1;
+    
+    cmd->hdr.type = rq->op == BLK_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    cmd->hdr.reserved = 0;
+    cmd->hdr.sector = rq->sector;
+    cmd->status = 0xFF;
+    cmd->rq = rq;
+    
+    // header, one descriptor per merged bio, then the status byte
+    struct virtq_buf bufs[BLK_MAX_SEGMENTS + 2];
+    uint32_t n = 0;
+    bufs[n++] = (struct virtq_buf){ (uint64_t)&cmd->hdr, sizeof(cmd->hdr) };
+    for (struct bio* bio = rq->bios; bio; bio = bio->next) {
+        bufs[n++] = (struct virtq_buf){ (uint64_t)bio->buf, bio->len };
+    }
+    bufs[n++] = (struct virtq_buf){ (uint64_t)&cmd->status, 1 };
+    
+    uint32_t out = rq->op == BLK_WRITE ? n - 1 : 1;
+    if (virtq_add(&requestq, bufs, out, n - out, cmd) < 0) {
+        cmd->busy = false;
+        return -1;
+    }
+    return 0;
+}
+
+static void vblk_commit(void) {
+    virtq_kick(&requestq);
+}
+
+static const struct blk_ops vblk_ops = {
+    .queue_rq = vblk_queue_rq,
+    .commit = vblk_commit,
+};
+
+static void blk_softirq(void) {
+    do {
+        struct vblk_cmd* cmd;
+        while ((cmd = virtq_get_used(&requestq, NULL))) {
+            struct blk_request* rq = cmd->rq;
+            int status = cmd->status == VIRTIO_BLK_S_OK ? BLK_OK : BLK_EIO;
+            cmd->busy = false;
+            blk_complete(rq, status);
+        }
+        // the ring has room again, let anything that piled up go out
+        blk_run_queue();
+    } while (virtq_enable_irq(&requestq));
+}
+
+static void virtio_blk_irq(uint32_t irq, void* data) {
+    (void)irq;
+    (void)data;
+    
+    virtio_ack_irq(&blk_dev);
+    virtq_disable_irq(&requestq);
+    raise_softirq(SOFTIRQ_BLOCK);
+}
+
+int virtio_blk_init(void) {
+    if (virtio_find(VIRTIO_ID_BLOCK, 0, &blk_dev) < 0) return -1;
+    if (virtio_negotiate(&blk_dev, VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO) < 0) return -1;
+    if (virtq_setup(&blk_dev, &requestq, 0, VIRTQ_MAX_SIZE) < 0) return -1;
+    
+    uint64_t capacity = virtio_config_read32(&blk_dev, 0);
+    capacity |= (uint64_t)virtio_config_read32(&blk_dev, 4) << 32;
+    
+    if (blk_dev.features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t max = virtio_config_read32(&blk_dev, 12);
+        if (max && max < seg_max) seg_max = max;
+    }
+    
+    for (int i = 0; i < BLK_MAX_REQUESTS; i++) {
+        cmds[i].busy = false;
+    }
+    
+    open_softirq(SOFTIRQ_BLOCK, blk_softirq);
+    irq_register(blk_dev.irq, virtio_blk_irq, NULL);
+    irq_enable(blk_dev.irq);
+    virtio_driver_ok(&blk_dev);
+    
+    blk_register(&vblk_ops, capacity, seg_max, blk_dev.features & VIRTIO_BLK_F_RO);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// registers the first virtio-blk transport with the block layer
+int virtio_blk_init(void);
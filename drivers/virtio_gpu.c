@@ -0,0 +1,377 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../vm_pages.h>
+#include <../cpu.h>
+#include <../spinlock.h>
+#include <virtio.h>
+#include <virtio_gpu.h>
+
+#define VIRTIO_GPU_CMD_GET_DISPLAY_INFO        0x0100
+#define VIRTIO_GPU_CMD_RESOURCE_CREATE_2D      0x0101
+#define VIRTIO_GPU_CMD_SET_SCANOUT             0x0103
+#define VIRTIO_GPU_CMD_RESOURCE_FLUSH          0x0104
+#define VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D     0x0105
+#define VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING 0x0106
+
+#define VIRTIO_GPU_RESP_OK_NODATA       0x1100
+#define VIRTIO_GPU_RESP_OK_DISPLAY_INFO 0x1101
+
+#define VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM 2
+#define VIRTIO_GPU_MAX_SCANOUTS 16
+
+#define VGPU_MAX_INFLIGHT 16
+#define VGPU_MAX_RESOURCES 8
+
+struct virtio_gpu_ctrl_hdr {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t fence_id;
+    uint32_t ctx_id;
+    uint32_t padding;
+};
+
+struct virtio_gpu_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct virtio_gpu_resp_display_info {
+    struct virtio_gpu_ctrl_hdr hdr;
+    struct {
+        struct virtio_gpu_rect r;
+        uint32_t enabled;
+        uint32_t flags;
+    } pmodes[VIRTIO_GPU_MAX_SCANOUTS];
+};
+
+struct virtio_gpu_resource_create_2d {
+    struct virtio_gpu_ctrl_hdr hdr;
+    uint32_t resource_id;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct virtio_gpu_mem_entry {
+    uint64_t addr;
+    uint32_t length;
+    uint32_t padding;
+};
+
+struct virtio_gpu_resource_attach_backing {
+    struct virtio_gpu_ctrl_hdr hdr;
+    uint32_t resource_id;
+    uint32_t nr_entries;
+    struct virtio_gpu_mem_entry entry;
+};
+
+struct virtio_gpu_set_scanout {
+    struct virtio_gpu_ctrl_hdr hdr;
+    struct virtio_gpu_rect r;
+    uint32_t scanout_id;
+    uint32_t resource_id;
+};
+
+struct virtio_gpu_transfer_to_host_2d {
+    struct virtio_gpu_ctrl_hdr hdr;
+    struct virtio_gpu_rect r;
+    uint64_t offset;
+    uint32_t resource_id;
+    uint32_t padding;
+};
+
+struct virtio_gpu_resource_flush {
+    struct virtio_gpu_ctrl_hdr hdr;
+    struct virtio_gpu_rect r;
+    uint32_t resource_id;
+    uint32_t padding;
+};
+
+// every request owns a slot until the device hands it back
+struct vgpu_slot {
+    union {
+        struct virtio_gpu_ctrl_hdr hdr;
+        struct virtio_gpu_resource_create_2d create;
+        struct virtio_gpu_resource_attach_backing attach;
+        struct virtio_gpu_set_scanout scanout;
+        struct virtio_gpu_transfer_to_host_2d transfer;
+        struct virtio_gpu_resource_flush flush;
+    } req;
+    struct virtio_gpu_ctrl_hdr resp;
+    bool busy;
+};
+
+static struct virtio_dev gpu_dev;
+static struct virtqueue controlq;
+static struct vgpu_slot slots[VGPU_MAX_INFLIGHT];
+static struct virtio_gpu_resp_display_info display_info;
+static uint32_t inflight = 0;
+// the console flush from the klog drainer and gfx run on any task or cpu.
+// guards the slots, inflight, the controlq and the damage box
+static spinlock_t gpu_lock = SPINLOCK_INIT;
+
+static struct fb_info mode;
+static bool gpu_ready = false;
+static uint32_t next_resource = VIRTIO_GPU_CONSOLE_RESOURCE;
+static uint32_t scanout_resource = 0;
+
+// union of everything transferred since the last present
+static uint32_t damage_x0, damage_y0, damage_x1, damage_y1;
+
+static void reset_damage(void) {
+    damage_x0 = mode.width;
+    damage_y0 = mode.height;
+    damage_x1 = 0;
+    damage_y1 = 0;
+}
+
+// gpu_lock held
+static void reap(void) {
+    struct vgpu_slot* slot;
+    while ((slot = virtq_get_used(&controlq, NULL))) {
+        slot->busy = false;
+        inflight--;
+    }
+}
+
+static void kick(void) {
+    uint64_t flags = spin_lock_irqsave(&gpu_lock);
+    virtq_kick(&controlq);
+    spin_unlock_irqrestore(&gpu_lock, flags);
+}
+
+// spins with the lock dropped so other cpus can reap and queue meanwhile
+static void wait_idle(void) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&gpu_lock);
+        reap();
+        bool idle = inflight == 0;
+        spin_unlock_irqrestore(&gpu_lock, flags);
+        if (idle) return;
+        cpu_relax();
+    }
+}
+
+// the slot belongs to the caller until it is queued
+static struct vgpu_slot* get_slot(void) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&gpu_lock);
+        reap();
+        for (int i = 0; i < VGPU_MAX_INFLIGHT; i++) {
+            if (!slots[i].busy) {
+                slots[i].busy = true;
+                slots[i].resp.type = 0;
+                spin_unlock_irqrestore(&gpu_lock, flags);
+                return &slots[i];
+            }
+        }
+        // all in flight, make sure the device is working on them
+        virtq_kick(&controlq);
+        spin_unlock_irqrestore(&gpu_lock, flags);
+        cpu_relax();
+    }
+}
+
+static int queue_slot(struct vgpu_slot* slot, uint32_t type, uint32_t len) {
+    slot->req.hdr.type = type;
+    slot->req.hdr.flags = 0;
+    slot->req.hdr.fence_id = 0;
+    slot->req.hdr.ctx_id = 0;
+    slot->req.hdr.padding = 0;
+    
+    struct virtq_buf bufs[2] = {
+        { (uint64_t)&slot->req, len },
+        { (uint64_t)&slot->resp, sizeof(slot->resp) },
+    };
+    uint64_t flags = spin_lock_irqsave(&gpu_lock);
+    if (virtq_add(&controlq, bufs, 1, 1, slot) < 0) {
+        slot->busy = false;
+        spin_unlock_irqrestore(&gpu_lock, flags);
+        return -1;
+    }
+    inflight++;
+    spin_unlock_irqrestore(&gpu_lock, flags);
+    return 0;
+}
+
+// setup commands are rare, just run them to completion
+static int run_slot(struct vgpu_slot* slot, uint32_t type, uint32_t len) {
+    if (queue_slot(slot, type, len) < 0) return -1;
+    kick();
+    wait_idle();
+    return slot->resp.type == VIRTIO_GPU_RESP_OK_NODATA ? 0 : -1;
+}
+
+static int get_display_info(void) {
+    static struct virtio_gpu_ctrl_hdr req;
+    req.type = VIRTIO_GPU_CMD_GET_DISPLAY_INFO;
+    
+    struct virtq_buf bufs[2] = {
+        { (uint64_t)&req, sizeof(req) },
+        { (uint64_t)&display_info, sizeof(display_info) },
+    };
+    if (virtq_add(&controlq, bufs, 1, 1, &display_info) < 0) return -1;
+    virtq_kick(&controlq);
+    
+    while (!virtq_get_used(&controlq, NULL)) {
+        cpu_relax();
+    }
+    return display_info.hdr.type == VIRTIO_GPU_RESP_OK_DISPLAY_INFO ? 0 : -1;
+}
+
+static int pick_mode(void) {
+    for (int i = 0; i < VIRTIO_GPU_MAX_SCANOUTS; i++) {
+        if (!display_info.pmodes[i].enabled) continue;
+        
+        mode.width = display_info.pmodes[i].r.width;
+        mode.height = display_info.pmodes[i].r.height;
+        if (mode.height > FB_MAX_HEIGHT) mode.height = FB_MAX_HEIGHT;
+        return 0;
+    }
+    return -1;
+}
+
+static int create_resource(uint32_t id, uint64_t base) {
+    struct vgpu_slot* slot = get_slot();
+    slot->req.create.resource_id = id;
+    slot->req.create.format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+    slot->req.create.width = mode.width;
+    slot->req.create.height = mode.height;
+    if (run_slot(slot, VIRTIO_GPU_CMD_RESOURCE_CREATE_2D, sizeof(slot->req.create)) < 0) return -1;
+    
+    // the backing store is plain cached ram, the device copies out of it on transfer
+    slot = get_slot();
+    slot->req.attach.resource_id = id;
+    slot->req.attach.nr_entries = 1;
+    slot->req.attach.entry.addr = base;
+    slot->req.attach.entry.length = mode.size;
+    slot->req.attach.entry.padding = 0;
+    return run_slot(slot, VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING, sizeof(slot->req.attach));
+}
+
+static int queue_transfer(uint32_t id, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    struct vgpu_slot* slot = get_slot();
+    if (!slot) return -1;
+    slot->req.transfer.r = (struct virtio_gpu_rect){ x, y, w, h };
+    slot->req.transfer.offset = (uint64_t)y * mode.pitch + (uint64_t)x * 4;
+    slot->req.transfer.resource_id = id;
+    slot->req.transfer.padding = 0;
+    return queue_slot(slot, VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D, sizeof(slot->req.transfer));
+}
+
+static int queue_flush(uint32_t id, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    struct vgpu_slot* slot = get_slot();
+    if (!slot) return -1;
+    slot->req.flush.r = (struct virtio_gpu_rect){ x, y, w, h };
+    slot->req.flush.resource_id = id;
+    slot->req.flush.padding = 0;
+    return queue_slot(slot, VIRTIO_GPU_CMD_RESOURCE_FLUSH, sizeof(slot->req.flush));
+}
+
+static int queue_scanout(uint32_t id) {
+    struct vgpu_slot* slot = get_slot();
+    if (!slot) return -1;
+    slot->req.scanout.r = (struct virtio_gpu_rect){ 0, 0, mode.width, mode.height };
+    slot->req.scanout.scanout_id = 0;
+    slot->req.scanout.resource_id = id;
+    return queue_slot(slot, VIRTIO_GPU_CMD_SET_SCANOUT, sizeof(slot->req.scanout));
+}
+
+int virtio_gpu_init(struct fb_info* info) {
+    if (virtio_find(VIRTIO_ID_GPU, 0, &gpu_dev) < 0) return -1;
+    if (virtio_negotiate(&gpu_dev, 0) < 0) return -1;
+    if (virtq_setup(&gpu_dev, &controlq, 0, VGPU_MAX_INFLIGHT * 2) < 0) return -1;
+    virtio_driver_ok(&gpu_dev);
+    
+    if (get_display_info() < 0 || pick_mode() < 0) return -1;
+    
+    mode.pitch = mode.width * 4;
+    mode.bpp = 32;
+    mode.size = mode.pitch * mode.height;
+    mode.base_addr = alloc_pages((mode.size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!mode.base_addr) return -1;
+    
+    if (create_resource(next_resource, mode.base_addr) < 0) return -1;
+    next_resource++;
+    if (queue_scanout(VIRTIO_GPU_CONSOLE_RESOURCE) < 0) return -1;
+    kick();
+    wait_idle();
+    scanout_resource = VIRTIO_GPU_CONSOLE_RESOURCE;
+    
+    reset_damage();
+    gpu_ready = true;
+    *info = mode;
+    return 0;
+}
+
+// queue a transfer for one damaged rectangle, nothing is shown until present
+int virtio_gpu_damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    if (!gpu_ready || w == 0 || h == 0) return -1;
+    
+    if (queue_transfer(VIRTIO_GPU_CONSOLE_RESOURCE, x, y, w, h) < 0) return -1;
+    
+    uint64_t flags = spin_lock_irqsave(&gpu_lock);
+    if (x < damage_x0) damage_x0 = x;
+    if (y < damage_y0) damage_y0 = y;
+    if (x + w > damage_x1) damage_x1 = x + w;
+    if (y + h > damage_y1) damage_y1 = y + h;
+    spin_unlock_irqrestore(&gpu_lock, flags);
+    return 0;
+}
+
+int virtio_gpu_present(void) {
+    if (!gpu_ready) return -1;
+    
+    // damage that lands after the box is taken waits for the next present
+    uint64_t flags = spin_lock_irqsave(&gpu_lock);
+    uint32_t x0 = damage_x0, y0 = damage_y0, x1 = damage_x1, y1 = damage_y1;
+    reset_damage();
+    spin_unlock_irqrestore(&gpu_lock, flags);
+    if (x0 >= x1 || y0 >= y1) return 0;
+    
+    int ret = queue_flush(VIRTIO_GPU_CONSOLE_RESOURCE, x0, y0, x1 - x0, y1 - y0);
+    
+    // one notification covers every transfer queued since the last present
+    kick();
+    wait_idle();
+    return ret;
+}
+
+// full-screen surfaces for page flipping, each one its own host resource
+int virtio_gpu_create_surface(uint64_t* base) {
+    if (!gpu_ready) return -1;
+    
+    uint64_t flags = spin_lock_irqsave(&gpu_lock);
+    uint32_t id = next_resource;
+    if (id <= VGPU_MAX_RESOURCES) next_resource++;
+    spin_unlock_irqrestore(&gpu_lock, flags);
+    if (id > VGPU_MAX_RESOURCES) return -1;
+    
+    uint64_t pages = alloc_pages((mode.size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!pages) return -1;
+    if (create_resource(id, pages) < 0) return -1;
+    
+    *base = pages;
+    return id;
+}
+
+// upload the whole surface and point the scanout at it
+int virtio_gpu_flip(uint32_t resource_id) {
+    if (!gpu_ready) return -1;
+    
+    int ret = queue_transfer(resource_id, 0, 0, mode.width, mode.height);
+    if (ret == 0 && resource_id != scanout_resource) {
+        ret = queue_scanout(resource_id);
+    }
+    if (ret == 0) {
+        ret = queue_flush(resource_id, 0, 0, mode.width, mode.height);
+    }
+    
+    kick();
+    wait_idle();
+    if (ret == 0) scanout_resource = resource_id;
+    return ret;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <fb.h>
+
+#define VIRTIO_GPU_CONSOLE_RESOURCE 1
+
+int virtio_gpu_init(struct fb_info* info);
+int virtio_gpu_damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+int virtio_gpu_present(void);
+int virtio_gpu_create_surface(uint64_t* base);
+int virtio_gpu_flip(uint32_t resource_id);
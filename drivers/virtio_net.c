@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../irq.h>
+#include <../timer.h>
+#include <../sched/softirq.h>
+#include <virtio.h>
+#include <virtio_net.h>
+
+#define VIRTIO_NET_F_MAC     (1ULL << 5)
+#define VIRTIO_NET_F_STATUS  (1ULL << 16)
+#define VIRTIO_F_ANY_LAYOUT  (1ULL << 27)
+
+#define VIRTIO_NET_RXQ 0
+#define VIRTIO_NET_TXQ 1
+
+// legacy devices without mergeable buffers leave num_buffers off the end
+#define VIRTIO_NET_HDR_LEGACY 10
+#define VIRTIO_NET_HDR_V1     12
+
+struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+};
+
+struct net_tx_slot {
+    struct virtio_net_hdr hdr;
+    struct pbuf* p;
+    struct net_tx_slot* next;
+};
+
+static struct virtio_dev net_dev;
+static struct virtqueue rxq;
+static struct virtqueue txq;
+static uint32_t hdr_len = VIRTIO_NET_HDR_LEGACY;
+static uint8_t mac_addr[NET_ETH_ALEN];
+static bool net_ready = false;
+
+static struct net_tx_slot tx_slots[NET_TX_SLOTS];
+static struct net_tx_slot* tx_free = NULL;
+static spinlock_t tx_lock = SPINLOCK_INIT;
+
+static virtio_net_rx_handler rx_handler = NULL;
+static volatile uint32_t napi_scheduled = 0;
+static struct virtio_net_stats net_stats;
+
+// the virtio header lands in the headroom so the frame starts at p->data
+static void rx_refill(void) {
+    bool added = false;
+    
+    while (rxq.num_free) {
+        struct pbuf* p = pbuf_alloc(0);
+        if (!p) break;
+        
+        struct virtq_buf buf = { (uint64_t)(p->data - hdr_len), hdr_len + pbuf_tailroom(p) };
+        if (virtq_add(&rxq, &buf, 0, 1, p) < 0) {
+            pbuf_free(p);
+            break;
+        }
+        added = true;
+    }
+    
+    if (added) virtq_kick(&rxq);
+}
+
+// called with tx_lock held, tx interrupts stay off so completions are
+// only picked up here
+static void tx_reap(void) {
+    struct net_tx_slot* slot;
+    while ((slot = virtq_get_used(&txq, NULL))) {
+        pbuf_free(slot->p);
+        slot->next = tx_free;
+        tx_free = slot;
+    }
+}
+
+static void net_rx_action(void) {
+    net_stats.polls++;
+    
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    tx_reap();
+    spin_unlock_irqrestore(&tx_lock, flags);
+    
+    struct pbuf* batch[NET_NAPI_BUDGET];
+    uint32_t count = 0;
+    uint32_t done = 0;
+    uint32_t len;
+    struct pbuf* p;
+    while (done < NET_NAPI_BUDGET && (p = virtq_get_used(&rxq, &len))) {
+        done++;
+        
+        if (len <= hdr_len || !rx_handler) {
+            net_stats.rx_dropped++;
+            pbuf_free(p);
+            continue;
+        }
+        
+        p->len = len - hdr_len;
+        p->tot_len = p->len;
+        net_stats.rx_packets++;
+        net_stats.rx_bytes += p->len;
+        batch[count++] = p;
+    }
+    
+    rx_refill();
+    if (count) rx_handler(batch, count);
+    
+    // still busy, keep polling with the device interrupt masked
+    if (done == NET_NAPI_BUDGET) {
+        net_stats.budget_exhausted++;
+        raise_softirq(SOFTIRQ_NET_RX);
+        return;
+    }
+    
+    __atomic_store_n(&napi_scheduled, 0, __ATOMIC_RELEASE);
+    if (virtq_enable_irq(&rxq) && !__atomic_exchange_n(&napi_scheduled, 1, __ATOMIC_ACQUIRE)) {
+        virtq_disable_irq(&rxq);
+        raise_softirq(SOFTIRQ_NET_RX);
+    }
+}
+
+static void virtio_net_irq(uint32_t irq, void* data) {
+    (void)irq;
+    (void)data;
+    
+    virtio_ack_irq(&net_dev);
+    net_stats.irqs++;
+    
+    if (!__atomic_exchange_n(&napi_scheduled, 1, __ATOMIC_ACQUIRE)) {
+        virtq_disable_irq(&rxq);
+        raise_softirq(SOFTIRQ_NET_RX);
+    }
+}
+
+int virtio_net_init(void) {
+    if (virtio_find(VIRTIO_ID_NET, 0, &net_dev) < 0) return -1;
+    if (virtio_negotiate(&net_dev, VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_F_ANY_LAYOUT) < 0) return -1;
+    
+    hdr_len = (net_dev.features & VIRTIO_F_VERSION_1) ? VIRTIO_NET_HDR_V1 : VIRTIO_NET_HDR_LEGACY;
+    
+    if (virtq_setup(&net_dev, &rxq, VIRTIO_NET_RXQ, VIRTQ_MAX_SIZE) < 0) return -1;
+    if (virtq_setup(&net_dev, &txq, VIRTIO_NET_TXQ, VIRTQ_MAX_SIZE) < 0) return -1;
+    
+    if (net_dev.features & VIRTIO_NET_F_MAC) {
+        uint32_t lo = virtio_config_read32(&net_dev, 0);
+        uint32_t hi = virtio_config_read32(&net_dev, 4);
+        for (int i = 0; i < 4; i++) mac_addr[i] = lo >> (8 * i);
+        mac_addr[4] = hi;
+        mac_addr[5] = hi >> 8;
+    } else {
+        // locally administered fallback
+        const uint8_t fallback[NET_ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+        for (int i = 0; i < NET_ETH_ALEN; i++) mac_addr[i] = fallback[i];
+    }
+    
+    tx_free = NULL;
+    for (int i = NET_TX_SLOTS - 1; i >= 0; i--) {
+        tx_slots[i].next = tx_free;
+        tx_free = &tx_slots[i];
+    }
+    
+    rx_refill();
+    virtq_disable_irq(&txq);
+    
+    open_softirq(SOFTIRQ_NET_RX, net_rx_action);
+    irq_register(net_dev.irq, virtio_net_irq, NULL);
+    irq_enable(net_dev.irq);
+    
+    virtio_driver_ok(&net_dev);
+    virtq_kick(&rxq);
+    net_ready = true;
+    return 0;
+}
+
+bool virtio_net_ready(void) {
+    return net_ready;
+}
+
+void virtio_net_get_mac(uint8_t* mac) {
+    for (int i = 0; i < NET_ETH_ALEN; i++) {
+        mac[i] = mac_addr[i];
+    }
+}
+
+void virtio_net_set_rx_handler(virtio_net_rx_handler handler) {
+    rx_handler = handler;
+}
+
+// takes ownership of p on success, on failure the caller still holds it
+int virtio_net_xmit(struct pbuf* p) {
+    uint32_t nfrags = pbuf_count(p);
+    if (!net_ready || nfrags == 0 || nfrags > NET_TX_MAX_FRAGS) return -1;
+    if (p->tot_len > NET_ETH_FRAME_MAX) return -1;
+    
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    if (!tx_free || txq.num_free < nfrags + 1) {
+        tx_reap();
+    }
+    
+    struct net_tx_slot* slot = tx_free;
+    if (!slot || txq.num_free < nfrags + 1) {
+        net_stats.tx_busy++;
+        spin_unlock_irqrestore(&tx_lock, flags);
+        return -1;
+    }
+    tx_free = slot->next;
+    
+    slot->hdr = (struct virtio_net_hdr){ 0 };
+    slot->p = p;
+    
+    // header in its own descriptor so clones can go out without touching
+    // their shared headroom, then one descriptor per fragment
+    struct virtq_buf bufs[NET_TX_MAX_FRAGS + 1];
+    bufs[0] = (struct virtq_buf){ (uint64_t)&slot->hdr, hdr_len };
+    uint32_t n = 1;
+    for (struct pbuf* q = p; q; q = q->next) {
+        bufs[n++] = (struct virtq_buf){ (uint64_t)q->data, q->len };
+    }
+    
+    virtq_add(&txq, bufs, nfrags + 1, 0, slot);
+    virtq_kick(&txq);
+    
+    net_stats.tx_packets++;
+    net_stats.tx_bytes += p->tot_len;
+    spin_unlock_irqrestore(&tx_lock, flags);
+    return 0;
+}
+
+// copying path for callers that don't want to keep the frame alive
+int virtio_net_send(const void* frame, uint32_t len) {
+    if (len > NET_ETH_FRAME_MAX) return -1;
+    
+    struct pbuf* p = pbuf_alloc(len);
+    if (!p) return -1;
+    
+    pbuf_copy_in(p, 0, frame, len);
+    if (virtio_net_xmit(p) < 0) {
+        pbuf_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+void virtio_net_get_stats(struct virtio_net_stats* stats) {
+    *stats = net_stats;
+}
+
+// blasts minimum size broadcast frames for ms milliseconds, returns packets per second
+uint64_t virtio_net_bench_tx(uint32_t ms) {
+    if (!net_ready || ms == 0) return 0;
+    
+    uint8_t frame[60] = { 0 };
+    for (int i = 0; i < NET_ETH_ALEN; i++) {
+        frame[i] = 0xFF;
+        frame[NET_ETH_ALEN + i] = mac_addr[i];
+    }
+    // local experimental ethertype
+    frame[12] = 0x88;
+    frame[13] = 0xB5;
+    
+    struct pbuf* tmpl = pbuf_alloc(sizeof(frame));
+    if (!tmpl) return 0;
+    pbuf_copy_in(tmpl, 0, frame, sizeof(frame));
+    
+    // every packet is a clone of the same buffer, only the descriptor is new
+    uint64_t sent = 0;
+    uint64_t start = ktime_get_ns();
+    uint64_t end = start + (uint64_t)ms * 1000000;
+    
+    while (ktime_get_ns() < end) {
+        struct pbuf* p = pbuf_clone(tmpl);
+        if (!p) continue;
+        if (virtio_net_xmit(p) == 0) {
+            sent++;
+        } else {
+            pbuf_free(p);
+        }
+    }
+    pbuf_free(tmpl);
+    
+    uint64_t elapsed = ktime_get_ns() - start;
+    return sent * 1000000000ULL / elapsed;
+}
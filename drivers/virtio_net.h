@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <virtio.h>
+#include <../internet/pbuf.h>
+
+#define NET_ETH_ALEN     6
+#define NET_ETH_FRAME_MAX 1514
+
+#define NET_TX_SLOTS     128
+#define NET_TX_MAX_FRAGS 8
+
+// packets handled per poll before giving the cpu back
+#define NET_NAPI_BUDGET  64
+
+struct virtio_net_stats {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_dropped;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_busy;
+    uint64_t irqs;
+    uint64_t polls;
+    uint64_t budget_exhausted;
+};
+
+// the device writes straight into the pbufs, each poll hands up everything
+// it reaped in one call and the handler owns and frees them
+typedef void (*virtio_net_rx_handler)(struct pbuf** batch, uint32_t count);
+
+int virtio_net_init(void);
+bool virtio_net_ready(void);
+void virtio_net_get_mac(uint8_t* mac);
+void virtio_net_set_rx_handler(virtio_net_rx_handler handler);
+int virtio_net_xmit(struct pbuf* p);
+int virtio_net_send(const void* frame, uint32_t len);
+void virtio_net_get_stats(struct virtio_net_stats* stats);
+uint64_t virtio_net_bench_tx(uint32_t ms);
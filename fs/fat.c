@@ -0,0 +1,792 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../vm_pages.h>
+#include <../pagecache.h>
+#include <../timer.h>
+#include <../drivers/blk.h>
+#include <fat.h>
+
+#define FAT_BENCH_MAX_CHUNK (1024 * 1024)
+#define LFN_CHARS       13
+#define LFN_MAX_ENTRIES 20
+
+// count clusters of the file from file_cluster on sit back to back on
+// disk, starting at disk_cluster
+struct fat_extent {
+    uint32_t file_cluster;
+    uint32_t disk_cluster;
+    uint32_t count;
+};
+
+// idle inodes keep their extents and cached pages until the slot is reused
+struct fat_inode {
+    bool used;
+    bool dir;
+    uint32_t refs;
+    uint32_t cluster;
+    uint32_t size;
+    struct fat_extent* extents;
+    uint32_t nr_extents;
+    uint32_t extent_pages;
+    uint32_t last_extent;
+    struct fat_extent inline_extents[FAT_INLINE_EXTENTS];
+    struct pcache_mapping mapping;
+};
+
+struct fat_file {
+    bool used;
+    struct fat_inode* inode;
+    uint64_t pos;
+};
+
+struct fat_dentry {
+    bool used;
+    uint32_t parent;
+    uint32_t hash;
+    uint32_t len;
+    char name[FAT_DENTRY_NAME];
+    uint8_t attr;
+    uint32_t cluster;
+    uint32_t size;
+    struct fat_dentry* next;
+};
+
+struct dir_iter {
+    struct fat_inode* dir;
+    uint32_t pos;
+    struct pcache_page* page;
+    uint64_t page_index;
+    uint32_t scanned;
+};
+
+static bool mounted = false;
+static uint64_t data_start;
+static uint32_t cluster_size;
+static uint32_t cluster_shift;
+static uint32_t sectors_per_cluster;
+static uint32_t nr_clusters;
+static uint32_t root_cluster;
+
+static uint32_t* fat;
+static uint32_t fat_entries;
+
+static struct fat_inode inodes[FAT_MAX_INODES];
+static uint32_t inode_hand = 0;
+static struct fat_file files[FAT_MAX_FILES];
+
+static struct fat_dentry dentries[FAT_DENTRIES];
+static struct fat_dentry* dentry_hash[FAT_DENTRY_HASH_SIZE];
+static uint32_t dentry_hand = 0;
+
+static spinlock_t fat_lock = SPINLOCK_INIT;
+static struct fat_stats stats;
+
+static inline uint32_t read32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static uint32_t str_len(const char* s) {
+    uint32_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+// names match without regard to case, like the rest of the FAT world
+static bool names_equal(const char* a, uint32_t alen, const char* b, uint32_t blen) {
+    if (alen != blen) return false;
+    for (uint32_t i = 0; i < alen; i++) {
+        if (lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+static uint32_t name_hash(uint32_t parent, const char* name, uint32_t len) {
+    uint32_t h = 2166136261u ^ parent;
+    for (uint32_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)lower(name[i])) * 16777619u;
+    }
+    return h;
+}
+
+static inline bool valid_cluster(uint32_t c) {
+    return c >= 2 && c < nr_clusters + 2;
+}
+
+static inline uint32_t fat_next(uint32_t c) {
+    return c < fat_entries ? fat[c] & FAT_ENTRY_MASK : FAT_ENTRY_BAD;
+}
+
+static void free_extents(struct fat_inode* ino) {
+    uint64_t mem = (uint64_t)ino->extents;
+    for (uint32_t i = 0; i < ino->extent_pages; i++) {
+        free_page(mem + (uint64_t)i * PAGE_SIZE);
+    }
+    ino->extents = ino->inline_extents;
+    ino->extent_pages = 0;
+    ino->nr_extents = 0;
+}
+
+// walks the in-memory FAT once to size the list and once to fill it.
+// a chain that stops short, loops or runs into a free or bad cluster is an error
+static int build_extents(struct fat_inode* ino, uint32_t max_clusters) {
+    ino->extents = ino->inline_extents;
+    ino->nr_extents = 0;
+    ino->extent_pages = 0;
+    ino->last_extent = 0;
+    if (!ino->cluster) return max_clusters && !ino->dir ? FAT_EIO : FAT_OK;
+    
+    uint32_t n = 0;
+    uint32_t count = 0;
+    uint32_t c = ino->cluster;
+    uint32_t prev = 0;
+    while (count < max_clusters && valid_cluster(c)) {
+        if (!count || c != prev + 1) n++;
+        prev = c;
+        count++;
+        c = fat_next(c);
+    }
+    // a file's chain has to cover its size, only a directory ends at EOC
+    if (ino->dir) {
+        if (count == max_clusters || c < FAT_ENTRY_EOC) return FAT_EIO;
+    } else if (count < max_clusters) {
+        return FAT_EIO;
+    }
+    
+    if (n > FAT_INLINE_EXTENTS) {
+        uint32_t pages = (n * sizeof(struct fat_extent) + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint64_t mem = alloc_pages(pages);
+        if (!mem) return FAT_ENOMEM;
+        ino->extents = (struct fat_extent*)mem;
+        ino->extent_pages = pages;
+    }
+    
+    struct fat_extent* e = NULL;
+    c = ino->cluster;
+    for (uint32_t i = 0; i < count; i++) {
+        if (e && c == e->disk_cluster + e->count) {
+            e->count++;
+        } else {
+            e = &ino->extents[ino->nr_extents++];
+            e->file_cluster = i;
+            e->disk_cluster = c;
+            e->count = 1;
+        }
+        c = fat_next(c);
+    }
+    stats.extents += n;
+    return FAT_OK;
+}
+
+// sequential reads keep hitting the last extent or the one after it
+static struct fat_extent* find_extent(struct fat_inode* ino, uint32_t fc) {
+    uint32_t n = ino->nr_extents;
+    uint32_t i = ino->last_extent;
+    for (uint32_t k = 0; k < 2 && i + k < n; k++) {
+        struct fat_extent* e = &ino->extents[i + k];
+        if (fc >= e->file_cluster && fc < e->file_cluster + e->count) {
+            ino->last_extent = i + k;
+            return e;
+        }
+    }
+    
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (ino->extents[mid].file_cluster <= fc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (!lo) return NULL;
+    struct fat_extent* e = &ino->extents[lo - 1];
+    if (fc >= e->file_cluster + e->count) return NULL;
+    ino->last_extent = lo - 1;
+    return e;
+}
+
+// a page is one run per contiguous stretch of clusters, which is a single
+// run unless clusters are smaller than a page and the file is fragmented
+static int fat_map(struct pcache_mapping* m, uint64_t index, struct pcache_run* runs, int max) {
+    struct fat_inode* ino = m->private;
+    uint64_t off = index << PAGE_SHIFT;
+    uint32_t left = PAGE_SIZE;
+    int n = 0;
+    
+    while (left) {
+        uint32_t fc = off >> cluster_shift;
+        uint32_t in = off & (cluster_size - 1);
+        struct fat_extent* e = find_extent(ino, fc);
+        if (!e) break;
+        if (n == max) return -1;
+        
+        uint64_t bytes = ((uint64_t)(e->file_cluster + e->count - fc) << cluster_shift) - in;
+        if (bytes > left) bytes = left;
+        runs[n].sector = data_start + (uint64_t)(e->disk_cluster + (fc - e->file_cluster) - 2) * sectors_per_cluster + (in >> BLK_SECTOR_SHIFT);
+        runs[n].count = bytes >> BLK_SECTOR_SHIFT;
+        n++;
+        off += bytes;
+        left -= bytes;
+    }
+    return n;
+}
+
+static const struct pcache_mapping_ops fat_mapping_ops = {
+    .map = fat_map,
+};
+
+static int get_inode(uint32_t cluster, uint32_t size, bool dir, struct fat_inode** out) {
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    for (int i = 0; i < FAT_MAX_INODES && cluster; i++) {
+        struct fat_inode* ino = &inodes[i];
+        if (ino->used && ino->cluster == cluster) {
+            ino->refs++;
+            spin_unlock_irqrestore(&fat_lock, flags);
+            *out = ino;
+            return FAT_OK;
+        }
+    }
+    
+    // a free slot if there is one, otherwise the next idle inode round robin
+    struct fat_inode* ino = NULL;
+    for (uint32_t i = 0; i < FAT_MAX_INODES && (!ino || ino->used); i++) {
+        struct fat_inode* c = &inodes[(inode_hand + i) % FAT_MAX_INODES];
+        if (!c->used || (!c->refs && !ino)) ino = c;
+    }
+    if (!ino) {
+        spin_unlock_irqrestore(&fat_lock, flags);
+        return FAT_ENFILE;
+    }
+    inode_hand = (ino - inodes + 1) % FAT_MAX_INODES;
+    if (ino->used) {
+        pcache_invalidate(&ino->mapping);
+        free_extents(ino);
+    }
+    
+    ino->used = true;
+    ino->dir = dir;
+    ino->refs = 1;
+    ino->cluster = cluster;
+    ino->size = size;
+    uint32_t max = dir ? nr_clusters + 1 : (uint32_t)(((uint64_t)size + cluster_size - 1) >> cluster_shift);
+    int err = build_extents(ino, max);
+    if (err != FAT_OK) {
+        free_extents(ino);
+        ino->used = false;
+        spin_unlock_irqrestore(&fat_lock, flags);
+        return err;
+    }
+    
+    // directories have no size of their own, they are as long as their chain
+    if (dir && ino->nr_extents) {
+        struct fat_extent* last = &ino->extents[ino->nr_extents - 1];
+        ino->size = (last->file_cluster + last->count) << cluster_shift;
+    }
+    pcache_mapping_init(&ino->mapping, &fat_mapping_ops, ino, ((uint64_t)ino->size + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    stats.inode_loads++;
+    spin_unlock_irqrestore(&fat_lock, flags);
+    
+    *out = ino;
+    return FAT_OK;
+}
+
+static void put_inode(struct fat_inode* ino) {
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    ino->refs--;
+    spin_unlock_irqrestore(&fat_lock, flags);
+}
+
+static struct fat_dentry* dentry_find(uint32_t parent, uint32_t hash, const char* name, uint32_t len) {
+    struct fat_dentry* de = dentry_hash[hash & (FAT_DENTRY_HASH_SIZE - 1)];
+    while (de) {
+        if (de->hash == hash && de->parent == parent && names_equal(de->name, de->len, name, len)) return de;
+        de = de->next;
+    }
+    return NULL;
+}
+
+// fifo replacement, the oldest entry makes room. names too long for a slot
+// are looked up the slow way every time
+static void dentry_insert(uint32_t parent, uint32_t hash, const char* name, uint32_t len, const struct fat_dirent* d) {
+    if (len >= FAT_DENTRY_NAME || dentry_find(parent, hash, name, len)) return;
+    
+    struct fat_dentry* de = &dentries[dentry_hand];
+    dentry_hand = (dentry_hand + 1) % FAT_DENTRIES;
+    if (de->used) {
+        struct fat_dentry** pp = &dentry_hash[de->hash & (FAT_DENTRY_HASH_SIZE - 1)];
+        while (*pp != de) {
+            pp = &(*pp)->next;
+        }
+        *pp = de->next;
+    }
+    
+    de->used = true;
+    de->parent = parent;
+    de->hash = hash;
+    de->len = len;
+    for (uint32_t i = 0; i < len; i++) {
+        de->name[i] = name[i];
+    }
+    de->attr = d->attr;
+    de->cluster = d->cluster;
+    de->size = d->size;
+    de->next = dentry_hash[hash & (FAT_DENTRY_HASH_SIZE - 1)];
+    dentry_hash[hash & (FAT_DENTRY_HASH_SIZE - 1)] = de;
+}
+
+static uint8_t lfn_checksum(const uint8_t* name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+// anything outside ascii comes out as '?'
+static void lfn_copy(char* lfn, const struct fat_lfn_entry* l) {
+    uint16_t chars[LFN_CHARS];
+    for (int i = 0; i < 5; i++) chars[i] = l->name1[i];
+    for (int i = 0; i < 6; i++) chars[5 + i] = l->name2[i];
+    for (int i = 0; i < 2; i++) chars[11 + i] = l->name3[i];
+    
+    uint32_t base = ((l->order & 0x1F) - 1) * LFN_CHARS;
+    for (uint32_t i = 0; i < LFN_CHARS && base + i < FAT_NAME_MAX - 1; i++) {
+        uint16_t c = chars[i];
+        if (c == 0xFFFF) break;
+        lfn[base + i] = c < 0x80 ? (char)c : '?';
+        if (!c) break;
+    }
+}
+
+static void short_name(const struct fat_dir_entry* de, char* out) {
+    uint32_t n = 0;
+    for (int i = 0; i < 8 && de->name[i] != ' '; i++) {
+        char c = (i == 0 && de->name[0] == 0x05) ? (char)0xE5 : (char)de->name[i];
+        out[n++] = (de->nt_flags & 0x08) ? lower(c) : c;
+    }
+    if (de->name[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && de->name[i] != ' '; i++) {
+            out[n++] = (de->nt_flags & 0x10) ? lower(de->name[i]) : (char)de->name[i];
+        }
+    }
+    out[n] = 0;
+}
+
+// the next live entry, under its long name when it has a valid one.
+// returns 1 per entry, 0 at the end of the directory
+static int dir_next(struct dir_iter* it, struct fat_dirent* out) {
+    struct fat_inode* dir = it->dir;
+    uint32_t entries = dir->size / sizeof(struct fat_dir_entry);
+    int expect = -1;
+    uint8_t sum = 0;
+    
+    while (it->pos < entries) {
+        uint64_t off = (uint64_t)it->pos * sizeof(struct fat_dir_entry);
+        uint64_t index = off >> PAGE_SHIFT;
+        if (!it->page || it->page_index != index) {
+            if (it->page) pcache_put(it->page);
+            it->page = pcache_get(&dir->mapping, index);
+            if (!it->page) return FAT_EIO;
+            it->page_index = index;
+        }
+        const uint8_t* raw = (const uint8_t*)pcache_data(it->page) + (off & (PAGE_SIZE - 1));
+        const struct fat_dir_entry* de = (const struct fat_dir_entry*)raw;
+        it->pos++;
+        it->scanned++;
+        
+        if (de->name[0] == 0) {
+            it->pos = entries;
+            return 0;
+        }
+        if (de->name[0] == 0xE5) {
+            expect = -1;
+            continue;
+        }
+        
+        if (de->attr == FAT_ATTR_LFN) {
+            const struct fat_lfn_entry* l = (const struct fat_lfn_entry*)raw;
+            int order = l->order & 0x1F;
+            if (l->order & 0x40) {
+                if (order == 0 || order > LFN_MAX_ENTRIES) {
+                    expect = -1;
+                    continue;
+                }
+                expect = order;
+                sum = l->checksum;
+                uint32_t end = order * LFN_CHARS;
+                out->name[end < FAT_NAME_MAX ? end : FAT_NAME_MAX - 1] = 0;
+            }
+            if (expect < 1 || order != expect || l->checksum != sum) {
+                expect = -1;
+                continue;
+            }
+            lfn_copy(out->name, l);
+            expect--;
+            continue;
+        }
+        
+        bool dot = de->name[0] == '.' && (de->name[1] == ' ' || (de->name[1] == '.' && de->name[2] == ' '));
+        if ((de->attr & FAT_ATTR_VOLUME_ID) || dot) {
+            expect = -1;
+            continue;
+        }
+        
+        if (expect != 0 || lfn_checksum(de->name) != sum) short_name(de, out->name);
+        out->attr = de->attr;
+        out->cluster = ((uint32_t)de->cluster_hi << 16) | de->cluster_lo;
+        out->size = (de->attr & FAT_ATTR_DIRECTORY) ? 0 : de->size;
+        return 1;
+    }
+    return 0;
+}
+
+static int lookup_child(uint32_t parent, const char* name, uint32_t len, struct fat_dirent* out) {
+    uint32_t hash = name_hash(parent, name, len);
+    
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    struct fat_dentry* de = dentry_find(parent, hash, name, len);
+    if (de) {
+        out->attr = de->attr;
+        out->cluster = de->cluster;
+        out->size = de->size;
+        stats.dentry_hits++;
+        spin_unlock_irqrestore(&fat_lock, flags);
+        return FAT_OK;
+    }
+    stats.dentry_misses++;
+    spin_unlock_irqrestore(&fat_lock, flags);
+    
+    struct fat_inode* dir;
+    int err = get_inode(parent, 0, true, &dir);
+    if (err != FAT_OK) return err;
+    
+    struct dir_iter it = { dir, 0, NULL, 0, 0 };
+    while ((err = dir_next(&it, out)) == 1) {
+        if (names_equal(out->name, str_len(out->name), name, len)) break;
+    }
+    if (it.page) pcache_put(it.page);
+    put_inode(dir);
+    
+    flags = spin_lock_irqsave(&fat_lock);
+    stats.dir_entries_scanned += it.scanned;
+    if (err == 1) dentry_insert(parent, hash, name, len, out);
+    spin_unlock_irqrestore(&fat_lock, flags);
+    
+    if (err == 1) return FAT_OK;
+    return err == 0 ? FAT_ENOENT : err;
+}
+
+// absolute or not, every path starts at the root
+static int lookup_path(const char* path, struct fat_dirent* out) {
+    out->name[0] = 0;
+    out->attr = FAT_ATTR_DIRECTORY;
+    out->cluster = root_cluster;
+    out->size = 0;
+    
+    const char* p = path;
+    while (1) {
+        while (*p == '/') p++;
+        if (!*p) return FAT_OK;
+        
+        const char* name = p;
+        while (*p && *p != '/') p++;
+        uint32_t len = p - name;
+        if (len == 1 && name[0] == '.') continue;
+        
+        if (!(out->attr & FAT_ATTR_DIRECTORY)) return FAT_ENOTDIR;
+        if (len >= FAT_NAME_MAX) return FAT_ENOENT;
+        int err = lookup_child(out->cluster, name, len, out);
+        if (err != FAT_OK) return err;
+    }
+}
+
+static bool is_fat32(const uint8_t* sector) {
+    const struct fat_bpb* bpb = (const struct fat_bpb*)sector;
+    uint8_t spc = bpb->sectors_per_cluster;
+    return sector[510] == 0x55 && sector[511] == 0xAA &&
+        bpb->bytes_per_sector == BLK_SECTOR_SIZE &&
+        spc && !(spc & (spc - 1)) &&
+        bpb->nr_fats && bpb->reserved_sectors &&
+        bpb->root_entries == 0 && bpb->fat_size16 == 0 &&
+        bpb->fat_size32 && bpb->root_cluster >= 2;
+}
+
+static int load_fat(uint64_t start, uint32_t sectors) {
+    uint32_t bytes = fat_entries * sizeof(uint32_t);
+    if ((uint64_t)sectors * BLK_SECTOR_SIZE < bytes) return FAT_EIO;
+    
+    uint32_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t mem = alloc_pages(pages);
+    if (!mem) return FAT_ENOMEM;
+    
+    uint32_t count = (bytes + BLK_SECTOR_SIZE - 1) / BLK_SECTOR_SIZE;
+    for (uint32_t done = 0; done < count; ) {
+        uint32_t n = count - done < BLK_MAX_SECTORS ? count - done : BLK_MAX_SECTORS;
+        if (blk_read(start + done, (uint8_t*)mem + (uint64_t)done * BLK_SECTOR_SIZE, n) != BLK_OK) {
+            for (uint32_t i = 0; i < pages; i++) {
+                free_page(mem + (uint64_t)i * PAGE_SIZE);
+            }
+            return FAT_EIO;
+        }
+        done += n;
+    }
+    fat = (uint32_t*)mem;
+    stats.fat_bytes = bytes;
+    return FAT_OK;
+}
+
+static int probe(uint8_t* sector, uint64_t* start) {
+    *start = 0;
+    if (blk_read(0, sector, 1) != BLK_OK) return FAT_EIO;
+    if (is_fat32(sector)) return FAT_OK;
+    if (sector[510] != 0x55 || sector[511] != 0xAA) return FAT_EINVAL;
+    
+    // mbr, take the first FAT32 partition
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* part = sector + 446 + i * 16;
+        if (part[4] != 0x0B && part[4] != 0x0C) continue;
+        *start = read32(part + 8);
+        if (blk_read(*start, sector, 1) != BLK_OK) return FAT_EIO;
+        return is_fat32(sector) ? FAT_OK : FAT_EINVAL;
+    }
+    return FAT_EINVAL;
+}
+
+int fat_mount(void) {
+    if (mounted) return FAT_OK;
+    if (!blk_ready()) return FAT_ENODEV;
+    
+    uint64_t page = alloc_page();
+    if (!page) return FAT_ENOMEM;
+    uint64_t start;
+    int err = probe((uint8_t*)page, &start);
+    if (err != FAT_OK) {
+        free_page(page);
+        return err;
+    }
+    
+    const struct fat_bpb* bpb = (const struct fat_bpb*)page;
+    uint32_t total = bpb->total_sectors32 ? bpb->total_sectors32 : bpb->total_sectors16;
+    uint32_t fat_sectors = bpb->fat_size32;
+    uint64_t meta = bpb->reserved_sectors + (uint64_t)bpb->nr_fats * fat_sectors;
+    uint64_t fat_start = start + bpb->reserved_sectors;
+    sectors_per_cluster = bpb->sectors_per_cluster;
+    root_cluster = bpb->root_cluster;
+    free_page(page);
+    
+    if (meta >= total || start + total > blk_capacity()) return FAT_EINVAL;
+    data_start = start + meta;
+    cluster_size = sectors_per_cluster * BLK_SECTOR_SIZE;
+    cluster_shift = __builtin_ctz(cluster_size);
+    nr_clusters = (total - meta) / sectors_per_cluster;
+    fat_entries = nr_clusters + 2;
+    if (!valid_cluster(root_cluster)) return FAT_EINVAL;
+    
+    err = load_fat(fat_start, fat_sectors);
+    if (err != FAT_OK) return err;
+    
+    for (int i = 0; i < FAT_DENTRY_HASH_SIZE; i++) {
+        dentry_hash[i] = NULL;
+    }
+    for (int i = 0; i < FAT_DENTRIES; i++) {
+        dentries[i].used = false;
+    }
+    for (int i = 0; i < FAT_MAX_INODES; i++) {
+        inodes[i].used = false;
+    }
+    for (int i = 0; i < FAT_MAX_FILES; i++) {
+        files[i].used = false;
+    }
+    mounted = true;
+    return FAT_OK;
+}
+
+bool fat_mounted(void) {
+    return mounted;
+}
+
+static struct fat_file* get_file(int fd) {
+    if (fd < 0 || fd >= FAT_MAX_FILES || !files[fd].used) return NULL;
+    return &files[fd];
+}
+
+int fat_open(const char* path) {
+    if (!mounted) return FAT_ENODEV;
+    
+    struct fat_dirent d;
+    int err = lookup_path(path, &d);
+    if (err != FAT_OK) return err;
+    
+    struct fat_inode* ino;
+    err = get_inode(d.cluster, d.size, d.attr & FAT_ATTR_DIRECTORY, &ino);
+    if (err != FAT_OK) return err;
+    
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    for (int i = 0; i < FAT_MAX_FILES; i++) {
+        if (files[i].used) continue;
+        files[i].used = true;
+        files[i].inode = ino;
+        files[i].pos = 0;
+        spin_unlock_irqrestore(&fat_lock, flags);
+        return i;
+    }
+    spin_unlock_irqrestore(&fat_lock, flags);
+    put_inode(ino);
+    return FAT_ENFILE;
+}
+
+int fat_close(int fd) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    f->inode->refs--;
+    f->used = false;
+    spin_unlock_irqrestore(&fat_lock, flags);
+    return FAT_OK;
+}
+
+int fat_pread(int fd, uint64_t offset, void* buf, uint32_t len) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    struct fat_inode* ino = f->inode;
+    if (ino->dir) return FAT_EISDIR;
+    if (offset >= ino->size || !len) return 0;
+    if (len > ino->size - offset) len = ino->size - offset;
+    
+    // a read spanning many pages gets all of them in flight up front, they
+    // merge into a few large requests instead of trickling in per window
+    uint64_t first = offset >> PAGE_SHIFT;
+    uint64_t last = (offset + len - 1) >> PAGE_SHIFT;
+    if (last > first) pcache_readahead(&ino->mapping, first, last - first + 1);
+    
+    int n = pcache_read(&ino->mapping, offset, buf, len);
+    return n < 0 ? FAT_EIO : n;
+}
+
+int fat_read(int fd, void* buf, uint32_t len) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    
+    int n = fat_pread(fd, f->pos, buf, len);
+    if (n > 0) f->pos += n;
+    return n;
+}
+
+int fat_seek(int fd, uint64_t offset) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    f->pos = offset;
+    return FAT_OK;
+}
+
+int fat_fstat(int fd, struct fat_stat* st) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    st->size = f->inode->dir ? 0 : f->inode->size;
+    st->attr = f->inode->dir ? FAT_ATTR_DIRECTORY : 0;
+    st->cluster = f->inode->cluster;
+    st->nr_extents = f->inode->nr_extents;
+    return FAT_OK;
+}
+
+int fat_stat(const char* path, struct fat_stat* st) {
+    if (!mounted) return FAT_ENODEV;
+    
+    struct fat_dirent d;
+    int err = lookup_path(path, &d);
+    if (err != FAT_OK) return err;
+    st->size = d.size;
+    st->attr = d.attr;
+    st->cluster = d.cluster;
+    st->nr_extents = 0;
+    return FAT_OK;
+}
+
+int fat_readdir(int fd, uint32_t* cookie, struct fat_dirent* out) {
+    struct fat_file* f = get_file(fd);
+    if (!f) return FAT_EINVAL;
+    if (!f->inode->dir) return FAT_ENOTDIR;
+    
+    struct dir_iter it = { f->inode, *cookie, NULL, 0, 0 };
+    int ret = dir_next(&it, out);
+    if (it.page) pcache_put(it.page);
+    *cookie = it.pos;
+    
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    stats.dir_entries_scanned += it.scanned;
+    spin_unlock_irqrestore(&fat_lock, flags);
+    return ret;
+}
+
+void fat_get_stats(struct fat_stats* out) {
+    uint64_t flags = spin_lock_irqsave(&fat_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&fat_lock, flags);
+}
+
+static int read_all(int fd, void* buf, uint32_t chunk) {
+    fat_seek(fd, 0);
+    int n;
+    while ((n = fat_read(fd, buf, chunk)) > 0);
+    return n;
+}
+
+// reads the whole file twice in chunk sized pieces: cold from disk after
+// dropping its cached pages, then warm out of the page cache
+int fat_bench_read(const char* path, uint32_t chunk, struct fat_bench_result* result) {
+    if (!chunk || chunk > FAT_BENCH_MAX_CHUNK || (chunk & (PAGE_SIZE - 1))) return FAT_EINVAL;
+    
+    int fd = fat_open(path);
+    if (fd < 0) return fd;
+    struct fat_inode* ino = files[fd].inode;
+    if (ino->dir) {
+        fat_close(fd);
+        return FAT_EISDIR;
+    }
+    
+    uint32_t pages = chunk / PAGE_SIZE;
+    uint64_t mem = alloc_pages(pages);
+    if (!mem) {
+        fat_close(fd);
+        return FAT_ENOMEM;
+    }
+    
+    *result = (struct fat_bench_result){ 0 };
+    result->bytes = ino->size;
+    result->nr_extents = ino->nr_extents;
+    pcache_invalidate(&ino->mapping);
+    
+    struct blk_stats before, after;
+    blk_get_stats(&before);
+    uint64_t start = ktime_get_ns();
+    int err = read_all(fd, (void*)mem, chunk);
+    uint64_t cold = ktime_get_ns();
+    blk_get_stats(&after);
+    if (err == 0) err = read_all(fd, (void*)mem, chunk);
+    uint64_t warm = ktime_get_ns();
+    
+    for (uint32_t i = 0; i < pages; i++) {
+        free_page(mem + (uint64_t)i * PAGE_SIZE);
+    }
+    fat_close(fd);
+    if (err < 0) return err;
+    
+    result->cold_ns = cold - start;
+    result->warm_ns = warm - cold;
+    if (result->cold_ns) result->cold_kbps = result->bytes * 1000000ULL / result->cold_ns;
+    if (result->warm_ns) result->warm_kbps = result->bytes * 1000000ULL / result->warm_ns;
+    result->requests = after.requests - before.requests;
+    if (result->requests) {
+        result->avg_request_kb = (after.read_bytes - before.read_bytes) / result->requests / 1024;
+    }
+    return FAT_OK;
+}
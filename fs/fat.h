@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FAT_MAX_FILES      32
+#define FAT_MAX_INODES     64
+#define FAT_NAME_MAX       256
+
+// chains with more runs than this spill into pages of their own
+#define FAT_INLINE_EXTENTS 4
+
+#define FAT_DENTRY_HASH_BITS 8
+#define FAT_DENTRY_HASH_SIZE (1 << FAT_DENTRY_HASH_BITS)
+#define FAT_DENTRIES       512
+#define FAT_DENTRY_NAME    48
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+#define FAT_ATTR_LFN       0x0F
+
+#define FAT_ENTRY_MASK     0x0FFFFFFF
+#define FAT_ENTRY_BAD      0x0FFFFFF7
+#define FAT_ENTRY_EOC      0x0FFFFFF8
+
+#define FAT_OK       0
+#define FAT_EIO     -1
+#define FAT_ENOENT  -2
+#define FAT_EINVAL  -3
+#define FAT_ENOTDIR -4
+#define FAT_EISDIR  -5
+#define FAT_ENFILE  -6
+#define FAT_ENOMEM  -7
+#define FAT_ENODEV  -8
+
+struct fat_bpb {
+    uint8_t jump[3];
+    char oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t nr_fats;
+    uint16_t root_entries;
+    uint16_t total_sectors16;
+    uint8_t media;
+    uint16_t fat_size16;
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors32;
+    uint32_t fat_size32;
+    uint16_t ext_flags;
+    uint16_t version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;
+    uint16_t backup_boot_sector;
+    uint8_t reserved[12];
+    uint8_t drive;
+    uint8_t reserved1;
+    uint8_t boot_sig;
+    uint32_t volume_id;
+    char label[11];
+    char fs_type[8];
+} __attribute__((packed));
+
+struct fat_dir_entry {
+    uint8_t name[11];
+    uint8_t attr;
+    uint8_t nt_flags;
+    uint8_t ctime_tenth;
+    uint16_t ctime;
+    uint16_t cdate;
+    uint16_t adate;
+    uint16_t cluster_hi;
+    uint16_t mtime;
+    uint16_t mdate;
+    uint16_t cluster_lo;
+    uint32_t size;
+} __attribute__((packed));
+
+struct fat_lfn_entry {
+    uint8_t order;
+    uint16_t name1[5];
+    uint8_t attr;
+    uint8_t type;
+    uint8_t checksum;
+    uint16_t name2[6];
+    uint16_t cluster;
+    uint16_t name3[2];
+} __attribute__((packed));
+
+struct fat_dirent {
+    char name[FAT_NAME_MAX];
+    uint8_t attr;
+    uint32_t cluster;
+    uint32_t size;
+};
+
+struct fat_stat {
+    uint32_t size;
+    uint8_t attr;
+    uint32_t cluster;
+    uint32_t nr_extents;
+};
+
+struct fat_stats {
+    uint64_t dentry_hits;
+    uint64_t dentry_misses;
+    uint64_t dir_entries_scanned;
+    uint64_t inode_loads;
+    uint64_t extents;
+    uint64_t fat_bytes;
+};
+
+struct fat_bench_result {
+    uint64_t bytes;
+    uint32_t nr_extents;
+    uint64_t cold_ns;
+    uint64_t warm_ns;
+    uint64_t cold_kbps;
+    uint64_t warm_kbps;
+    uint64_t requests;
+    uint64_t avg_request_kb;
+};
+
+// read-only, on top of the block layer. mounts a bare volume or the first
+// FAT32 partition of an MBR disk
+int fat_mount(void);
+bool fat_mounted(void);
+
+int fat_open(const char* path);
+int fat_close(int fd);
+int fat_read(int fd, void* buf, uint32_t len);
+int fat_pread(int fd, uint64_t offset, void* buf, uint32_t len);
+int fat_seek(int fd, uint64_t offset);
+int fat_fstat(int fd, struct fat_stat* st);
+int fat_stat(const char* path, struct fat_stat* st);
+
+// *cookie starts at 0, returns 1 per entry and 0 once the directory is done
+int fat_readdir(int fd, uint32_t* cookie, struct fat_dirent* out);
+
+void fat_get_stats(struct fat_stats* stats);
+int fat_bench_read(const char* path, uint32_t chunk, struct fat_bench_result* result);
@@ -0,0 +1,266 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../sched/sched.h>
+#include <../sched/workqueue.h>
+#include <../drivers/virtio_net.h>
+#include <net.h>
+
+#define ARP_OP_REQUEST 1
+#define ARP_OP_REPLY   2
+
+#define ARP_FREE       0
+#define ARP_INCOMPLETE 1
+#define ARP_REACHABLE  2
+
+struct arp_entry {
+    uint32_t ip;
+    uint8_t mac[ETH_ALEN];
+    uint8_t state;
+    uint8_t retries;
+    uint64_t updated;
+    struct pbuf* pending[ARP_PENDING];
+    uint32_t npending;
+    struct arp_entry* next;
+};
+
+static struct arp_entry entries[ARP_ENTRIES];
+static struct arp_entry* buckets[ARP_HASH_SIZE];
+static struct arp_entry* free_entries = NULL;
+static spinlock_t arp_lock = SPINLOCK_INIT;
+static struct work age_work;
+
+static const uint8_t eth_broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static inline uint32_t arp_hash(uint32_t ip) {
+    return (ip * 0x9E3779B1u) >> (32 - ARP_HASH_BITS);
+}
+
+static struct arp_entry* lookup(uint32_t ip) {
+    for (struct arp_entry* e = buckets[arp_hash(ip)]; e; e = e->next) {
+        if (e->ip == ip) return e;
+    }
+    return NULL;
+}
+
+static void unlink_entry(struct arp_entry* e) {
+    struct arp_entry** link = &buckets[arp_hash(e->ip)];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    e->state = ARP_FREE;
+    e->next = free_entries;
+    free_entries = e;
+}
+
+// table full, push out the reachable entry that was confirmed longest ago.
+// entries still resolving are left alone, they have traffic waiting on them
+static struct arp_entry* evict(void) {
+    struct arp_entry* oldest = NULL;
+    for (int i = 0; i < ARP_ENTRIES; i++) {
+        struct arp_entry* e = &entries[i];
+        if (e->state != ARP_REACHABLE) continue;
+        if (!oldest || e->updated < oldest->updated) oldest = e;
+    }
+    if (!oldest) return NULL;
+    
+    unlink_entry(oldest);
+    return oldest;
+}
+
+static struct arp_entry* insert(uint32_t ip) {
+    struct arp_entry* e = free_entries;
+    if (e) {
+        free_entries = e->next;
+    } else {
+        e = evict();
+        if (!e) return NULL;
+        free_entries = e->next;
+    }
+    
+    e->ip = ip;
+    e->state = ARP_INCOMPLETE;
+    e->retries = 0;
+    e->npending = 0;
+    e->updated = get_tick_count();
+    
+    uint32_t h = arp_hash(ip);
+    e->next = buckets[h];
+    buckets[h] = e;
+    return e;
+}
+
+static void send_arp(uint16_t op, const uint8_t* tha, uint32_t tpa) {
+    struct pbuf* p = pbuf_alloc(sizeof(struct arp_hdr));
+    if (!p) return;
+    
+    struct arp_hdr* arp = (struct arp_hdr*)p->data;
+    arp->htype = htons(1);
+    arp->ptype = htons(ETH_P_IP);
+    arp->hlen = ETH_ALEN;
+    arp->plen = 4;
+    arp->op = htons(op);
+    virtio_net_get_mac(arp->sha);
+    arp->spa = htonl(net_get_addr());
+    for (int i = 0; i < ETH_ALEN; i++) {
+        arp->tha[i] = op == ARP_OP_REQUEST ? 0 : tha[i];
+    }
+    arp->tpa = htonl(tpa);
+    
+    net_stats.tx_arp++;
+    eth_output(p, op == ARP_OP_REQUEST ? eth_broadcast : tha, ETH_P_ARP);
+}
+
+// pending packets go out after the lock is dropped
+static void send_pending(struct pbuf** pending, uint32_t count, const uint8_t* mac) {
+    for (uint32_t i = 0; i < count; i++) {
+        eth_output(pending[i], mac, ETH_P_IP);
+    }
+}
+
+static void arp_age(struct work* work) {
+    (void)work;
+    
+    uint64_t now = get_tick_count();
+    uint32_t retry[ARP_ENTRIES];
+    uint32_t nretry = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&arp_lock);
+    for (int i = 0; i < ARP_ENTRIES; i++) {
+        struct arp_entry* e = &entries[i];
+        if (e->state == ARP_REACHABLE && now - e->updated >= ARP_TIMEOUT_MS) {
+            net_stats.arp_expired++;
+            unlink_entry(e);
+        } else if (e->state == ARP_INCOMPLETE && now - e->updated >= ARP_RETRY_MS) {
+            if (e->retries >= ARP_MAX_RETRIES) {
+                // nobody answered, whatever was waiting goes with it
+                for (uint32_t j = 0; j < e->npending; j++) {
+                    net_stats.tx_dropped++;
+                    pbuf_free(e->pending[j]);
+                }
+                unlink_entry(e);
+            } else {
+                e->retries++;
+                e->updated = now;
+                retry[nretry++] = e->ip;
+            }
+        }
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    
+    for (uint32_t i = 0; i < nretry; i++) {
+        send_arp(ARP_OP_REQUEST, NULL, retry[i]);
+    }
+    
+    queue_delayed_work(&age_work, ARP_AGE_MS);
+}
+
+void arp_init(void) {
+    free_entries = NULL;
+    for (int i = ARP_ENTRIES - 1; i >= 0; i--) {
+        entries[i].state = ARP_FREE;
+        entries[i].next = free_entries;
+        free_entries = &entries[i];
+    }
+    for (int i = 0; i < ARP_HASH_SIZE; i++) {
+        buckets[i] = NULL;
+    }
+    
+    init_work(&age_work, arp_age, NULL);
+    queue_delayed_work(&age_work, ARP_AGE_MS);
+}
+
+void arp_input(struct pbuf* p) {
+    net_stats.rx_arp++;
+    if (p->len < sizeof(struct arp_hdr)) {
+        net_stats.rx_bad++;
+        pbuf_free(p);
+        return;
+    }
+    
+    struct arp_hdr* arp = (struct arp_hdr*)p->data;
+    if (ntohs(arp->htype) != 1 || ntohs(arp->ptype) != ETH_P_IP || arp->hlen != ETH_ALEN || arp->plen != 4) {
+        net_stats.rx_bad++;
+        pbuf_free(p);
+        return;
+    }
+    
+    uint32_t spa = ntohl(arp->spa);
+    uint32_t tpa = ntohl(arp->tpa);
+    bool for_us = tpa == net_get_addr();
+    uint8_t sha[ETH_ALEN];
+    for (int i = 0; i < ETH_ALEN; i++) {
+        sha[i] = arp->sha[i];
+    }
+    
+    struct pbuf* pending[ARP_PENDING];
+    uint32_t npending = 0;
+    
+    // learn the sender if we already track it or it is talking to us
+    uint64_t flags = spin_lock_irqsave(&arp_lock);
+    struct arp_entry* e = lookup(spa);
+    if (!e && for_us) {
+        e = insert(spa);
+    }
+    if (e) {
+        for (int i = 0; i < ETH_ALEN; i++) {
+            e->mac[i] = sha[i];
+        }
+        e->state = ARP_REACHABLE;
+        e->updated = get_tick_count();
+        npending = e->npending;
+        for (uint32_t i = 0; i < npending; i++) {
+            pending[i] = e->pending[i];
+        }
+        e->npending = 0;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    
+    send_pending(pending, npending, sha);
+    
+    if (for_us && ntohs(arp->op) == ARP_OP_REQUEST) {
+        send_arp(ARP_OP_REPLY, sha, spa);
+    }
+    pbuf_free(p);
+}
+
+int arp_output(struct pbuf* p, uint32_t next_hop) {
+    if (next_hop == NET_BROADCAST) {
+        return eth_output(p, eth_broadcast, ETH_P_IP);
+    }
+    
+    uint8_t mac[ETH_ALEN];
+    bool request = false;
+    
+    uint64_t flags = spin_lock_irqsave(&arp_lock);
+    struct arp_entry* e = lookup(next_hop);
+    if (e && e->state == ARP_REACHABLE) {
+        for (int i = 0; i < ETH_ALEN; i++) {
+            mac[i] = e->mac[i];
+        }
+        net_stats.arp_hits++;
+        spin_unlock_irqrestore(&arp_lock, flags);
+        return eth_output(p, mac, ETH_P_IP);
+    }
+    
+    net_stats.arp_misses++;
+    if (!e) {
+        e = insert(next_hop);
+        request = e != NULL;
+    }
+    if (!e || e->npending == ARP_PENDING) {
+        spin_unlock_irqrestore(&arp_lock, flags);
+        net_stats.tx_dropped++;
+        pbuf_free(p);
+        return -1;
+    }
+    e->pending[e->npending++] = p;
+    spin_unlock_irqrestore(&arp_lock, flags);
+    
+    if (request) {
+        send_arp(ARP_OP_REQUEST, NULL, next_hop);
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <net.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// the ones' complement sum doesn't care about byte order as long as every
+// word is read the same way, so sum little-endian words and store the folded
+// result back without swapping. the pseudo header is added in wire order to match.
+uint32_t net_csum_partial(const void* data, uint32_t len, uint32_t sum) {
+    const uint8_t* p = data;
+    uint64_t acc = sum;
+
+#if defined(__ARM_NEON)
+    // pairwise add-accumulate keeps 32-bit lanes, good for 2^16 rounds
+    if (len >= 64) {
+        uint32x4_t a0 = vdupq_n_u32(0);
+        uint32x4_t a1 = vdupq_n_u32(0);
+        while (len >= 64) {
+            uint16x8x4_t v = vld1q_u16_x4((const uint16_t*)p);
+            a0 = vpadalq_u16(a0, v.val[0]);
+            a1 = vpadalq_u16(a1, v.val[1]);
+            a0 = vpadalq_u16(a0, v.val[2]);
+            a1 = vpadalq_u16(a1, v.val[3]);
+            p += 64;
+            len -= 64;
+        }
+        acc += vaddlvq_u32(a0) + vaddlvq_u32(a1);
+    }
+    if (len >= 16) {
+        uint32x4_t a = vdupq_n_u32(0);
+        while (len >= 16) {
+            a = vpadalq_u16(a, vld1q_u16((const uint16_t*)p));
+            p += 16;
+            len -= 16;
+        }
+        acc += vaddlvq_u32(a);
+    }
+#endif
+    
+    while (len >= 2) {
+        acc += (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        acc += p[0];
+    }
+    
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+uint16_t net_csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+uint32_t net_csum_pseudo(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len) {
+    uint64_t acc = 0;
+    uint32_t s = htonl(src);
+    uint32_t d = htonl(dst);
+    acc += (s & 0xFFFF) + (s >> 16);
+    acc += (d & 0xFFFF) + (d >> 16);
+    acc += htons(proto);
+    acc += htons(len);
+    return (uint32_t)((acc & 0xFFFFFFFF) + (acc >> 32));
+}
@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../timer.h>
+#include <../sched/sched.h>
+#include <../sched/workqueue.h>
+#include <../drivers/virtio_net.h>
+#include <net.h>
+
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+#define PING_ID           0x434F
+
+struct net_stats net_stats;
+
+static uint32_t local_ip = NET_DEFAULT_IP;
+static uint32_t local_mask = NET_DEFAULT_NETMASK;
+static uint32_t gateway_ip = NET_DEFAULT_GATEWAY;
+static uint8_t local_mac[ETH_ALEN];
+static uint16_t ip_id = 0;
+
+// one ping in flight at a time is all the shell needs
+static spinlock_t ping_lock = SPINLOCK_INIT;
+static uint16_t ping_seq = 0;
+static volatile uint64_t ping_reply_ns = 0;
+static uint32_t ping_waiter = 0;
+static struct work ping_timeout;
+
+int eth_output(struct pbuf* p, const uint8_t* dst, uint16_t type) {
+    struct eth_hdr* eth = (struct eth_hdr*)pbuf_push(p, ETH_HLEN);
+    if (!eth) {
+        // clones can't write into shared headroom, give them their own header
+        struct pbuf* h = pbuf_alloc(0);
+        if (!h) {
+            net_stats.tx_dropped++;
+            pbuf_free(p);
+            return -1;
+        }
+        pbuf_chain(h, p);
+        p = h;
+        eth = (struct eth_hdr*)pbuf_push(p, ETH_HLEN);
+    }
+    
+    for (int i = 0; i < ETH_ALEN; i++) {
+        eth->dst[i] = dst[i];
+        eth->src[i] = local_mac[i];
+    }
+    eth->type = htons(type);
+    
+    if (virtio_net_xmit(p) < 0) {
+        net_stats.tx_dropped++;
+        pbuf_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+int ip_output(struct pbuf* p, uint32_t dst, uint8_t proto) {
+    uint32_t len = p->tot_len + IP_HLEN;
+    if (len > IP_MTU) {
+        net_stats.tx_dropped++;
+        pbuf_free(p);
+        return -1;
+    }
+    
+    struct ip_hdr* ip = (struct ip_hdr*)pbuf_push(p, IP_HLEN);
+    if (!ip) {
+        struct pbuf* h = pbuf_alloc(0);
+        if (!h) {
+            net_stats.tx_dropped++;
+            pbuf_free(p);
+            return -1;
+        }
+        pbuf_chain(h, p);
+        p = h;
+        ip = (struct ip_hdr*)pbuf_push(p, IP_HLEN);
+    }
+    
+    ip->ver_ihl = 0x45;
+    ip->tos = 0;
+    ip->len = htons(len);
+    ip->id = htons(__atomic_fetch_add(&ip_id, 1, __ATOMIC_RELAXED));
+    ip->frag = htons(0x4000);
+    ip->ttl = IP_TTL;
+    ip->proto = proto;
+    ip->csum = 0;
+    ip->src = htonl(local_ip);
+    ip->dst = htonl(dst);
+    ip->csum = net_csum_fold(net_csum_partial(ip, IP_HLEN, 0));
+    net_stats.tx_ip++;
+    
+    uint32_t next_hop = dst;
+    if (dst != NET_BROADCAST && (dst & local_mask) != (local_ip & local_mask)) {
+        next_hop = gateway_ip;
+    }
+    return arp_output(p, next_hop);
+}
+
+static void icmp_input(struct pbuf* p, uint32_t src) {
+    net_stats.rx_icmp++;
+    if (p->len < sizeof(struct icmp_hdr) || net_csum_fold(net_csum_partial(p->data, p->len, 0)) != 0) {
+        net_stats.rx_bad++;
+        pbuf_free(p);
+        return;
+    }
+    
+    struct icmp_hdr* icmp = (struct icmp_hdr*)p->data;
+    if (icmp->type == ICMP_ECHO_REQUEST && !pbuf_shared(p)) {
+        // answer in the same buffer, the ip header gets rebuilt in the headroom
+        icmp->type = ICMP_ECHO_REPLY;
+        icmp->csum = 0;
+        icmp->csum = net_csum_fold(net_csum_partial(p->data, p->len, 0));
+        ip_output(p, src, IP_PROTO_ICMP);
+        return;
+    }
+    
+    if (icmp->type == ICMP_ECHO_REPLY && ntohs(icmp->id) == PING_ID) {
+        uint64_t flags = spin_lock_irqsave(&ping_lock);
+        if (ntohs(icmp->seq) == ping_seq && !ping_reply_ns) {
+            ping_reply_ns = ktime_get_ns();
+            if (ping_waiter) task_wake(ping_waiter);
+        }
+        spin_unlock_irqrestore(&ping_lock, flags);
+    }
+    pbuf_free(p);
+}
+
+static void ip_input(struct pbuf* p) {
+    net_stats.rx_ip++;
+    
+    struct ip_hdr* ip = (struct ip_hdr*)p->data;
+    uint32_t hlen = (ip->ver_ihl & 0xF) * 4;
+    if (p->len < IP_HLEN || (ip->ver_ihl >> 4) != 4 || hlen < IP_HLEN || p->len < hlen) goto bad;
+    
+    uint32_t len = ntohs(ip->len);
+    if (len < hlen || len > p->len) goto bad;
+    if (net_csum_fold(net_csum_partial(ip, hlen, 0)) != 0) goto bad;
+    
+    // fragments aren't reassembled
+    if (ntohs(ip->frag) & 0x3FFF) goto drop;
+    
+    uint32_t src = ntohl(ip->src);
+    uint32_t dst = ntohl(ip->dst);
+    if (dst != local_ip && dst != NET_BROADCAST && dst != (local_ip | ~local_mask)) goto drop;
+    
+    uint8_t proto = ip->proto;
+    // ethernet padding on short frames comes off here
+    p->len = len;
+    p->tot_len = len;
+    pbuf_pull(p, hlen);
+    
+    if (proto == IP_PROTO_UDP) {
+        udp_input(p, src, dst);
+    } else if (proto == IP_PROTO_ICMP) {
+        icmp_input(p, src);
+    } else {
+        goto drop;
+    }
+    return;
+
+bad:
+    net_stats.rx_bad++;
+    pbuf_free(p);
+    return;
+drop:
+    net_stats.rx_dropped++;
+    pbuf_free(p);
+}
+
+// everything one napi poll pulled off the ring. sockets collect their
+// datagrams across the whole batch and are woken once at the end
+static void net_rx_batch(struct pbuf** batch, uint32_t count) {
+    net_stats.rx_batches++;
+    net_stats.rx_frames += count;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        struct pbuf* p = batch[i];
+        if (p->len < ETH_HLEN) {
+            net_stats.rx_bad++;
+            pbuf_free(p);
+            continue;
+        }
+        
+        uint16_t type = ntohs(((struct eth_hdr*)p->data)->type);
+        pbuf_pull(p, ETH_HLEN);
+        
+        if (type == ETH_P_IP) {
+            ip_input(p);
+        } else if (type == ETH_P_ARP) {
+            arp_input(p);
+        } else {
+            net_stats.rx_dropped++;
+            pbuf_free(p);
+        }
+    }
+    
+    udp_rx_flush();
+}
+
+int net_init(void) {
+    if (!virtio_net_ready()) return -1;
+    
+    virtio_net_get_mac(local_mac);
+    arp_init();
+    udp_init();
+    virtio_net_set_rx_handler(net_rx_batch);
+    return 0;
+}
+
+void net_set_addr(uint32_t ip, uint32_t netmask, uint32_t gateway) {
+    local_ip = ip;
+    local_mask = netmask;
+    gateway_ip = gateway;
+}
+
+uint32_t net_get_addr(void) {
+    return local_ip;
+}
+
+void net_get_stats(struct net_stats* stats) {
+    *stats = net_stats;
+}
+
+static void ping_expired(struct work* work) {
+    task_wake((uint32_t)(uint64_t)work->data);
+}
+
+// returns the round trip in microseconds, -1 on timeout
+int64_t net_ping(uint32_t ip, uint32_t timeout_ms) {
+    struct pbuf* p = pbuf_alloc(sizeof(struct icmp_hdr) + 56);
+    if (!p) return -1;
+    
+    for (uint32_t i = sizeof(struct icmp_hdr); i < p->len; i++) {
+        p->data[i] = (uint8_t)i;
+    }
+    
+    uint64_t flags = spin_lock_irqsave(&ping_lock);
+    ping_seq++;
+    ping_reply_ns = 0;
+    ping_waiter = get_current_tid();
+    struct icmp_hdr* icmp = (struct icmp_hdr*)p->data;
+    icmp->type = ICMP_ECHO_REQUEST;
+    icmp->code = 0;
+    icmp->csum = 0;
+    icmp->id = htons(PING_ID);
+    icmp->seq = htons(ping_seq);
+    spin_unlock_irqrestore(&ping_lock, flags);
+    icmp->csum = net_csum_fold(net_csum_partial(p->data, p->len, 0));
+    
+    init_work(&ping_timeout, ping_expired, (void*)(uint64_t)ping_waiter);
+    uint64_t start = ktime_get_ns();
+    uint64_t deadline = get_tick_count() + timeout_ms;
+    ip_output(p, ip, IP_PROTO_ICMP);
+    
+    while (!ping_reply_ns && get_tick_count() < deadline) {
+        queue_delayed_work(&ping_timeout, deadline - get_tick_count());
+        task_block();
+        cancel_work(&ping_timeout);
+    }
+    
+    flags = spin_lock_irqsave(&ping_lock);
+    uint64_t reply = ping_reply_ns;
+    ping_waiter = 0;
+    spin_unlock_irqrestore(&ping_lock, flags);
+    
+    if (!reply) return -1;
+    return (int64_t)((reply - start) / 1000);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pbuf.h>
+
+// addresses and ports are host order everywhere outside the wire structs
+#define NET_IP(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+#define NET_BROADCAST 0xFFFFFFFF
+
+// qemu user networking hands these out
+#define NET_DEFAULT_IP      NET_IP(10, 0, 2, 15)
+#define NET_DEFAULT_NETMASK NET_IP(255, 255, 255, 0)
+#define NET_DEFAULT_GATEWAY NET_IP(10, 0, 2, 2)
+
+#define ETH_ALEN    6
+#define ETH_HLEN    14
+#define ETH_P_IP    0x0800
+#define ETH_P_ARP   0x0806
+
+#define IP_HLEN     20
+#define IP_TTL      64
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_UDP  17
+#define IP_MTU      1500
+
+#define ARP_HASH_BITS    6
+#define ARP_HASH_SIZE    (1 << ARP_HASH_BITS)
+#define ARP_ENTRIES      128
+#define ARP_PENDING      4
+#define ARP_TIMEOUT_MS   60000
+#define ARP_RETRY_MS     1000
+#define ARP_MAX_RETRIES  3
+#define ARP_AGE_MS       1000
+
+static inline uint16_t htons(uint16_t x) { return __builtin_bswap16(x); }
+static inline uint16_t ntohs(uint16_t x) { return __builtin_bswap16(x); }
+static inline uint32_t htonl(uint32_t x) { return __builtin_bswap32(x); }
+static inline uint32_t ntohl(uint32_t x) { return __builtin_bswap32(x); }
+
+struct eth_hdr {
+    uint8_t dst[ETH_ALEN];
+    uint8_t src[ETH_ALEN];
+    uint16_t type;
+} __attribute__((packed));
+
+struct arp_hdr {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[ETH_ALEN];
+    uint32_t spa;
+    uint8_t tha[ETH_ALEN];
+    uint32_t tpa;
+} __attribute__((packed));
+
+struct ip_hdr {
+    uint8_t ver_ihl;
+    uint8_t tos;
+    uint16_t len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t csum;
+    uint32_t src;
+    uint32_t dst;
+} __attribute__((packed));
+
+struct icmp_hdr {
+    uint8_t type;
+    uint8_t code;
+    uint16_t csum;
+    uint16_t id;
+    uint16_t seq;
+} __attribute__((packed));
+
+struct udp_hdr {
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t len;
+    uint16_t csum;
+} __attribute__((packed));
+
+struct net_stats {
+    uint64_t rx_frames;
+    uint64_t rx_batches;
+    uint64_t rx_arp;
+    uint64_t rx_ip;
+    uint64_t rx_icmp;
+    uint64_t rx_udp;
+    uint64_t rx_bad;
+    uint64_t rx_dropped;
+    uint64_t tx_ip;
+    uint64_t tx_arp;
+    uint64_t tx_dropped;
+    uint64_t arp_hits;
+    uint64_t arp_misses;
+    uint64_t arp_expired;
+};
+
+int net_init(void);
+void net_set_addr(uint32_t ip, uint32_t netmask, uint32_t gateway);
+uint32_t net_get_addr(void);
+void net_get_stats(struct net_stats* stats);
+int64_t net_ping(uint32_t ip, uint32_t timeout_ms);
+
+// internet checksum over native-order words, fold the result before storing it
+uint32_t net_csum_partial(const void* data, uint32_t len, uint32_t sum);
+uint16_t net_csum_fold(uint32_t sum);
+uint32_t net_csum_pseudo(uint32_t src, uint32_t dst, uint8_t proto, uint16_t len);
+
+// shared between the layers, these all take ownership of p
+int ip_output(struct pbuf* p, uint32_t dst, uint8_t proto);
+int eth_output(struct pbuf* p, const uint8_t* dst, uint16_t type);
+void arp_init(void);
+void arp_input(struct pbuf* p);
+int arp_output(struct pbuf* p, uint32_t next_hop);
+void udp_init(void);
+void udp_input(struct pbuf* p, uint32_t src, uint32_t dst);
+void udp_rx_flush(void);
+
+extern struct net_stats net_stats;
@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../vm_pages.h>
+#include <../spinlock.h>
+#include <../cpu.h>
+#include <pbuf.h>
+
+// lives in the last bytes of every chunk
+struct pbuf_shared {
+    volatile uint32_t refs;
+    uint32_t pad[3];
+};
+
+#define PBUF_END (PBUF_CHUNK - sizeof(struct pbuf_shared))
+
+#define POOL_DESC  0
+#define POOL_CHUNK 1
+#define NR_POOLS   2
+
+// free objects are linked through their first word
+struct free_obj {
+    struct free_obj* next;
+};
+
+struct free_list {
+    struct free_obj* head;
+    uint32_t count;
+};
+
+static struct pbuf descs[PBUF_MAX_DESCS];
+static struct free_list shared_lists[NR_POOLS];
+static struct free_list cpu_lists[MAX_CPUS][NR_POOLS];
+static spinlock_t pbuf_lock = SPINLOCK_INIT;
+static struct pbuf_stats stats;
+
+static inline void list_push(struct free_list* l, void* obj) {
+    struct free_obj* o = obj;
+    o->next = l->head;
+    l->head = o;
+    l->count++;
+}
+
+static inline void* list_pop(struct free_list* l) {
+    struct free_obj* o = l->head;
+    if (o) {
+        l->head = o->next;
+        l->count--;
+    }
+    return o;
+}
+
+static inline struct pbuf_shared* shinfo(struct pbuf* p) {
+    return (struct pbuf_shared*)(p->head + PBUF_END);
+}
+
+// called with pbuf_lock held. chunks come straight from the page
+// allocator and are never handed back, so the zeroing it does is paid once
+static void grow_chunks(void) {
+    if (stats.pages >= PBUF_MAX_PAGES) return;
+
+    uint64_t page = alloc_page();
+    if (!page) return;
+    stats.pages++;
+
+    for (uint32_t off = 0; off < PAGE_SIZE; off += PBUF_CHUNK) {
+        list_push(&shared_lists[POOL_CHUNK], (void*)(page + off));
+    }
+}
+
+// interrupts are off from here to the matching put, which is what makes
+// the per-cpu lists safe against the rx softirq and irq handlers
+static void refill(struct free_list* local, int pool) {
+    spin_lock(&pbuf_lock);
+    struct free_list* global = &shared_lists[pool];
+    if (pool == POOL_CHUNK && global->count < PBUF_BATCH) {
+        for (int i = 0; i < PBUF_BATCH * PBUF_CHUNK / PAGE_SIZE; i++) {
+            grow_chunks();
+        }
+    }
+
+    for (int i = 0; i < PBUF_BATCH && global->count; i++) {
+        list_push(local, list_pop(global));
+    }
+    spin_unlock(&pbuf_lock);
+}
+
+static void drain(struct free_list* local, int pool) {
+    spin_lock(&pbuf_lock);
+    for (int i = 0; i < PBUF_BATCH && local->count; i++) {
+        list_push(&shared_lists[pool], list_pop(local));
+    }
+    spin_unlock(&pbuf_lock);
+}
+
+static void* pool_get(int pool) {
+    uint64_t flags = local_irq_save();
+    struct free_list* local = &cpu_lists[smp_processor_id()][pool];
+    if (!local->count) {
+        refill(local, pool);
+    }
+    void* obj = list_pop(local);
+    local_irq_restore(flags);
+    return obj;
+}
+
+static void pool_put(int pool, void* obj) {
+    uint64_t flags = local_irq_save();
+    struct free_list* local = &cpu_lists[smp_processor_id()][pool];
+    list_push(local, obj);
+    if (local->count > PBUF_CACHE_MAX) {
+        drain(local, pool);
+    }
+    local_irq_restore(flags);
+}
+
+void pbuf_init(void) {
+    for (int pool = 0; pool < NR_POOLS; pool++) {
+        shared_lists[pool].head = NULL;
+        shared_lists[pool].count = 0;
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            cpu_lists[cpu][pool].head = NULL;
+            cpu_lists[cpu][pool].count = 0;
+        }
+    }
+    for (int i = PBUF_MAX_DESCS - 1; i >= 0; i--) {
+        list_push(&shared_lists[POOL_DESC], &descs[i]);
+    }
+    stats = (struct pbuf_stats){ 0 };
+}
+
+// one descriptor and chunk, only the first fragment of a packet keeps headroom
+static struct pbuf* alloc_frag(uint32_t headroom) {
+    struct pbuf* p = pool_get(POOL_DESC);
+    if (!p) return NULL;
+
+    uint8_t* chunk = pool_get(POOL_CHUNK);
+    if (!chunk) {
+        pool_put(POOL_DESC, p);
+        return NULL;
+    }
+
+    p->next = NULL;
+    p->head = chunk;
+    p->data = chunk + headroom;
+    p->len = 0;
+    p->tot_len = 0;
+    shinfo(p)->refs = 1;
+    return p;
+}
+
+struct pbuf* pbuf_alloc(uint32_t len) {
+    struct pbuf* first = alloc_frag(PBUF_HEADROOM);
+    if (!first) goto fail;
+
+    struct pbuf* last = first;
+    uint32_t remaining = len;
+    while (1) {
+        uint32_t room = pbuf_tailroom(last);
+        last->len = remaining < room ? remaining : room;
+        remaining -= last->len;
+        last->tot_len = remaining + last->len;
+        if (!remaining) break;
+
+        struct pbuf* frag = alloc_frag(0);
+        if (!frag) {
+            pbuf_free(first);
+            goto fail;
+        }
+        last->next = frag;
+        last = frag;
+    }
+
+    __atomic_fetch_add(&stats.allocs, 1, __ATOMIC_RELAXED);
+    return first;
+
+fail:
+    __atomic_fetch_add(&stats.failures, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// new descriptors over the same chunks, nothing is copied
+struct pbuf* pbuf_clone(struct pbuf* p) {
+    struct pbuf* first = NULL;
+    struct pbuf** link = &first;
+
+    for (; p; p = p->next) {
+        struct pbuf* c = pool_get(POOL_DESC);
+        if (!c) {
+            pbuf_free(first);
+            __atomic_fetch_add(&stats.failures, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        *c = *p;
+        c->next = NULL;
+        __atomic_fetch_add(&shinfo(p)->refs, 1, __ATOMIC_RELAXED);
+
+        *link = c;
+        link = &c->next;
+    }
+
+    __atomic_fetch_add(&stats.clones, 1, __ATOMIC_RELAXED);
+    return first;
+}
+
+void pbuf_free(struct pbuf* p) {
+    if (!p) return;
+    __atomic_fetch_add(&stats.frees, 1, __ATOMIC_RELAXED);
+
+    while (p) {
+        struct pbuf* next = p->next;
+        if (__atomic_sub_fetch(&shinfo(p)->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+            pool_put(POOL_CHUNK, p->head);
+        }
+        pool_put(POOL_DESC, p);
+        p = next;
+    }
+}
+
+void pbuf_chain(struct pbuf* head, struct pbuf* tail) {
+    for (struct pbuf* p = head; p; p = p->next) {
+        p->tot_len += tail->tot_len;
+        if (!p->next) {
+            p->next = tail;
+            break;
+        }
+    }
+}
+
+uint32_t pbuf_count(struct pbuf* p) {
+    uint32_t count = 0;
+    for (; p; p = p->next) {
+        count++;
+    }
+    return count;
+}
+
+uint32_t pbuf_headroom(struct pbuf* p) {
+    return p->data - p->head;
+}
+
+uint32_t pbuf_tailroom(struct pbuf* p) {
+    return PBUF_END - (p->data - p->head) - p->len;
+}
+
+bool pbuf_shared(struct pbuf* p) {
+    return shinfo(p)->refs > 1;
+}
+
+// prepend a header in place. the headroom of a shared chunk belongs to every
+// clone, so callers that get NULL back chain a fresh header fragment instead
+uint8_t* pbuf_push(struct pbuf* p, uint32_t len) {
+    if (pbuf_shared(p) || pbuf_headroom(p) < len) return NULL;
+    p->data -= len;
+    p->len += len;
+    p->tot_len += len;
+    return p->data;
+}
+
+uint8_t* pbuf_pull(struct pbuf* p, uint32_t len) {
+    if (p->len < len) return NULL;
+    p->data += len;
+    p->len -= len;
+    p->tot_len -= len;
+    return p->data;
+}
+
+// grow the last fragment, returns where the new bytes go. clones of a
+// shared chunk would all append into the same tailroom, so they can't
+uint8_t* pbuf_put(struct pbuf* p, uint32_t len) {
+    struct pbuf* last = p;
+    while (last->next) {
+        last = last->next;
+    }
+    if (pbuf_shared(last) || pbuf_tailroom(last) < len) return NULL;
+
+    for (struct pbuf* q = p; q; q = q->next) {
+        q->tot_len += len;
+    }
+    uint8_t* tail = last->data + last->len;
+    last->len += len;
+    return tail;
+}
+
+uint32_t pbuf_copy_in(struct pbuf* p, uint32_t offset, const void* src, uint32_t len) {
+    const uint8_t* s = src;
+    uint32_t copied = 0;
+
+    for (; p && copied < len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint32_t n = p->len - offset;
+        if (n > len - copied) n = len - copied;
+        for (uint32_t i = 0; i < n; i++) {
+            p->data[offset + i] = s[copied + i];
+        }
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+uint32_t pbuf_copy_out(struct pbuf* p, uint32_t offset, void* dst, uint32_t len) {
+    uint8_t* d = dst;
+    uint32_t copied = 0;
+
+    for (; p && copied < len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        uint32_t n = p->len - offset;
+        if (n > len - copied) n = len - copied;
+        for (uint32_t i = 0; i < n; i++) {
+            d[copied + i] = p->data[offset + i];
+        }
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+void pbuf_get_stats(struct pbuf_stats* out) {
+    *out = stats;
+}
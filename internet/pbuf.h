@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// packet buffers are 2k chunks carved from pages, two to a page, with a
+// descriptor (struct pbuf) pointing into them. clones get their own
+// descriptor and share the chunk through a refcount kept at its tail.
+#define PBUF_CHUNK      2048
+#define PBUF_HEADROOM   128
+#define PBUF_MAX_DESCS  2048
+#define PBUF_MAX_PAGES  1024
+
+// per-cpu free lists move to and from the shared lists in batches
+#define PBUF_BATCH      32
+#define PBUF_CACHE_MAX  (2 * PBUF_BATCH)
+
+struct pbuf {
+    struct pbuf* next;   // next fragment of the same packet
+    uint8_t* head;       // start of the chunk
+    uint8_t* data;       // first byte of this fragment
+    uint32_t len;        // bytes in this fragment
+    uint32_t tot_len;    // bytes in this fragment and the ones after it
+};
+
+struct pbuf_stats {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t clones;
+    uint64_t failures;
+    uint32_t pages;
+};
+
+void pbuf_init(void);
+struct pbuf* pbuf_alloc(uint32_t len);
+struct pbuf* pbuf_clone(struct pbuf* p);
+void pbuf_free(struct pbuf* p);
+void pbuf_chain(struct pbuf* head, struct pbuf* tail);
+uint32_t pbuf_count(struct pbuf* p);
+
+uint32_t pbuf_headroom(struct pbuf* p);
+uint32_t pbuf_tailroom(struct pbuf* p);
+bool pbuf_shared(struct pbuf* p);
+uint8_t* pbuf_push(struct pbuf* p, uint32_t len);
+uint8_t* pbuf_pull(struct pbuf* p, uint32_t len);
+uint8_t* pbuf_put(struct pbuf* p, uint32_t len);
+
+uint32_t pbuf_copy_in(struct pbuf* p, uint32_t offset, const void* src, uint32_t len);
+uint32_t pbuf_copy_out(struct pbuf* p, uint32_t offset, void* dst, uint32_t len);
+void pbuf_get_stats(struct pbuf_stats* stats);
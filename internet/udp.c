@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <../spinlock.h>
+#include <../timer.h>
+#include <../sched/sched.h>
+#include <../sched/workqueue.h>
+#include <net.h>
+#include <udp.h>
+
+#define UDP_BENCH_WINDOW 32
+
+struct udp_dgram {
+    struct pbuf* p;
+    uint32_t ip;
+    uint16_t port;
+};
+
+struct udp_socket {
+    bool used;
+    bool wake;
+    uint16_t port;
+    uint32_t waiter;
+    struct udp_dgram queue[UDP_RX_QUEUE];
+    uint32_t head;
+    uint32_t count;
+    uint64_t drops;
+    struct work timeout;
+};
+
+static struct udp_socket sockets[UDP_MAX_SOCKETS];
+static spinlock_t udp_lock = SPINLOCK_INIT;
+static uint16_t next_ephemeral = UDP_EPHEMERAL_BASE;
+
+static uint64_t bench_rtt[UDP_BENCH_SAMPLES];
+static uint8_t bench_buf[UDP_MAX_PAYLOAD];
+
+static struct udp_socket* find_port(uint16_t port) {
+    for (int i = 0; i < UDP_MAX_SOCKETS; i++) {
+        if (sockets[i].used && sockets[i].port == port) return &sockets[i];
+    }
+    return NULL;
+}
+
+static void udp_expired(struct work* work) {
+    struct udp_socket* s = work->data;
+    if (s->waiter) task_wake(s->waiter);
+}
+
+void udp_init(void) {
+    for (int i = 0; i < UDP_MAX_SOCKETS; i++) {
+        sockets[i].used = false;
+        init_work(&sockets[i].timeout, udp_expired, &sockets[i]);
+    }
+}
+
+// port 0 picks a free ephemeral port
+int udp_open(uint16_t port) {
+    uint64_t flags = spin_lock_irqsave(&udp_lock);
+    if (port == 0) {
+        for (int tries = 0; tries < 0x4000; tries++) {
+            uint16_t candidate = next_ephemeral++;
+            if (next_ephemeral == 0) next_ephemeral = UDP_EPHEMERAL_BASE;
+            if (!find_port(candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+    }
+    if (port == 0 || find_port(port)) {
+        spin_unlock_irqrestore(&udp_lock, flags);
+        return -1;
+    }
+    
+    for (int i = 0; i < UDP_MAX_SOCKETS; i++) {
+        struct udp_socket* s = &sockets[i];
+        if (s->used) continue;
+        
+        s->used = true;
+        s->wake = false;
+        s->port = port;
+        s->waiter = 0;
+        s->head = 0;
+        s->count = 0;
+        s->drops = 0;
+        spin_unlock_irqrestore(&udp_lock, flags);
+        return i;
+    }
+    spin_unlock_irqrestore(&udp_lock, flags);
+    return -1;
+}
+
+void udp_close(int sock) {
+    if (sock < 0 || sock >= UDP_MAX_SOCKETS) return;
+    struct udp_socket* s = &sockets[sock];
+    
+    uint64_t flags = spin_lock_irqsave(&udp_lock);
+    while (s->count) {
+        pbuf_free(s->queue[s->head].p);
+        s->head = (s->head + 1) % UDP_RX_QUEUE;
+        s->count--;
+    }
+    s->used = false;
+    spin_unlock_irqrestore(&udp_lock, flags);
+}
+
+int udp_sendto(int sock, uint32_t ip, uint16_t port, const void* data, uint32_t len) {
+    if (sock < 0 || sock >= UDP_MAX_SOCKETS || !sockets[sock].used) return -1;
+    if (len > UDP_MAX_PAYLOAD) return -1;
+    
+    struct pbuf* p = pbuf_alloc(sizeof(struct udp_hdr) + len);
+    if (!p) return -1;
+    
+    // headers go in front of the payload, ip and ethernet push into the headroom
+    struct udp_hdr* udp = (struct udp_hdr*)p->data;
+    udp->sport = htons(sockets[sock].port);
+    udp->dport = htons(port);
+    udp->len = htons(sizeof(struct udp_hdr) + len);
+    udp->csum = 0;
+    pbuf_copy_in(p, sizeof(struct udp_hdr), data, len);
+    
+    uint32_t sum = net_csum_pseudo(net_get_addr(), ip, IP_PROTO_UDP, p->tot_len);
+    uint16_t csum = net_csum_fold(net_csum_partial(p->data, p->len, sum));
+    udp->csum = csum ? csum : 0xFFFF;
+    
+    return ip_output(p, ip, IP_PROTO_UDP) < 0 ? -1 : (int)len;
+}
+
+// runs from the rx batch, waking the reader is left to udp_rx_flush
+void udp_input(struct pbuf* p, uint32_t src, uint32_t dst) {
+    net_stats.rx_udp++;
+    
+    struct udp_hdr* udp = (struct udp_hdr*)p->data;
+    uint32_t len = p->len >= sizeof(struct udp_hdr) ? ntohs(udp->len) : 0;
+    if (len < sizeof(struct udp_hdr) || len > p->len) goto bad;
+    
+    if (udp->csum) {
+        uint32_t sum = net_csum_pseudo(src, dst, IP_PROTO_UDP, len);
+        if (net_csum_fold(net_csum_partial(p->data, len, sum)) != 0) goto bad;
+    }
+    
+    uint16_t sport = ntohs(udp->sport);
+    uint16_t dport = ntohs(udp->dport);
+    p->len = len;
+    p->tot_len = len;
+    pbuf_pull(p, sizeof(struct udp_hdr));
+    
+    uint64_t flags = spin_lock_irqsave(&udp_lock);
+    struct udp_socket* s = find_port(dport);
+    if (!s || s->count == UDP_RX_QUEUE) {
+        if (s) s->drops++;
+        spin_unlock_irqrestore(&udp_lock, flags);
+        net_stats.rx_dropped++;
+        pbuf_free(p);
+        return;
+    }
+    
+    struct udp_dgram* d = &s->queue[(s->head + s->count) % UDP_RX_QUEUE];
+    d->p = p;
+    d->ip = src;
+    d->port = sport;
+    s->count++;
+    s->wake = true;
+    spin_unlock_irqrestore(&udp_lock, flags);
+    return;
+
+bad:
+    net_stats.rx_bad++;
+    pbuf_free(p);
+}
+
+void udp_rx_flush(void) {
+    uint32_t wake[UDP_MAX_SOCKETS];
+    uint32_t nwake = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&udp_lock);
+    for (int i = 0; i < UDP_MAX_SOCKETS; i++) {
+        struct udp_socket* s = &sockets[i];
+        if (!s->wake) continue;
+        s->wake = false;
+        if (s->waiter) wake[nwake++] = s->waiter;
+    }
+    spin_unlock_irqrestore(&udp_lock, flags);
+    
+    for (uint32_t i = 0; i < nwake; i++) {
+        task_wake(wake[i]);
+    }
+}
+
+// copies out the next datagram, anything past len is discarded
+int udp_recvfrom(int sock, void* buf, uint32_t len, uint32_t* ip, uint16_t* port, uint32_t timeout_ms) {
+    if (sock < 0 || sock >= UDP_MAX_SOCKETS || !sockets[sock].used) return -1;
+    struct udp_socket* s = &sockets[sock];
+    uint64_t deadline = get_tick_count() + timeout_ms;
+    
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&udp_lock);
+        if (s->count) {
+            struct udp_dgram d = s->queue[s->head];
+            s->head = (s->head + 1) % UDP_RX_QUEUE;
+            s->count--;
+            s->waiter = 0;
+            spin_unlock_irqrestore(&udp_lock, flags);
+            
+            uint32_t n = pbuf_copy_out(d.p, 0, buf, len);
+            if (ip) *ip = d.ip;
+            if (port) *port = d.port;
+            pbuf_free(d.p);
+            return (int)n;
+        }
+        
+        uint64_t now = get_tick_count();
+        if (timeout_ms != UDP_FOREVER && now >= deadline) {
+            s->waiter = 0;
+            spin_unlock_irqrestore(&udp_lock, flags);
+            return -1;
+        }
+        s->waiter = get_current_tid();
+        spin_unlock_irqrestore(&udp_lock, flags);
+        
+        if (timeout_ms != UDP_FOREVER) {
+            queue_delayed_work(&s->timeout, deadline - now);
+        }
+        task_block();
+        cancel_work(&s->timeout);
+    }
+}
+
+static void sort_u64(uint64_t* v, uint32_t n) {
+    for (uint32_t gap = n / 2; gap; gap /= 2) {
+        for (uint32_t i = gap; i < n; i++) {
+            uint64_t x = v[i];
+            uint32_t j = i;
+            while (j >= gap && v[j - gap] > x) {
+                v[j] = v[j - gap];
+                j -= gap;
+            }
+            v[j] = x;
+        }
+    }
+}
+
+// ping-pong for round trip times, then a windowed burst for throughput.
+// the peer just has to send every datagram back (tools/udp_echo.py)
+int udp_bench_echo(uint32_t ip, uint16_t port, uint32_t count, uint32_t size, struct udp_bench_result* result) {
+    if (size > UDP_MAX_PAYLOAD || count == 0) return -1;
+    
+    int sock = udp_open(0);
+    if (sock < 0) return -1;
+    
+    for (uint32_t i = 0; i < size; i++) {
+        bench_buf[i] = (uint8_t)i;
+    }
+    *result = (struct udp_bench_result){ 0 };
+    
+    uint32_t samples = 0;
+    uint32_t rounds = count < UDP_BENCH_SAMPLES ? count : UDP_BENCH_SAMPLES;
+    for (uint32_t i = 0; i < rounds; i++) {
+        uint64_t start = ktime_get_ns();
+        if (udp_sendto(sock, ip, port, bench_buf, size) < 0) continue;
+        if (udp_recvfrom(sock, bench_buf, size, NULL, NULL, 1000) < 0) continue;
+        bench_rtt[samples++] = (ktime_get_ns() - start) / 1000;
+    }
+    
+    if (samples) {
+        sort_u64(bench_rtt, samples);
+        result->rtt_min_us = bench_rtt[0];
+        result->rtt_p50_us = bench_rtt[samples / 2];
+        result->rtt_p99_us = bench_rtt[(samples - 1) * 99 / 100];
+        result->rtt_max_us = bench_rtt[samples - 1];
+    }
+    
+    // keep a window of datagrams in flight, stop waiting once the peer goes quiet
+    uint32_t inflight = 0;
+    uint64_t start = ktime_get_ns();
+    while (result->sent < count || inflight) {
+        while (result->sent < count && inflight < UDP_BENCH_WINDOW) {
+            if (udp_sendto(sock, ip, port, bench_buf, size) < 0) break;
+            result->sent++;
+            inflight++;
+        }
+        if (udp_recvfrom(sock, bench_buf, size, NULL, NULL, 200) < 0) {
+            // whatever is still out there is lost, don't let it stall the window
+            inflight = 0;
+            continue;
+        }
+        result->received++;
+        if (inflight) inflight--;
+    }
+    uint64_t elapsed = ktime_get_ns() - start;
+    
+    udp_close(sock);
+    if (elapsed) {
+        result->pps = (uint64_t)result->received * 1000000000ULL / elapsed;
+        result->kbps = (uint64_t)result->received * size * 8 * 1000000ULL / elapsed;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UDP_MAX_SOCKETS    16
+#define UDP_RX_QUEUE       64
+#define UDP_EPHEMERAL_BASE 49152
+#define UDP_MAX_PAYLOAD    1472
+
+// recvfrom timeouts
+#define UDP_NOWAIT  0
+#define UDP_FOREVER 0xFFFFFFFF
+
+#define UDP_BENCH_SAMPLES 1024
+
+struct udp_bench_result {
+    uint32_t sent;
+    uint32_t received;
+    uint64_t rtt_min_us;
+    uint64_t rtt_p50_us;
+    uint64_t rtt_p99_us;
+    uint64_t rtt_max_us;
+    uint64_t pps;
+    uint64_t kbps;
+};
+
+int udp_open(uint16_t port);
+void udp_close(int sock);
+int udp_sendto(int sock, uint32_t ip, uint16_t port, const void* data, uint32_t len);
+int udp_recvfrom(int sock, void* buf, uint32_t len, uint32_t* ip, uint16_t* port, uint32_t timeout_ms);
+int udp_bench_echo(uint32_t ip, uint16_t port, uint32_t count, uint32_t size, struct udp_bench_result* result);
@@ -3,53 +3,75 @@
 #include <stdbool.h>
 #include <wifi.h>
 #include <../vm_pages.h>
+#include <../trace.h>
+#include <../timer.h>
+#include <../sched/sched.h>
+#include <../sched/async.h>
+
+// waiter once the request has finished, a wait that starts later doesn't park
+#define WIFI_WAITER_DONE 0xFFFFFFFF
 
 static uint64_t wifi_mapped_base = 0;
 static bool wifi_initialized = false;
 
+#ifdef WIFI_HOST_MODEL
+// host builds talk to the software device in tools/wifi_model instead of mmio
+uint32_t wifi_model_read32(uint32_t offset);
+void wifi_model_write32(uint32_t offset, uint32_t val);
+void wifi_model_write8(uint32_t offset, uint8_t val);
+#endif
+
+static void wifi_write8(uint32_t offset, uint8_t val) {
+#ifdef WIFI_HOST_MODEL
+    wifi_model_write8(offset, val);
+#else
+    *(volatile uint8_t*)(wifi_mapped_base + offset) = val;
+#endif
+}
+
 static void wifi_write_str(uint32_t offset, const char* str, size_t max_len) {
-    volatile char* reg = (volatile char*)(wifi_mapped_base + offset);
     size_t len = strlen(str);
     if (len >= max_len) len = max_len - 1;
     
     for (size_t i = 0; i < len; i++) {
-        reg[i] = str[i];
+        wifi_write8(offset + i, str[i]);
     }
-    reg[len] = 0;
+    wifi_write8(offset + len, 0);
 }
 
 static uint32_t wifi_read32(uint32_t offset) {
+#ifdef WIFI_HOST_MODEL
+    return wifi_model_read32(offset);
+#else
     return *(volatile uint32_t*)(wifi_mapped_base + offset);
+#endif
 }
 
 static void wifi_write32(uint32_t offset, uint32_t val) {
+    if (offset == 0x00) TRACE(wifi_cmd, val);
+#ifdef WIFI_HOST_MODEL
+    wifi_model_write32(offset, val);
+#else
     *(volatile uint32_t*)(wifi_mapped_base + offset) = val;
-}
-
-static void delay_ms(uint32_t ms) {
-    for (volatile uint32_t i = 0; i < ms * 10000; i++);
+#endif
 }
 
 static bool wifi_wait_status(uint32_t target, uint32_t timeout_ms) {
-    uint32_t elapsed = 0;
-    while (elapsed < timeout_ms) {
+    uint64_t start = ktime_get_ns();
+    uint64_t timeout_ns = (uint64_t)timeout_ms * 1000000;
+    uint64_t elapsed = 0;
+    while (elapsed < timeout_ns) {
         uint32_t status = wifi_read32(0x04);
+        TRACE(wifi_status, status, target, elapsed);
         if (status == target) return true;
         if (status == STATUS_FAILED) return false;
-        delay_ms(100);
-        elapsed += 100;
+        msleep(100);
+        elapsed = ktime_get_ns() - start;
     }
     return false;
 }
 
-static void wifi_reset_chip(void) {
-    wifi_write32(0x00, 0xFF);
-    delay_ms(100);
-    wifi_write32(0x00, 0x00);
-    delay_ms(500);
-}
-
-static bool wifi_init_hardware(void) {
+static bool wifi_map_device(void) {
     if (!wifi_initialized) {
         // map wifi device memory using vm subsystem
         wifi_mapped_base = 0x10000000;  // virtual address
@@ -58,13 +80,10 @@ static bool wifi_init_hardware(void) {
         }
         wifi_initialized = true;
     }
-    
-    wifi_reset_chip();
-    
-    if (wifi_read32(0x04) != STATUS_IDLE) {
-        return false;
-    }
-    
+    return true;
+}
+
+static void wifi_program_mac(void) {
     uint32_t mac_low = wifi_read32(0x88);
     uint32_t mac_high = wifi_read32(0x8C);
     
@@ -72,77 +91,281 @@ static bool wifi_init_hardware(void) {
         wifi_write32(0x88, 0x12345678);
         wifi_write32(0x8C, 0x9ABC0000);
     }
-    
-    return true;
 }
 
-static bool wifi_scan_network(const char* ssid) {
-    wifi_write_str(0x08, ssid, 32);
-    wifi_write32(0x00, CMD_SCAN);
-    
-    if (!wifi_wait_status(STATUS_SCANNING, 5000)) return false;
-    if (!wifi_wait_status(STATUS_IDLE, 15000)) return false;
-    
-    return true;
+static struct wifi_connect_req* active_req = NULL;
+static struct wifi_connect_req sync_req;
+
+static struct wifi_bss bss_cache[WIFI_BSS_CACHE];
+static char connected_ssid[WIFI_SSID_MAX];
+
+// true once the step can stop waiting: target hit, device failed, or out of time
+static bool wifi_step_done(struct wifi_connect_req* req, uint32_t target) {
+    req->status = wifi_read32(0x04);
+    TRACE(wifi_status, req->status, target, req->step);
+    if (req->status == target || req->status == STATUS_FAILED) return true;
+    return get_tick_count() >= req->deadline;
 }
 
-static bool wifi_authenticate(const char* ssid, const char* password) {
-    wifi_write_str(0x08, ssid, 32);
-    wifi_write_str(0x48, password ? password : "", 64);
-    
-    wifi_write32(0x00, CMD_CONNECT);
-    
-    if (!wifi_wait_status(STATUS_CONNECTING, 5000)) return false;
-    if (!wifi_wait_status(STATUS_CONNECTED, 30000)) return false;
-    
+static bool wifi_ip_done(struct wifi_connect_req* req) {
+    req->ip = wifi_read32(0x90);
+    return req->ip != 0 || get_tick_count() >= req->deadline;
+}
+
+static bool wifi_ping_done(struct wifi_connect_req* req) {
+    req->status = wifi_read32(0x04);
+    return req->status != STATUS_CONNECTED || get_tick_count() >= req->deadline;
+}
+
+#define WIFI_AWAIT_STATUS(t, req, target, timeout_ms, err) do { \
+    (req)->deadline = get_tick_count() + (timeout_ms); \
+    ASYNC_AWAIT(t, wifi_step_done((req), (target)), WIFI_POLL_MS); \
+    if ((req)->status != (target)) ASYNC_RETURN(t, err); \
+} while (0)
+
+static bool ssid_equal(const char* a, const char* b) {
+    for (int i = 0; i < WIFI_SSID_MAX; i++) {
+        if (a[i] != b[i]) return false;
+        if (!a[i]) return true;
+    }
     return true;
 }
 
-static bool wifi_get_ip(void) {
-    wifi_write32(0x00, CMD_GET_IP);
-    delay_ms(2000);
-    
-    uint32_t ip = wifi_read32(0x90);
-    return ip != 0;
+static void ssid_copy(char* dst, const char* src) {
+    int i = 0;
+    for (; i < WIFI_SSID_MAX - 1 && src[i]; i++) {
+        dst[i] = src[i];
+    }
+    dst[i] = 0;
 }
 
-static bool wifi_test_connection(void) {
-    wifi_write32(0x90, 0x08080808);
-    wifi_write32(0x00, CMD_PING);
-    delay_ms(3000);
+static struct wifi_bss* bss_lookup(const char* ssid) {
+    for (int i = 0; i < WIFI_BSS_CACHE; i++) {
+        if (bss_cache[i].valid && ssid_equal(bss_cache[i].ssid, ssid)) return &bss_cache[i];
+    }
+    return NULL;
+}
+
+// reuse the entry for ssid, else the oldest slot
+static struct wifi_bss* bss_update(const char* ssid) {
+    struct wifi_bss* bss = bss_lookup(ssid);
+    if (bss) return bss;
     
-    uint32_t status = wifi_read32(0x04);
-    return status == STATUS_CONNECTED;
+    bss = &bss_cache[0];
+    for (int i = 0; i < WIFI_BSS_CACHE; i++) {
+        if (!bss_cache[i].valid) {
+            bss = &bss_cache[i];
+            break;
+        }
+        if (bss_cache[i].seen < bss->seen) bss = &bss_cache[i];
+    }
+    ssid_copy(bss->ssid, ssid);
+    bss->valid = true;
+    bss->signal = 0;
+    bss->seen = 0;
+    bss->lease_ip = 0;
+    bss->lease_at = 0;
+    return bss;
 }
 
-int wifi_connect(const char* ssid, const char* password) {
-    if (!ssid || strlen(ssid) == 0) return -1;
+static bool bss_fresh(struct wifi_bss* bss, uint64_t now) {
+    return bss && bss->seen && now - bss->seen < WIFI_BSS_MAX_AGE_MS;
+}
+
+static bool lease_valid(struct wifi_bss* bss, uint64_t now) {
+    return bss && bss->lease_ip && now - bss->lease_at < WIFI_LEASE_MS;
+}
+
+// every wait re-reads STATUS each WIFI_POLL_MS, so a step ends as soon as the device moves.
+// a fresh cache entry skips reset and scan, a live lease skips dhcp, and the fast
+// path falls back to the full sequence if auth fails.
+static int wifi_connect_fn(struct async_task* t) {
+    struct wifi_connect_req* req = t->data;
+    struct wifi_bss* bss;
+    
+    ASYNC_BEGIN(t);
     
-    if (!wifi_init_hardware()) return -2;
+    if (wifi_read32(0x04) == STATUS_CONNECTED && ssid_equal(connected_ssid, req->ssid)) {
+        req->ip = wifi_read32(0x90);
+        ASYNC_RETURN(t, 0);
+    }
+    connected_ssid[0] = 0;
     
-    if (wifi_read32(0x04) == STATUS_CONNECTED) {
-        wifi_write32(0x00, CMD_DISCONNECT);
-        wifi_wait_status(STATUS_IDLE, 5000);
+    if (!req->fast) {
+        req->step = WIFI_STEP_RESET;
+        wifi_write32(0x00, 0xFF);
+        ASYNC_SLEEP(t, WIFI_RESET_PULSE_MS);
+        wifi_write32(0x00, 0x00);
+        WIFI_AWAIT_STATUS(t, req, STATUS_IDLE, WIFI_RESET_TIMEOUT_MS, WIFI_ERR_HARDWARE);
+        wifi_program_mac();
+        
+        req->step = WIFI_STEP_SCAN;
+        wifi_write_str(0x08, req->ssid, 32);
+        wifi_write32(0x00, CMD_SCAN);
+        WIFI_AWAIT_STATUS(t, req, STATUS_SCANNING, 5000, WIFI_ERR_SCAN);
+        WIFI_AWAIT_STATUS(t, req, STATUS_IDLE, 15000, WIFI_ERR_SCAN);
+        
+        bss = bss_update(req->ssid);
+        bss->signal = wifi_read32(0x94);
+        bss->seen = get_tick_count();
     }
     
-    if (!wifi_scan_network(ssid)) return -3;
+    req->step = WIFI_STEP_AUTH;
+    wifi_write_str(0x08, req->ssid, 32);
+    wifi_write_str(0x48, req->password ? req->password : "", 64);
+    wifi_write32(0x00, CMD_CONNECT);
+    req->deadline = get_tick_count() + 5000;
+    ASYNC_AWAIT(t, wifi_step_done(req, STATUS_CONNECTING), WIFI_POLL_MS);
+    if (req->status == STATUS_CONNECTING) {
+        req->deadline = get_tick_count() + 30000;
+        ASYNC_AWAIT(t, wifi_step_done(req, STATUS_CONNECTED), WIFI_POLL_MS);
+    }
+    if (req->status != STATUS_CONNECTED) {
+        if (!req->fast) ASYNC_RETURN(t, WIFI_ERR_AUTH);
+        
+        // stale cache, forget it and start over from the reset
+        bss = bss_lookup(req->ssid);
+        if (bss) bss->seen = 0;
+        req->fast = false;
+        req->fallbacks++;
+        t->resume = 0;
+        return ASYNC_YIELDED;
+    }
+    
+    req->step = WIFI_STEP_IP;
+    bss = bss_lookup(req->ssid);
+    if (lease_valid(bss, get_tick_count())) {
+        req->ip = bss->lease_ip;
+        wifi_write32(0x90, req->ip);
+    } else {
+        wifi_write32(0x00, CMD_GET_IP);
+        req->deadline = get_tick_count() + 2000;
+        ASYNC_AWAIT(t, wifi_ip_done(req), WIFI_POLL_MS);
+        if (req->ip == 0) ASYNC_RETURN(t, WIFI_ERR_IP);
+        req->lease_at = get_tick_count();
+    }
+    
+    // the device has no ping completion, only a drop out of CONNECTED means failure
+    if (!req->fast) {
+        req->step = WIFI_STEP_PING;
+        wifi_write32(0x90, 0x08080808);
+        wifi_write32(0x00, CMD_PING);
+        req->deadline = get_tick_count() + WIFI_PING_WINDOW_MS;
+        ASYNC_AWAIT(t, wifi_ping_done(req), WIFI_POLL_MS);
+        if (req->status != STATUS_CONNECTED) ASYNC_RETURN(t, WIFI_ERR_PING);
+        // the ping target went through the ip register, put our address back
+        wifi_write32(0x90, req->ip);
+    }
+    
+    bss = bss_update(req->ssid);
+    bss->seen = get_tick_count();
+    // any dhcp grant restarts the lease, even when it renews the same address
+    if (req->lease_at) {
+        bss->lease_ip = req->ip;
+        bss->lease_at = req->lease_at;
+    }
+    ssid_copy(connected_ssid, req->ssid);
+    
+    req->step = WIFI_STEP_DONE;
+    ASYNC_RETURN(t, 0);
+    
+    ASYNC_END(t);
+}
+
+static void wifi_connect_done(struct async_task* t) {
+    struct wifi_connect_req* req = t->data;
+    void (*callback)(struct wifi_connect_req* req, int result) = req->callback;
+    int result = t->result;
+    req->result = result;
+    async_event_signal(&req->done);
     
-    if (!wifi_authenticate(ssid, password)) return -4;
+    // whoever sees complete may free or reuse req, so it is stored last and
+    // the waiter is claimed before it rather than read after
+    uint32_t waiter = __atomic_exchange_n(&req->waiter, WIFI_WAITER_DONE, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&req->complete, true, __ATOMIC_SEQ_CST);
+    if (waiter && waiter != WIFI_WAITER_DONE) task_wake(waiter);
     
-    if (!wifi_get_ip()) return -5;
+    // req is not touched past here, the callback may free it or start the
+    // next connect with it
+    __atomic_store_n(&active_req, NULL, __ATOMIC_RELEASE);
+    if (callback) callback(req, result);
+}
+
+int wifi_connect_async(struct wifi_connect_req* req, const char* ssid, const char* password,
+                       uint32_t flags, void (*callback)(struct wifi_connect_req* req, int result)) {
+    if (!req || !ssid || strlen(ssid) == 0) return WIFI_ERR_ARGS;
+    if (!wifi_map_device()) return WIFI_ERR_HARDWARE;
+    struct wifi_connect_req* expected = NULL;
+    if (!__atomic_compare_exchange_n(&active_req, &expected, req, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return WIFI_ERR_BUSY;
+    }
     
-    if (!wifi_test_connection()) return -6;
+    req->ssid = ssid;
+    req->password = password;
+    req->callback = callback;
+    req->waiter = 0;
+    req->step = WIFI_STEP_RESET;
+    req->status = STATUS_IDLE;
+    req->ip = 0;
+    req->lease_at = 0;
+    req->result = 0;
+    req->fallbacks = 0;
+    req->complete = false;
+    req->fast = !(flags & WIFI_CONNECT_FULL) && bss_fresh(bss_lookup(ssid), get_tick_count());
+    req->task.state = ASYNC_IDLE;
+    async_event_init(&req->done);
     
+    if (async_start(&req->task, wifi_connect_fn, req, wifi_connect_done) < 0) {
+        active_req = NULL;
+        return WIFI_ERR_BUSY;
+    }
     return 0;
 }
 
+// parks the calling task until the state machine finishes. when done has
+// claimed the waiter first it is only a moment away from storing complete
+int wifi_connect_wait(struct wifi_connect_req* req) {
+    uint32_t none = 0;
+    bool parked = __atomic_compare_exchange_n(&req->waiter, &none, get_current_tid(), false,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&req->complete, __ATOMIC_SEQ_CST)) {
+        if (parked) {
+            task_block();
+        } else {
+            task_yield();
+        }
+    }
+    return req->result;
+}
+
+int wifi_connect(const char* ssid, const char* password) {
+    int ret = wifi_connect_async(&sync_req, ssid, password, 0, NULL);
+    if (ret < 0) return ret;
+    return wifi_connect_wait(&sync_req);
+}
+
 void wifi_disconnect(void) {
     if (!wifi_initialized) return;
     
+    connected_ssid[0] = 0;
     wifi_write32(0x00, CMD_DISCONNECT);
     wifi_wait_status(STATUS_IDLE, 5000);
 }
 
+int wifi_get_bss_cache(struct wifi_bss* out, int max) {
+    int n = 0;
+    for (int i = 0; i < WIFI_BSS_CACHE && n < max; i++) {
+        if (bss_cache[i].valid) out[n++] = bss_cache[i];
+    }
+    return n;
+}
+
+void wifi_flush_cache(void) {
+    for (int i = 0; i < WIFI_BSS_CACHE; i++) {
+        bss_cache[i].valid = false;
+    }
+}
+
 uint32_t wifi_get_ip_addr(void) {
     if (!wifi_initialized) return 0;
     return wifi_read32(0x90);
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <../sched/async.h>
 
 #define WIFI_BASE 0xE0000000
 #define WIFI_CMD (WIFI_BASE + 0x00)
@@ -25,8 +26,68 @@
 #define STATUS_FAILED 0x04
 #define STATUS_DISCONNECTED 0x05
 
+#define WIFI_ERR_ARGS     -1
+#define WIFI_ERR_HARDWARE -2
+#define WIFI_ERR_SCAN     -3
+#define WIFI_ERR_AUTH     -4
+#define WIFI_ERR_IP       -5
+#define WIFI_ERR_PING     -6
+#define WIFI_ERR_BUSY     -7
+
+#define WIFI_STEP_RESET 0
+#define WIFI_STEP_SCAN  1
+#define WIFI_STEP_AUTH  2
+#define WIFI_STEP_IP    3
+#define WIFI_STEP_PING  4
+#define WIFI_STEP_DONE  5
+
+#define WIFI_POLL_MS          10
+#define WIFI_RESET_PULSE_MS   100
+#define WIFI_RESET_TIMEOUT_MS 500
+#define WIFI_PING_WINDOW_MS   3000
+
+#define WIFI_SSID_MAX       32
+#define WIFI_BSS_CACHE      8
+#define WIFI_BSS_MAX_AGE_MS 60000
+#define WIFI_LEASE_MS       3600000
+
+// skip the cache and always reset, scan and ping
+#define WIFI_CONNECT_FULL 0x1
+
+struct wifi_bss {
+    char ssid[WIFI_SSID_MAX];
+    uint32_t signal;
+    uint64_t seen;
+    uint32_t lease_ip;
+    uint64_t lease_at;
+    bool valid;
+};
+
+struct wifi_connect_req {
+    const char* ssid;
+    const char* password;
+    void (*callback)(struct wifi_connect_req* req, int result);
+    struct async_task task;
+    struct async_event done;
+    uint32_t waiter;
+    uint32_t step;
+    uint32_t status;
+    uint32_t ip;
+    uint64_t deadline;
+    uint64_t lease_at;
+    uint32_t fallbacks;
+    int result;
+    bool fast;
+    volatile bool complete;
+};
+
 int wifi_connect(const char* ssid, const char* password);
+int wifi_connect_async(struct wifi_connect_req* req, const char* ssid, const char* password,
+                       uint32_t flags, void (*callback)(struct wifi_connect_req* req, int result));
+int wifi_connect_wait(struct wifi_connect_req* req);
 void wifi_disconnect(void);
 uint32_t wifi_get_ip_addr(void);
 uint32_t wifi_get_signal_strength(void);
 bool wifi_is_connected(void);
+int wifi_get_bss_cache(struct wifi_bss* out, int max);
+void wifi_flush_cache(void);
@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <vm_pages.h>
+#include <cpu.h>
+#include <irq.h>
+#include <sched/softirq.h>
+#include <sched/sched.h>
+
+#define GICD_CTLR       0x000
+#define GICD_TYPER      0x004
+#define GICD_ISENABLER  0x100
+#define GICD_ICENABLER  0x180
+#define GICD_IPRIORITYR 0x400
+#define GICD_ITARGETSR  0x800
+
+#define GICC_CTLR 0x00
+#define GICC_PMR  0x04
+#define GICC_IAR  0x0C
+#define GICC_EOIR 0x10
+
+#define GIC_SPURIOUS   1020
+#define GIC_FIRST_SPI  32
+#define IRQ_PRIORITY   0xA0
+
+struct irq_desc {
+    irq_handler_t handler;
+    void* data;
+    uint64_t count;
+};
+
+static struct irq_desc irq_table[MAX_IRQS];
+static volatile uint32_t irq_nesting[MAX_CPUS];
+static struct irq_frame* irq_frames[MAX_CPUS];
+
+extern void exception_vectors(void);
+extern void kernel_panic(const char* error);
+
+static void gicd_write(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)((uint64_t)GIC_DIST_BASE + offset) = value;
+}
+
+static uint32_t gicd_read(uint32_t offset) {
+    return *(volatile uint32_t*)((uint64_t)GIC_DIST_BASE + offset);
+}
+
+static void gicc_write(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)((uint64_t)GIC_CPU_BASE + offset) = value;
+}
+
+static uint32_t gicc_read(uint32_t offset) {
+    return *(volatile uint32_t*)((uint64_t)GIC_CPU_BASE + offset);
+}
+
+void irq_init(void) {
+    vm_map(GIC_DIST_BASE, GIC_DIST_BASE, PROT_READ | PROT_WRITE | PROT_DEVICE);
+    vm_map(GIC_CPU_BASE, GIC_CPU_BASE, PROT_READ | PROT_WRITE | PROT_DEVICE);
+    
+    for (int i = 0; i < MAX_IRQS; i++) {
+        irq_table[i].handler = NULL;
+        irq_table[i].data = NULL;
+        irq_table[i].count = 0;
+    }
+    
+    gicd_write(GICD_CTLR, 0);
+    
+    uint32_t lines = ((gicd_read(GICD_TYPER) & 0x1F) + 1) * 32;
+    if (lines > MAX_IRQS) lines = MAX_IRQS;
+    
+    for (uint32_t i = 0; i < lines; i += 32) {
+        gicd_write(GICD_ICENABLER + (i / 32) * 4, 0xFFFFFFFF);
+    }
+    for (uint32_t i = 0; i < lines; i += 4) {
+        uint32_t prio = IRQ_PRIORITY | (IRQ_PRIORITY << 8) | (IRQ_PRIORITY << 16) | (IRQ_PRIORITY << 24);
+        gicd_write(GICD_IPRIORITYR + i, prio);
+    }
+    // spis all go to cpu0 for now
+    for (uint32_t i = GIC_FIRST_SPI; i < lines; i += 4) {
+        gicd_write(GICD_ITARGETSR + i, 0x01010101);
+    }
+    
+    gicd_write(GICD_CTLR, 1);
+    irq_init_cpu();
+}
+
+// banked per-cpu state, every core runs this once
+void irq_init_cpu(void) {
+    uint32_t prio = IRQ_PRIORITY | (IRQ_PRIORITY << 8) | (IRQ_PRIORITY << 16) | (IRQ_PRIORITY << 24);
+    for (uint32_t i = 0; i < GIC_FIRST_SPI; i += 4) {
+        gicd_write(GICD_IPRIORITYR + i, prio);
+    }
+    
+    gicc_write(GICC_PMR, 0xF0);
+    gicc_write(GICC_CTLR, 1);
+    
+    __asm__ volatile(
+        "msr vbar_el1, %0\n"
+        "isb\n"
+        : : "r"((uint64_t)exception_vectors)
+    );
+}
+
+int irq_register(uint32_t irq, irq_handler_t handler, void* data) {
+    if (irq >= MAX_IRQS || !handler) return -1;
+    if (irq_table[irq].handler) return -1;
+    
+    irq_table[irq].data = data;
+    irq_table[irq].count = 0;
+    irq_table[irq].handler = handler;
+    return 0;
+}
+
+void irq_enable(uint32_t irq) {
+    if (irq >= MAX_IRQS) return;
+    gicd_write(GICD_ISENABLER + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+void irq_disable(uint32_t irq) {
+    if (irq >= MAX_IRQS) return;
+    gicd_write(GICD_ICENABLER + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+bool in_interrupt(void) {
+    return irq_nesting[smp_processor_id()] != 0;
+}
+
+// the interrupted context, for handlers that sample it
+struct irq_frame* irq_get_frame(void) {
+    return irq_frames[smp_processor_id()];
+}
+
+void handle_irq(struct irq_frame* frame) {
+    uint32_t cpu = smp_processor_id();
+    uint32_t iar = gicc_read(GICC_IAR);
+    uint32_t irq = iar & 0x3FF;
+    
+    if (irq >= GIC_SPURIOUS) return;
+    
+    struct irq_frame* outer = irq_frames[cpu];
+    irq_frames[cpu] = frame;
+    irq_nesting[cpu]++;
+    
+    if (irq < MAX_IRQS && irq_table[irq].handler) {
+        irq_table[irq].count++;
+        irq_table[irq].handler(irq, irq_table[irq].data);
+    }
+    
+    gicc_write(GICC_EOIR, iar);
+    irq_nesting[cpu]--;
+    irq_frames[cpu] = outer;
+    
+    // bottom halves run on the way out of the outermost irq
+    if (irq_nesting[cpu] == 0 && softirq_pending()) {
+        do_softirq();
+    }
+    // an irq that lands while do_softirq runs handlers must not switch the
+    // task away, need_resched is picked up on a later irq exit instead
+    if (irq_nesting[cpu] == 0 && !in_softirq()) {
+        sched_irq_exit();
+    }
+}
+
+void handle_bad_exception(uint64_t type, uint64_t esr, uint64_t elr) {
+    (void)type;
+    (void)esr;
+    (void)elr;
+    kernel_panic("unhandled exception");
+}
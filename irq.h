@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_IRQS 256
+
+// gicv2 on qemu virt
+#define GIC_DIST_BASE 0x08000000
+#define GIC_CPU_BASE  0x08010000
+
+typedef void (*irq_handler_t)(uint32_t irq, void* data);
+
+// layout pushed by save_regs in vectors.s
+struct irq_frame {
+    uint64_t x[19];
+    uint64_t fp;
+    uint64_t lr;
+    uint64_t elr;
+    uint64_t spsr;
+};
+
+void irq_init(void);
+void irq_init_cpu(void);
+int irq_register(uint32_t irq, irq_handler_t handler, void* data);
+void irq_enable(uint32_t irq);
+void irq_disable(uint32_t irq);
+void handle_irq(struct irq_frame* frame);
+struct irq_frame* irq_get_frame(void);
+bool in_interrupt(void);
@@ -1,24 +1,25 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <vm_pages.h>
-
-#define DEFAULT_FB_BASE 0xA0000000
-#define DEFAULT_FB_WIDTH 1024
-#define DEFAULT_FB_HEIGHT 768
-
-struct fb_info {
-    uint64_t base_addr;
-    uint32_t width;
-    uint32_t height;
-    uint32_t pitch;
-    uint32_t bpp;
-    uint32_t size;
-};
-
-static struct fb_info fb;
-static uint32_t cursor_x = 0;
-static uint32_t cursor_y = 0;
-
+#include <drivers/fb.h>
+#include <drivers/console.h>
+#include <drivers/klog.h>
+#include <drivers/uart.h>
+#include <drivers/virtio_net.h>
+#include <drivers/blk.h>
+#include <internet/pbuf.h>
+#include <internet/net.h>
+#include <cpu.h>
+#include <irq.h>
+#include <smp.h>
+#include <prof.h>
+#include <pagecache.h>
+#include <fs/fat.h>
+#include <timer.h>
+#include <sched/sched.h>
+#include <sched/softirq.h>
+#include <sched/workqueue.h>
+#include <sched/async.h>
 
 static void mmio_write(uint64_t addr, uint32_t value) {
    *(volatile uint32_t*)addr = value;
@@ -28,164 +29,24 @@ static uint32_t mmio_read(uint64_t addr) {
    return *(volatile uint32_t*)addr;
 }
 
-static int fb_detect(void) {
-    fb.base_addr = DEFAULT_FB_BASE;
-    fb.width = DEFAULT_FB_WIDTH;
-    fb.height = DEFAULT_FB_HEIGHT;
-    fb.pitch = fb.width * 4;
-    fb.size = fb.pitch * fb.height;
-    fb.bpp = 32;
-    return 0;
-}
-
-static uint8_t font[128][16] = {
-    [' '] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-    ['0'] = {0x00,0x00,0x3C,0x66,0x6E,0x76,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
-    ['1'] = {0x00,0x00,0x18,0x18,0x38,0x18,0x18,0x18,0x18,0x18,0x18,0x7E,0x00,0x00,0x00,0x00},
-    ['2'] = {0x00,0x00,0x3C,0x66,0x06,0x0C,0x30,0x60,0x60,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
-    ['3'] = {0x00,0x00,0x3C,0x66,0x06,0x06,0x1C,0x06,0x06,0x06,0x66,0x3C,0x00,0x00,0x00,0x00},
-    ['a'] = {0x00,0x00,0x00,0x00,0x3C,0x06,0x3E,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
-    ['b'] = {0x00,0x00,0x60,0x60,0x7C,0x66,0x66,0x66,0x66,0x66,0x66,0x7C,0x00,0x00,0x00,0x00},
-    ['c'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x60,0x60,0x60,0x60,0x66,0x3C,0x00,0x00,0x00,0x00},
-    ['d'] = {0x00,0x00,0x06,0x06,0x3E,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
-    ['e'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x66,0x7E,0x60,0x60,0x66,0x3C,0x00,0x00,0x00,0x00},
-    ['f'] = {0x00,0x00,0x1C,0x36,0x30,0x30,0x7C,0x30,0x30,0x30,0x30,0x30,0x00,0x00,0x00,0x00},
-    ['g'] = {0x00,0x00,0x00,0x00,0x3E,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x66,0x3C,0x00,0x00},
-    ['h'] = {0x00,0x00,0x60,0x60,0x6C,0x76,0x66,0x66,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
-    ['i'] = {0x00,0x00,0x18,0x18,0x00,0x38,0x18,0x18,0x18,0x18,0x18,0x3C,0x00,0x00,0x00,0x00},
-    ['j'] = {0x00,0x00,0x06,0x06,0x00,0x0E,0x06,0x06,0x06,0x06,0x06,0x66,0x66,0x3C,0x00,0x00},
-    ['k'] = {0x00,0x00,0x60,0x60,0x66,0x6C,0x78,0x70,0x78,0x6C,0x66,0x66,0x00,0x00,0x00,0x00},
-    ['l'] = {0x00,0x00,0x38,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x3C,0x00,0x00,0x00,0x00},
-    ['m'] = {0x00,0x00,0x00,0x00,0x66,0xFF,0xDB,0xDB,0xDB,0xDB,0xDB,0xDB,0x00,0x00,0x00,0x00},
-    ['n'] = {0x00,0x00,0x00,0x00,0x7C,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
-    ['o'] = {0x00,0x00,0x00,0x00,0x3C,0x66,0x66,0x66,0x66,0x66,0x66,0x3C,0x00,0x00,0x00,0x00},
-    ['p'] = {0x00,0x00,0x00,0x00,0x7C,0x66,0x66,0x66,0x66,0x66,0x7C,0x60,0x60,0x60,0x00,0x00},
-    ['q'] = {0x00,0x00,0x00,0x00,0x3E,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x06,0x06,0x00,0x00},
-    ['r'] = {0x00,0x00,0x00,0x00,0x6C,0x76,0x66,0x60,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00},
-    ['s'] = {0x00,0x00,0x00,0x00,0x3E,0x60,0x60,0x3C,0x06,0x06,0x06,0x7C,0x00,0x00,0x00,0x00},
-    ['t'] = {0x00,0x00,0x18,0x18,0x7E,0x18,0x18,0x18,0x18,0x18,0x18,0x0E,0x00,0x00,0x00,0x00},
-    ['u'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x00,0x00,0x00,0x00},
-    ['v'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x3C,0x18,0x18,0x00,0x00,0x00,0x00},
-    ['w'] = {0x00,0x00,0x00,0x00,0x63,0x63,0x6B,0x6B,0x6B,0x36,0x36,0x36,0x00,0x00,0x00,0x00},
-    ['x'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x3C,0x18,0x3C,0x66,0x66,0x66,0x00,0x00,0x00,0x00},
-    ['y'] = {0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x66,0x66,0x3E,0x06,0x66,0x3C,0x00,0x00},
-    ['z'] = {0x00,0x00,0x00,0x00,0x7E,0x06,0x0C,0x18,0x30,0x60,0x60,0x7E,0x00,0x00,0x00,0x00},
-    ['-'] = {0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-    ['@'] = {0x00,0x00,0x3C,0x66,0x66,0x6E,0x6E,0x60,0x62,0x60,0x60,0x3C,0x00,0x00,0x00,0x00},
-    ['.'] = {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x00,0x00},
-    [':'] = {0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x00,0x00,0x00,0x00,0x00,0x00},
-    ['/'] = {0x00,0x00,0x02,0x06,0x0C,0x18,0x30,0x60,0x60,0x60,0x60,0x00,0x00,0x00,0x00,0x00},
-    ['#'] = {0x00,0x00,0x36,0x36,0x7F,0x36,0x36,0x36,0x7F,0x36,0x36,0x36,0x00,0x00,0x00,0x00},
-    ['~'] = {0x00,0x00,0x00,0x00,0x00,0x76,0xDC,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}
-};
-
-static void fb_init(void) {
-   for (uint64_t offset = 0; offset < fb.size; offset += PAGE_SIZE) {
-       vm_map(fb.base_addr + offset, fb.base_addr + offset, PROT_READ | PROT_WRITE);
-   }
-}
-
-static void fb_clear(uint32_t color) {
-   volatile uint32_t* fbptr = (volatile uint32_t*)fb.base_addr;
-   for (uint32_t i = 0; i < fb.width * fb.height; i++) {
-       fbptr[i] = color;
-   }
-   cursor_x = 0;
-   cursor_y = 0;
-}
-
-static void fb_putchar(char c, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
-   if (x >= fb.width || y >= fb.height) return;
-   
-   uint8_t* glyph = font[(uint8_t)c];
-   volatile uint32_t* fbptr = (volatile uint32_t*)fb.base_addr;
-   
-   for (int row = 0; row < 16; row++) {
-       for (int col = 0; col < 8; col++) {
-           if (x + col >= fb.width || y + row >= fb.height) continue;
-           uint32_t color = (glyph[row] & (1 << (7 - col))) ? fg : bg;
-           fbptr[(y + row) * fb.width + (x + col)] = color;
-       }
-   }
-}
-
-static void fb_puts(const char* str, uint32_t x, uint32_t y, uint32_t fg, uint32_t bg) {
-   cursor_x = x;
-   cursor_y = y;
-   while (*str) {
-       if (*str == '\n') {
-           cursor_y += 16;
-           cursor_x = x;
-       } else {
-           if (cursor_x < fb.width && cursor_y < fb.height) {
-               fb_putchar(*str, cursor_x, cursor_y, fg, bg);
-               cursor_x += 8;
-           }
-       }
-       str++;
-   }
-}
-
-static void fb_scroll(void) {
-   volatile uint32_t* fbptr = (volatile uint32_t*)fb.base_addr;
-   for (uint32_t y = 0; y < fb.height - 16; y++) {
-       for (uint32_t x = 0; x < fb.width; x++) {
-           fbptr[y * fb.width + x] = fbptr[(y + 16) * fb.width + x];
-       }
-   }
-   for (uint32_t y = fb.height - 16; y < fb.height; y++) {
-       for (uint32_t x = 0; x < fb.width; x++) {
-           fbptr[y * fb.width + x] = 0x000000;
-       }
-   }
-}
-
-static void fb_print(const char* str, uint32_t fg, uint32_t bg) {
-   uint32_t cur_x = cursor_x;
-   uint32_t cur_y = cursor_y;
+static void panic_serial(const char* str) {
    while (*str) {
-       if (*str == '\n') {
-           cur_y += 16;
-           cur_x = 0;
-           if (cur_y >= fb.height) {
-               fb_scroll();
-               cur_y = fb.height - 16;
-           }
-       } else {
-           if (cur_x + 8 >= fb.width) {
-               cur_y += 16;
-               cur_x = 0;
-               if (cur_y >= fb.height) {
-                   fb_scroll();
-                   cur_y = fb.height - 16;
-               }
-           }
-           if (cur_x < fb.width && cur_y < fb.height) {
-               fb_putchar(*str, cur_x, cur_y, fg, bg);
-               cur_x += 8;
-           }
-       }
-       str++;
+       uart_putc_sync(*str++);
    }
-   cursor_x = cur_x;
-   cursor_y = cur_y;
 }
 
-static void fb_newline(void) {
-   cursor_x = 0;
-   cursor_y += 16;
-   if (cursor_y >= fb.height) {
-       fb_scroll();
-       cursor_y = fb.height - 16;
-   }
-}
-
-
-
 void kernel_panic(const char* error) {
-   fb_clear(0x000000);
-   fb_print("KERNEL PANIC: ", 0xFF0000, 0x000000);
-   fb_print(error, 0xFF0000, 0x000000);
+   // whatever is still queued in the log goes out first, the drainer may never run again
+   klog_flush();
+   
+   // polled, so it still gets out with interrupts off or the tx lock held
+   panic_serial("\r\nKERNEL PANIC: ");
+   panic_serial(error);
+   panic_serial("\r\n");
+   
+   console_clear(0x000000);
+   console_print("KERNEL PANIC: ", 0xFF0000, 0x000000);
+   console_print(error, 0xFF0000, 0x000000);
    while(1) {
        asm volatile("wfi");
    }
@@ -195,9 +56,27 @@ void kernel_main(void) {
    vm_init();
    set_page_table_base(0x1000);
    
+   irq_init();
+   uart_init();
+   prof_init();
+   sched_init();
+   timer_init();
+   softirq_init();
+   workqueue_init();
+   async_init();
+   pbuf_init();
+   smp_boot_secondaries();
+   local_irq_enable();
+   
    fb_detect();
    fb_init();
-   fb_clear(0x000000);
+   console_init();
+   klog_init();
+   virtio_net_init();
+   net_init();
+   blk_init();
+   pcache_init();
+   fat_mount();
    fb_puts("Hello From Comet OS\n", 10, 10, 0xFFFFFF, 0x000000);
    
    while(1) {
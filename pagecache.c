@@ -0,0 +1,520 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <vm_pages.h>
+#include <spinlock.h>
+#include <pagecache.h>
+#include <sched/sched.h>
+#include <drivers/blk.h>
+
+#define PG_USED       (1 << 0)
+#define PG_UPTODATE   (1 << 1)
+#define PG_LOCKED     (1 << 2)
+#define PG_REFERENCED (1 << 3)
+#define PG_READAHEAD  (1 << 4)
+#define PG_ERROR      (1 << 5)
+
+#define SECTORS_PER_PAGE (PAGE_SIZE / BLK_SECTOR_SIZE)
+#define NO_INDEX ((uint64_t)-1)
+
+// LOCKED means a read is in flight, refs pins the page against eviction
+struct pcache_page {
+    struct pcache_mapping* mapping;
+    uint32_t id;
+    uint64_t index;
+    uint64_t phys;
+    uint32_t flags;
+    uint32_t refs;
+    uint32_t io_pending;
+    int io_status;
+    struct pcache_page* hash_next;
+};
+
+static struct pcache_page pages[PCACHE_MAX_PAGES];
+static struct pcache_page* hash[PCACHE_HASH_SIZE];
+static struct pcache_page* free_descs = NULL;
+static uint32_t clock_hand = 0;
+static uint32_t next_mapping_id = 1;
+
+static struct bio bios[PCACHE_MAX_BIOS];
+static struct bio* free_bios = NULL;
+static uint32_t nr_free_bios = 0;
+
+static uint32_t waiters[PCACHE_MAX_WAITERS];
+
+static spinlock_t pcache_lock = SPINLOCK_INIT;
+static struct pcache_stats stats;
+static struct pcache_mapping blkdev_mapping;
+
+static inline uint32_t hash_key(uint32_t id, uint64_t index) {
+    uint64_t key = (index ^ ((uint64_t)id << 40)) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(key >> (64 - PCACHE_HASH_BITS));
+}
+
+static struct pcache_page* lookup(struct pcache_mapping* m, uint64_t index) {
+    struct pcache_page* p = hash[hash_key(m->id, index)];
+    while (p && (p->mapping != m || p->id != m->id || p->index != index)) {
+        p = p->hash_next;
+    }
+    return p;
+}
+
+static void unhash(struct pcache_page* page) {
+    struct pcache_page** pp = &hash[hash_key(page->id, page->index)];
+    while (*pp != page) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = page->hash_next;
+    page->flags = 0;
+    stats.pages--;
+}
+
+// the descriptor goes back on the free list, its page back to vm_pages
+static void release(struct pcache_page* page) {
+    unhash(page);
+    if (page->phys) free_page(page->phys);
+    page->phys = 0;
+    page->hash_next = free_descs;
+    free_descs = page;
+}
+
+// second chance: referenced pages get their bit cleared and are passed over
+// once, pinned pages and pages under I/O are never taken
+static struct pcache_page* clock_evict(void) {
+    for (uint32_t scanned = 0; scanned < 2 * PCACHE_MAX_PAGES; scanned++) {
+        struct pcache_page* p = &pages[clock_hand];
+        clock_hand = (clock_hand + 1) % PCACHE_MAX_PAGES;
+        
+        if (!(p->flags & PG_USED) || p->refs || (p->flags & PG_LOCKED)) continue;
+        if (p->flags & PG_REFERENCED) {
+            p->flags &= ~PG_REFERENCED;
+            continue;
+        }
+        unhash(p);
+        stats.evictions++;
+        return p;
+    }
+    return NULL;
+}
+
+// a new locked page in the hash, it keeps the old page's memory when it
+// had to evict to get a descriptor. NULL when everything is pinned
+static struct pcache_page* new_page(struct pcache_mapping* m, uint64_t index, uint32_t flags, uint32_t refs) {
+    struct pcache_page* page = free_descs;
+    if (page) {
+        free_descs = page->hash_next;
+    } else {
+        page = clock_evict();
+        if (!page) return NULL;
+    }
+    
+    uint32_t h = hash_key(m->id, index);
+    page->mapping = m;
+    page->id = m->id;
+    page->index = index;
+    page->flags = PG_USED | PG_LOCKED | flags;
+    page->refs = refs;
+    page->io_pending = 0;
+    page->io_status = BLK_OK;
+    page->hash_next = hash[h];
+    hash[h] = page;
+    stats.pages++;
+    return page;
+}
+
+static struct bio* bio_get(void) {
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    struct bio* bio = free_bios;
+    if (bio) {
+        free_bios = bio->next;
+        nr_free_bios--;
+    }
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    return bio;
+}
+
+static void bio_put_locked(struct bio* bio) {
+    bio->next = free_bios;
+    free_bios = bio;
+    nr_free_bios++;
+}
+
+static void wake_waiters(void) {
+    uint32_t wake[PCACHE_MAX_WAITERS];
+    uint32_t nwake = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    for (int i = 0; i < PCACHE_MAX_WAITERS; i++) {
+        if (waiters[i]) {
+            wake[nwake++] = waiters[i];
+            waiters[i] = 0;
+        }
+    }
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    
+    for (uint32_t i = 0; i < nwake; i++) {
+        task_wake(wake[i]);
+    }
+}
+
+static void read_finished(struct pcache_page* page) {
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    page->flags &= ~PG_LOCKED;
+    if (page->io_status == BLK_OK) {
+        page->flags |= PG_UPTODATE;
+    } else {
+        page->flags |= PG_ERROR;
+        stats.io_errors++;
+        // nobody is waiting on a failed readahead page, drop it so the next
+        // access tries again
+        if (!page->refs) release(page);
+    }
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    wake_waiters();
+}
+
+static void read_done(struct bio* bio) {
+    struct pcache_page* page = bio->private;
+    if (bio->status != BLK_OK) page->io_status = bio->status;
+    
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    bio_put_locked(bio);
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    
+    if (__atomic_sub_fetch(&page->io_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        read_finished(page);
+    }
+}
+
+static void zero_range(uint8_t* p, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        p[i] = 0;
+    }
+}
+
+// one bio per run, the extra pending count keeps completions from finishing
+// the page before every bio is out. with the bio pool empty, whatever sits
+// in the caller's plug goes out first, it may be what the others wait for
+static void start_read(struct pcache_page* page, struct blk_plug* plug) {
+    struct pcache_run runs[PCACHE_MAX_RUNS];
+    uint8_t* data = (uint8_t*)page->phys;
+    
+    int n = page->mapping->ops->map(page->mapping, page->index, runs, PCACHE_MAX_RUNS);
+    page->io_pending = 1;
+    if (n < 0) {
+        page->io_status = BLK_EIO;
+        n = 0;
+    }
+    
+    uint32_t off = 0;
+    for (int i = 0; i < n && off < PAGE_SIZE; i++) {
+        uint32_t len = runs[i].count * BLK_SECTOR_SIZE;
+        if (len > PAGE_SIZE - off) len = PAGE_SIZE - off;
+        if (runs[i].sector == PCACHE_HOLE) {
+            zero_range(data + off, len);
+            off += len;
+            continue;
+        }
+        
+        struct bio* bio;
+        while (!(bio = bio_get())) {
+            if (plug) blk_unplug(plug);
+            task_yield();
+        }
+        bio->sector = runs[i].sector;
+        bio->buf = data + off;
+        bio->len = len;
+        bio->op = BLK_READ;
+        bio->private = page;
+        
+        __atomic_add_fetch(&page->io_pending, 1, __ATOMIC_ACQ_REL);
+        int err = blk_submit_plugged(plug, bio, read_done);
+        if (err != BLK_OK) {
+            page->io_status = err;
+            bio->status = err;
+            read_done(bio);
+        }
+        off += len;
+    }
+    zero_range(data + off, PAGE_SIZE - off);
+    
+    if (__atomic_sub_fetch(&page->io_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        read_finished(page);
+    }
+}
+
+// memory is taken outside the lock since allocating may call back into
+// pcache_shrink. an evicted descriptor already brings its own page
+static bool attach_memory(struct pcache_page* page, bool pinned) {
+    if (page->phys) return true;
+    page->phys = alloc_page();
+    if (page->phys) return true;
+    
+    // others may have found the page meanwhile, the last put drops it
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    page->flags = (page->flags & ~PG_LOCKED) | PG_ERROR;
+    if (pinned) page->refs--;
+    if (!page->refs) release(page);
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    wake_waiters();
+    return false;
+}
+
+static void wait_page(struct pcache_page* page) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&pcache_lock);
+        if (!(page->flags & PG_LOCKED)) {
+            spin_unlock_irqrestore(&pcache_lock, flags);
+            return;
+        }
+        bool queued = false;
+        uint32_t tid = get_current_tid();
+        for (int i = 0; i < PCACHE_MAX_WAITERS && tid; i++) {
+            if (!waiters[i] || waiters[i] == tid) {
+                waiters[i] = tid;
+                queued = true;
+                break;
+            }
+        }
+        spin_unlock_irqrestore(&pcache_lock, flags);
+        
+        if (queued) {
+            task_block();
+        } else {
+            task_yield();
+        }
+    }
+}
+
+// sequential access grows the window, anything else collapses it. once the
+// reader is halfway into what was already read ahead, a whole window more
+// goes out so the device sees requests as large as the window
+static bool readahead_window(struct pcache_mapping* m, uint64_t index, uint64_t* start, uint64_t* end) {
+    if (index == m->prev_index + 1) {
+        uint32_t w = m->ra_window ? m->ra_window * 2 : PCACHE_RA_MIN;
+        m->ra_window = w > PCACHE_RA_MAX ? PCACHE_RA_MAX : w;
+    } else if (index != m->prev_index) {
+        m->ra_window = 0;
+        m->ra_next = 0;
+    }
+    m->prev_index = index;
+    if (!m->ra_window) return false;
+    
+    if (m->ra_next > index + m->ra_window / 2) return false;
+    *start = m->ra_next > index + 1 ? m->ra_next : index + 1;
+    *end = *start + m->ra_window;
+    if (*end > m->nr_pages) *end = m->nr_pages;
+    m->ra_next = *end;
+    return *start < *end;
+}
+
+// plugged so neighbouring pages merge into a few large requests. stops
+// early rather than wait for bios, the pages it skipped are read ahead again
+// on the next access
+static void readahead(struct pcache_mapping* m, uint64_t start, uint64_t end) {
+    struct blk_plug plug;
+    uint64_t index;
+    blk_plug(&plug);
+    for (index = start; index < end; index++) {
+        uint64_t flags = spin_lock_irqsave(&pcache_lock);
+        if (lookup(m, index)) {
+            spin_unlock_irqrestore(&pcache_lock, flags);
+            continue;
+        }
+        if (nr_free_bios < PCACHE_MAX_RUNS) {
+            spin_unlock_irqrestore(&pcache_lock, flags);
+            break;
+        }
+        struct pcache_page* page = new_page(m, index, PG_READAHEAD, 0);
+        if (page) stats.ra_pages++;
+        spin_unlock_irqrestore(&pcache_lock, flags);
+        
+        if (!page || !attach_memory(page, false)) break;
+        start_read(page, &plug);
+    }
+    blk_unplug(&plug);
+    
+    if (index < end) {
+        uint64_t flags = spin_lock_irqsave(&pcache_lock);
+        if (m->ra_next > index) m->ra_next = index;
+        spin_unlock_irqrestore(&pcache_lock, flags);
+    }
+}
+
+struct pcache_page* pcache_get(struct pcache_mapping* m, uint64_t index) {
+    if (index >= m->nr_pages) return NULL;
+    
+    uint64_t ra_start, ra_end;
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    bool ra = readahead_window(m, index, &ra_start, &ra_end);
+    struct pcache_page* page = lookup(m, index);
+    if (page) {
+        page->refs++;
+        page->flags |= PG_REFERENCED;
+        if (page->flags & PG_READAHEAD) {
+            page->flags &= ~PG_READAHEAD;
+            stats.ra_hits++;
+        }
+        stats.hits++;
+        spin_unlock_irqrestore(&pcache_lock, flags);
+    } else {
+        stats.misses++;
+        page = new_page(m, index, PG_REFERENCED, 1);
+        spin_unlock_irqrestore(&pcache_lock, flags);
+        if (!page || !attach_memory(page, true)) return NULL;
+        start_read(page, NULL);
+    }
+    
+    // the demand page is already on its way, the window behind it goes out
+    // as one merged request
+    if (ra) readahead(m, ra_start, ra_end);
+    
+    wait_page(page);
+    if (page->flags & PG_ERROR) {
+        pcache_put(page);
+        return NULL;
+    }
+    return page;
+}
+
+// for callers that know how much they are about to read, e.g. one large
+// file read. pages already cached are skipped
+void pcache_readahead(struct pcache_mapping* m, uint64_t index, uint64_t nr_pages) {
+    if (index >= m->nr_pages) return;
+    uint64_t end = nr_pages < m->nr_pages - index ? index + nr_pages : m->nr_pages;
+    
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    if (m->ra_next < end) m->ra_next = end;
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    readahead(m, index, end);
+}
+
+void pcache_put(struct pcache_page* page) {
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    if (--page->refs == 0 && (page->flags & PG_ERROR)) release(page);
+    spin_unlock_irqrestore(&pcache_lock, flags);
+}
+
+void* pcache_data(struct pcache_page* page) {
+    return (void*)page->phys;
+}
+
+int pcache_read(struct pcache_mapping* m, uint64_t offset, void* buf, uint32_t len) {
+    uint8_t* dst = buf;
+    uint32_t done = 0;
+    
+    while (done < len) {
+        uint64_t pos = offset + done;
+        struct pcache_page* page = pcache_get(m, pos >> PAGE_SHIFT);
+        if (!page) break;
+        
+        uint32_t off = pos & (PAGE_SIZE - 1);
+        uint32_t n = PAGE_SIZE - off;
+        if (n > len - done) n = len - done;
+        const uint8_t* src = (const uint8_t*)pcache_data(page) + off;
+        for (uint32_t i = 0; i < n; i++) {
+            dst[done + i] = src[i];
+        }
+        pcache_put(page);
+        done += n;
+    }
+    return done || !len ? (int)done : -1;
+}
+
+// pages still pinned or under I/O stay behind and age out through the clock
+void pcache_invalidate(struct pcache_mapping* m) {
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    for (int i = 0; i < PCACHE_MAX_PAGES; i++) {
+        struct pcache_page* p = &pages[i];
+        if (!(p->flags & PG_USED) || p->mapping != m) continue;
+        if (p->refs || (p->flags & PG_LOCKED)) continue;
+        release(p);
+    }
+    m->prev_index = NO_INDEX;
+    m->ra_next = 0;
+    m->ra_window = 0;
+    spin_unlock_irqrestore(&pcache_lock, flags);
+}
+
+// registered with vm_pages, so it may run from inside any alloc_page.
+// if the caller already holds the cache lock there is nothing to give
+uint64_t pcache_shrink(uint64_t nr_pages) {
+    uint64_t flags = local_irq_save();
+    if (!spin_trylock(&pcache_lock)) {
+        local_irq_restore(flags);
+        return 0;
+    }
+    
+    uint64_t freed = 0;
+    while (freed < nr_pages) {
+        struct pcache_page* p = clock_evict();
+        if (!p) break;
+        // clock_evict already unhashed it
+        free_page(p->phys);
+        p->phys = 0;
+        p->hash_next = free_descs;
+        free_descs = p;
+        freed++;
+    }
+    stats.shrunk += freed;
+    spin_unlock_irqrestore(&pcache_lock, flags);
+    return freed;
+}
+
+void pcache_get_stats(struct pcache_stats* out) {
+    uint64_t flags = spin_lock_irqsave(&pcache_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&pcache_lock, flags);
+}
+
+// every init hands out a new id, so pages a previous user of m left behind
+// are never found again and just age out
+void pcache_mapping_init(struct pcache_mapping* m, const struct pcache_mapping_ops* ops, void* private, uint64_t nr_pages) {
+    m->ops = ops;
+    m->private = private;
+    m->nr_pages = nr_pages;
+    m->prev_index = NO_INDEX;
+    m->ra_next = 0;
+    m->ra_window = 0;
+    m->id = __atomic_fetch_add(&next_mapping_id, 1, __ATOMIC_RELAXED);
+}
+
+static int blkdev_map(struct pcache_mapping* m, uint64_t index, struct pcache_run* runs, int max) {
+    (void)m;
+    if (max < 1) return -1;
+    uint64_t sector = index * SECTORS_PER_PAGE;
+    uint64_t left = blk_capacity() - sector;
+    runs[0].sector = sector;
+    runs[0].count = left < SECTORS_PER_PAGE ? (uint32_t)left : SECTORS_PER_PAGE;
+    return 1;
+}
+
+static const struct pcache_mapping_ops blkdev_ops = {
+    .map = blkdev_map,
+};
+
+// the whole disk as one mapping, NULL without a block device
+struct pcache_mapping* pcache_blkdev(void) {
+    return blkdev_mapping.ops ? &blkdev_mapping : NULL;
+}
+
+void pcache_init(void) {
+    for (int i = 0; i < PCACHE_HASH_SIZE; i++) {
+        hash[i] = NULL;
+    }
+    for (int i = PCACHE_MAX_PAGES - 1; i >= 0; i--) {
+        pages[i].flags = 0;
+        pages[i].phys = 0;
+        pages[i].hash_next = free_descs;
+        free_descs = &pages[i];
+    }
+    for (int i = 0; i < PCACHE_MAX_BIOS; i++) {
+        bio_put_locked(&bios[i]);
+    }
+    
+    if (blk_ready()) {
+        uint64_t sectors = blk_capacity();
+        pcache_mapping_init(&blkdev_mapping, &blkdev_ops, NULL, (sectors + SECTORS_PER_PAGE - 1) / SECTORS_PER_PAGE);
+    }
+    vm_register_shrinker(pcache_shrink);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PCACHE_HASH_BITS  10
+#define PCACHE_HASH_SIZE  (1 << PCACHE_HASH_BITS)
+#define PCACHE_MAX_PAGES  4096
+#define PCACHE_MAX_BIOS   256
+#define PCACHE_MAX_WAITERS 16
+
+// a page is at most one run per sector
+#define PCACHE_MAX_RUNS   8
+
+// readahead window in pages, doubled on every sequential hit
+#define PCACHE_RA_MIN     4
+#define PCACHE_RA_MAX     32
+
+// a run with this sector is zero filled instead of read
+#define PCACHE_HOLE       ((uint64_t)-1)
+
+struct pcache_run {
+    uint64_t sector;
+    uint32_t count;
+};
+
+struct pcache_mapping;
+
+struct pcache_mapping_ops {
+    // where page index lives on disk, at most max runs adding up to a page.
+    // sectors not covered by a run read as zeroes. returns the number of runs or -1
+    int (*map)(struct pcache_mapping* m, uint64_t index, struct pcache_run* runs, int max);
+};
+
+// one file or device, pages are keyed by (mapping, index)
+struct pcache_mapping {
+    const struct pcache_mapping_ops* ops;
+    void* private;
+    uint32_t id;
+    uint64_t nr_pages;
+    uint64_t prev_index;
+    uint64_t ra_next;
+    uint32_t ra_window;
+};
+
+struct pcache_page;
+
+struct pcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t ra_pages;
+    uint64_t ra_hits;
+    uint64_t evictions;
+    uint64_t shrunk;
+    uint64_t io_errors;
+    uint32_t pages;
+};
+
+void pcache_init(void);
+void pcache_mapping_init(struct pcache_mapping* m, const struct pcache_mapping_ops* ops, void* private, uint64_t nr_pages);
+struct pcache_mapping* pcache_blkdev(void);
+
+// returns the page uptodate and pinned until pcache_put, NULL past the end or on error
+struct pcache_page* pcache_get(struct pcache_mapping* m, uint64_t index);
+void pcache_put(struct pcache_page* page);
+void pcache_readahead(struct pcache_mapping* m, uint64_t index, uint64_t nr_pages);
+void* pcache_data(struct pcache_page* page);
+
+int pcache_read(struct pcache_mapping* m, uint64_t offset, void* buf, uint32_t len);
+void pcache_invalidate(struct pcache_mapping* m);
+uint64_t pcache_shrink(uint64_t nr_pages);
+void pcache_get_stats(struct pcache_stats* stats);
@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <cpu.h>
+#include <irq.h>
+#include <timer.h>
+#include <prof.h>
+#include <drivers/uart.h>
+#include <drivers/kprintf.h>
+
+// ppis on qemu virt: pmu overflow, and the el1 physical timer as fallback
+#define PROF_PMU_IRQ   23
+#define PROF_TIMER_IRQ 30
+
+#define PMCR_E  (1 << 0)
+#define PMCR_C  (1 << 2)
+#define PMCR_LC (1 << 6)
+#define PMU_CYCLE_BIT (1U << 31)
+
+// while stopped the source keeps ticking, just rarely
+#define PROF_IDLE_HZ 1
+
+// generated from kernel.elf by tools/gensyms.py, see the Makefile
+extern const uint64_t ksym_count;
+extern const uint64_t ksym_addrs[];
+extern const uint32_t ksym_offsets[];
+extern const char ksym_names[];
+
+struct prof_buffer {
+    struct prof_sample samples[PROF_SAMPLES];
+    uint32_t count;
+    uint64_t lost;
+} __attribute__((aligned(64)));
+
+static struct prof_buffer buffers[MAX_CPUS];
+static volatile bool running = false;
+static bool uses_pmu = false;
+static uint64_t source_hz = 0;
+static uint64_t sample_period = 0;
+static uint64_t idle_period = 0;
+
+static bool pmu_present(void) {
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    uint64_t ver = (dfr0 >> 8) & 0xF;
+    return ver != 0 && ver != 0xF;
+}
+
+static inline uint64_t read_cycles(void) {
+    uint64_t val;
+    __asm__ volatile("isb\nmrs %0, pmccntr_el0" : "=r"(val));
+    return val;
+}
+
+// the cycle counter has no architected rate, measure it against cntvct
+static uint64_t calibrate_cycles(void) {
+    uint64_t window = timer_freq() / 100;
+    uint64_t c0 = read_cycles();
+    uint64_t t0 = timer_counter();
+    while (timer_counter() - t0 < window) {
+        cpu_relax();
+    }
+    uint64_t cycles = read_cycles() - c0;
+    return cycles * 100;
+}
+
+static void rearm(void) {
+    uint64_t period = running ? sample_period : idle_period;
+    if (uses_pmu) {
+        // the counter overflows after period cycles
+        __asm__ volatile("msr pmccntr_el0, %0" :: "r"(0 - period));
+        __asm__ volatile("msr pmovsclr_el0, %0" :: "r"((uint64_t)PMU_CYCLE_BIT));
+    } else {
+        __asm__ volatile("msr cntp_tval_el0, %0" :: "r"(period));
+        __asm__ volatile("msr cntp_ctl_el0, %0" :: "r"((uint64_t)1));
+    }
+    __asm__ volatile("isb");
+}
+
+static void record(struct irq_frame* frame) {
+    uint32_t cpu = smp_processor_id();
+    struct prof_buffer* buf = &buffers[cpu];
+    if (buf->count >= PROF_SAMPLES) {
+        buf->lost++;
+        return;
+    }
+    
+    struct prof_sample* s = &buf->samples[buf->count];
+    s->pc = frame->elr;
+    s->cpu = cpu;
+    s->depth = 0;
+    
+    // aapcs64 frame records: [fp] = caller's fp, [fp + 8] = return address
+    uint64_t fp = frame->fp;
+    while (s->depth < PROF_MAX_DEPTH && fp && !(fp & 7)) {
+        uint64_t next = ((uint64_t*)fp)[0];
+        uint64_t lr = ((uint64_t*)fp)[1];
+        if (!lr) break;
+        s->stack[s->depth++] = lr;
+        if (next <= fp || next - fp > 0x10000) break;
+        fp = next;
+    }
+    buf->count++;
+}
+
+static void prof_irq(uint32_t irq, void* data) {
+    (void)irq;
+    (void)data;
+    
+    struct irq_frame* frame = irq_get_frame();
+    if (running && frame) {
+        record(frame);
+    }
+    rearm();
+}
+
+void prof_init_cpu(void) {
+    if (uses_pmu) {
+        uint64_t pmcr;
+        __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+        pmcr |= PMCR_E | PMCR_C | PMCR_LC;
+        __asm__ volatile("msr pmcr_el0, %0" :: "r"(pmcr));
+        __asm__ volatile("msr pmcntenset_el0, %0" :: "r"((uint64_t)PMU_CYCLE_BIT));
+        __asm__ volatile("msr pmintenset_el1, %0" :: "r"((uint64_t)PMU_CYCLE_BIT));
+        irq_enable(PROF_PMU_IRQ);
+    } else {
+        irq_enable(PROF_TIMER_IRQ);
+    }
+    rearm();
+}
+
+void prof_init(void) {
+    uses_pmu = pmu_present();
+    if (uses_pmu) {
+        uint64_t pmcr;
+        __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+        __asm__ volatile("msr pmcr_el0, %0" :: "r"(pmcr | PMCR_E | PMCR_LC));
+        __asm__ volatile("msr pmcntenset_el0, %0" :: "r"((uint64_t)PMU_CYCLE_BIT));
+        source_hz = calibrate_cycles();
+        uses_pmu = source_hz != 0;
+    }
+    if (!uses_pmu) {
+        source_hz = timer_freq();
+    }
+    
+    idle_period = source_hz / PROF_IDLE_HZ;
+    sample_period = idle_period;
+    irq_register(uses_pmu ? PROF_PMU_IRQ : PROF_TIMER_IRQ, prof_irq, NULL);
+    prof_init_cpu();
+}
+
+// other cpus pick the new rate up at their next idle overflow
+void prof_start(uint32_t hz) {
+    if (hz == 0) return;
+    sample_period = source_hz / hz;
+    if (sample_period == 0) sample_period = 1;
+    running = true;
+    
+    uint64_t flags = local_irq_save();
+    rearm();
+    local_irq_restore(flags);
+}
+
+void prof_stop(void) {
+    running = false;
+}
+
+void prof_reset(void) {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        buffers[cpu].count = 0;
+        buffers[cpu].lost = 0;
+    }
+}
+
+void prof_get_stats(struct prof_stats* stats) {
+    stats->samples = 0;
+    stats->lost = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->samples += buffers[cpu].count;
+        stats->lost += buffers[cpu].lost;
+    }
+    stats->period = sample_period;
+    stats->uses_pmu = uses_pmu;
+}
+
+const char* ksym_lookup(uint64_t addr, uint64_t* offset) {
+    if (ksym_count == 0 || addr < ksym_addrs[0]) return NULL;
+    
+    uint64_t lo = 0;
+    uint64_t hi = ksym_count - 1;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi + 1) / 2;
+        if (ksym_addrs[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (offset) *offset = addr - ksym_addrs[lo];
+    return &ksym_names[ksym_offsets[lo]];
+}
+
+static void put_frame(uint64_t addr) {
+    char tmp[24];
+    const char* name = ksym_lookup(addr, NULL);
+    if (name) {
+        uart_puts(name);
+    } else {
+        ksnprintf(tmp, sizeof(tmp), "0x%lx", addr);
+        uart_puts(tmp);
+    }
+}
+
+// one "outer;...;inner 1" line per sample, flamegraph.pl sums duplicates
+void prof_dump_folded(void) {
+    bool was_running = running;
+    running = false;
+    
+    uart_puts("#PROF-BEGIN\r\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct prof_buffer* buf = &buffers[cpu];
+        for (uint32_t i = 0; i < buf->count; i++) {
+            struct prof_sample* s = &buf->samples[i];
+            for (uint32_t d = s->depth; d > 0; d--) {
+                put_frame(s->stack[d - 1]);
+                uart_puts(";");
+            }
+            put_frame(s->pc);
+            uart_puts(" 1\r\n");
+        }
+    }
+    uart_puts("#PROF-END\r\n");
+    
+    running = was_running;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PROF_MAX_DEPTH 16
+#define PROF_SAMPLES   512
+
+struct prof_sample {
+    uint64_t pc;
+    uint32_t cpu;
+    uint32_t depth;
+    uint64_t stack[PROF_MAX_DEPTH];
+};
+
+struct prof_stats {
+    uint64_t samples;
+    uint64_t lost;
+    uint64_t period;
+    int uses_pmu;
+};
+
+void prof_init(void);
+void prof_init_cpu(void);
+void prof_start(uint32_t hz);
+void prof_stop(void);
+void prof_reset(void);
+void prof_get_stats(struct prof_stats* stats);
+void prof_dump_folded(void);
+const char* ksym_lookup(uint64_t addr, uint64_t* offset);
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <async.h>
+#include <workqueue.h>
+#include <../spinlock.h>
+
+static struct async_task* ready_head = NULL;
+static struct async_task* ready_tail = NULL;
+static struct async_task* sleep_head = NULL;
+static spinlock_t async_lock = SPINLOCK_INIT;
+
+// one work item runs ready coroutines, the other fires for the next sleeper
+static struct work run_work;
+static struct work timer_work;
+static uint64_t timer_expires = 0;
+
+static void make_ready(struct async_task* t) {
+    t->state = ASYNC_READY;
+    t->next = NULL;
+    if (ready_tail) {
+        ready_tail->next = t;
+    } else {
+        ready_head = t;
+    }
+    ready_tail = t;
+}
+
+static void wake_sleepers(uint64_t now) {
+    struct async_task** link = &sleep_head;
+    while (*link) {
+        struct async_task* t = *link;
+        if (t->wake_at <= now) {
+            *link = t->next;
+            make_ready(t);
+        } else {
+            link = &t->next;
+        }
+    }
+}
+
+static void arm_timer(uint64_t now) {
+    if (!sleep_head) return;
+    
+    uint64_t earliest = sleep_head->wake_at;
+    for (struct async_task* t = sleep_head->next; t; t = t->next) {
+        if (t->wake_at < earliest) earliest = t->wake_at;
+    }
+    
+    if (timer_work.pending) {
+        if (timer_expires <= earliest) return;
+        cancel_work(&timer_work);
+    }
+    
+    timer_expires = earliest;
+    queue_delayed_work(&timer_work, earliest > now ? earliest - now : 1);
+}
+
+static void async_run(struct work* work) {
+    (void)work;
+    
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&async_lock);
+        wake_sleepers(get_tick_count());
+        struct async_task* t = ready_head;
+        if (t) {
+            ready_head = t->next;
+            if (!ready_head) ready_tail = NULL;
+            t->next = NULL;
+            t->state = ASYNC_RUNNING;
+        } else {
+            arm_timer(get_tick_count());
+        }
+        spin_unlock_irqrestore(&async_lock, flags);
+        
+        if (!t) break;
+        
+        int ret = t->fn(t);
+        
+        if (ret == ASYNC_EXIT) {
+            t->state = ASYNC_IDLE;
+            if (t->done) t->done(t);
+        } else if (ret == ASYNC_YIELDED) {
+            flags = spin_lock_irqsave(&async_lock);
+            make_ready(t);
+            spin_unlock_irqrestore(&async_lock, flags);
+        }
+    }
+}
+
+void async_init(void) {
+    ready_head = NULL;
+    ready_tail = NULL;
+    sleep_head = NULL;
+    timer_expires = 0;
+    init_work(&run_work, async_run, NULL);
+    init_work(&timer_work, async_run, NULL);
+}
+
+int async_start(struct async_task* t, async_fn fn, void* data, void (*done)(struct async_task* t)) {
+    if (!t || !fn) return -1;
+    if (t->state != ASYNC_IDLE) return -1;
+    
+    t->fn = fn;
+    t->data = data;
+    t->done = done;
+    t->resume = 0;
+    t->result = 0;
+    t->wake_at = 0;
+    
+    uint64_t flags = spin_lock_irqsave(&async_lock);
+    make_ready(t);
+    spin_unlock_irqrestore(&async_lock, flags);
+    
+    queue_work(&run_work);
+    return 0;
+}
+
+void async_sleep_until(struct async_task* t, uint64_t tick) {
+    uint64_t flags = spin_lock_irqsave(&async_lock);
+    t->wake_at = tick;
+    t->state = ASYNC_SLEEPING;
+    t->next = sleep_head;
+    sleep_head = t;
+    spin_unlock_irqrestore(&async_lock, flags);
+}
+
+bool async_wait(struct async_task* t, struct async_event* ev) {
+    uint64_t flags = spin_lock_irqsave(&async_lock);
+    // the event fired before we got here, consume it and keep going
+    if (ev->signalled) {
+        ev->signalled = 0;
+        spin_unlock_irqrestore(&async_lock, flags);
+        return false;
+    }
+    
+    t->state = ASYNC_WAITING;
+    t->next = ev->waiters;
+    ev->waiters = t;
+    spin_unlock_irqrestore(&async_lock, flags);
+    return true;
+}
+
+void async_event_init(struct async_event* ev) {
+    ev->waiters = NULL;
+    ev->signalled = 0;
+}
+
+void async_event_signal(struct async_event* ev) {
+    uint64_t flags = spin_lock_irqsave(&async_lock);
+    struct async_task* t = ev->waiters;
+    ev->waiters = NULL;
+    
+    if (!t) {
+        ev->signalled = 1;
+    }
+    while (t) {
+        struct async_task* next = t->next;
+        make_ready(t);
+        t = next;
+    }
+    spin_unlock_irqrestore(&async_lock, flags);
+    
+    queue_work(&run_work);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <sched.h>
+
+// stackless coroutines for driver state machines. a coroutine is a plain
+// function re-entered from the top on every resume, so anything that has
+// to survive a suspension point must live in t->data, not in locals.
+
+#define ASYNC_EXIT      0
+#define ASYNC_YIELDED   1
+#define ASYNC_SUSPENDED 2
+
+#define ASYNC_IDLE     0
+#define ASYNC_READY    1
+#define ASYNC_SLEEPING 2
+#define ASYNC_WAITING  3
+#define ASYNC_RUNNING  4
+
+struct async_task;
+typedef int (*async_fn)(struct async_task* t);
+
+struct async_event {
+    struct async_task* waiters;
+    volatile uint32_t signalled;
+};
+
+struct async_task {
+    async_fn fn;
+    void* data;
+    void (*done)(struct async_task* t);
+    uint64_t wake_at;
+    uint32_t resume;
+    uint32_t state;
+    int result;
+    struct async_task* next;
+};
+
+#define ASYNC_BEGIN(t) switch ((t)->resume) { case 0:
+
+#define ASYNC_END(t) } (t)->resume = 0; return ASYNC_EXIT
+
+#define ASYNC_RETURN(t, val) do { \
+    (t)->result = (val); \
+    (t)->resume = 0; \
+    return ASYNC_EXIT; \
+} while (0)
+
+#define ASYNC_YIELD(t) do { \
+    (t)->resume = __LINE__; \
+    return ASYNC_YIELDED; \
+    case __LINE__:; \
+} while (0)
+
+// resume is always stored before the task is published on a sleep or wait
+// list, another worker may pick it up and re-enter it straight away
+#define ASYNC_SLEEP(t, ms) do { \
+    (t)->resume = __LINE__; \
+    async_sleep_until((t), get_tick_count() + (ms)); \
+    return ASYNC_SUSPENDED; \
+    case __LINE__:; \
+} while (0)
+
+// re-test cond every poll_ms, for devices that have no completion irq
+#define ASYNC_AWAIT(t, cond, poll_ms) do { \
+    (t)->resume = __LINE__; \
+    __attribute__((fallthrough)); \
+    case __LINE__:; \
+    if (!(cond)) { \
+        async_sleep_until((t), get_tick_count() + (poll_ms)); \
+        return ASYNC_SUSPENDED; \
+    } \
+} while (0)
+
+#define ASYNC_WAIT_EVENT(t, ev) do { \
+    (t)->resume = __LINE__; \
+    if (async_wait((t), (ev))) return ASYNC_SUSPENDED; \
+    case __LINE__:; \
+} while (0)
+
+void async_init(void);
+int async_start(struct async_task* t, async_fn fn, void* data, void (*done)(struct async_task* t));
+void async_sleep_until(struct async_task* t, uint64_t tick);
+bool async_wait(struct async_task* t, struct async_event* ev);
+void async_event_init(struct async_event* ev);
+void async_event_signal(struct async_event* ev);
@@ -1,16 +1,49 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <../vm_pages.h>
 #include <sched.h>
+#include <softirq.h>
+#include <../cpu.h>
+#include <../spinlock.h>
+#include <../trace.h>
+#include <../irq.h>
+#include <../timer.h>
 
 #define MAX_TASKS 64
 #define STACK_SIZE 8192
+#define STACK_PAGES (STACK_SIZE / PAGE_SIZE)
 #define TIME_SLICE_MS 10
 #define IDLE_TASK_PRIORITY 0
 
+// deadline bandwidth is tracked as runtime/period in 12.20 fixed point
+#define DL_BW_SHIFT 20
+#define DL_BW_LIMIT ((95ULL << DL_BW_SHIFT) / 100)
+
+// load balancing, all in ticks
+#define BALANCE_INTERVAL     64
+#define BALANCE_IMBALANCE_PCT 125
+#define BALANCE_MAX_PULL     8
+#define MIGRATION_COST_TICKS 5
+#define BALANCE_HOT_RETRIES  4
+#define LOAD_SHIFT           10
+
+// 1 balances on priority-weighted load, 0 on plain run-queue length
+#define BALANCE_WEIGHTED 1
+
+#define BENCH_MAX_TASKS 32
+#define BENCH_PRIORITY  1
+
+// 20% of a cpu per deadline task, four of them stay under DL_BW_LIMIT
+#define DL_BENCH_MAX_TASKS 4
+#define DL_BENCH_RUNTIME   2
+#define DL_BENCH_PERIOD    10
+#define DL_BENCH_WORK_NS   1000000
+
 struct task_context {
     uint64_t x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30;
     uint64_t sp;
+    uint64_t d8, d9, d10, d11, d12, d13, d14, d15;
 };
 
 struct task {
@@ -20,20 +53,77 @@ struct task {
     uint32_t time_slice;
     uint64_t stack_base;
     uint64_t sleep_until;
+    uint32_t wake_pending;
+    uint32_t cpu;
+    uint64_t affinity;
+    uint64_t last_ran;
+    uint32_t migrations;
+    volatile uint32_t on_cpu;
+    uint32_t policy;
+    uint32_t dl_job_done;
+    uint64_t dl_runtime;
+    uint64_t dl_deadline;
+    uint64_t dl_period;
+    uint64_t dl_bw;
+    uint64_t dl_budget;
+    uint64_t dl_abs_deadline;
+    uint64_t dl_next_period;
+    uint32_t dl_jobs;
+    uint32_t dl_misses;
+    uint32_t dl_throttled;
     struct task_context ctx;
     struct task* next;
 };
 
+struct runqueue {
+    spinlock_t lock;
+    uint32_t cpu;
+    struct task* curr;
+    struct task* idle;
+    struct task* ready_head;
+    struct task* prev;
+    struct task* push_task;
+    uint32_t nr_ready;
+    uint64_t ready_load;
+    uint64_t avg_load;
+    uint64_t next_balance;
+    uint32_t balance_failed;
+    uint64_t busy_ticks;
+    uint64_t total_ticks;
+    uint64_t nr_switches;
+    uint64_t nr_pulled;
+    bool need_resched;
+};
+
 static struct task tasks[MAX_TASKS];
-static struct task* current_task = NULL;
-static struct task* ready_head = NULL;
-static struct task* idle_task = NULL;
+static struct runqueue runqueues[MAX_CPUS];
+static volatile uint64_t cpu_online_mask = 0;
+static spinlock_t task_lock = SPINLOCK_INIT;
 static uint32_t next_tid = 1;
 static uint64_t tick_count = 0;
+static uint64_t dl_total_bw = 0;
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;
 
 extern void context_switch(struct task_context* old_ctx, struct task_context* new_ctx);
-extern uint64_t get_timer_ticks(void);
+extern void task_trampoline(void);
 extern void kernel_panic(const char* msg);
+extern void kprintf(const char* format, ...);
+
+static inline struct runqueue* cpu_rq(uint32_t cpu) {
+    return &runqueues[cpu];
+}
+
+static inline struct runqueue* this_rq(void) {
+    return &runqueues[smp_processor_id()];
+}
+
+static inline bool cpu_allowed(struct task* task, uint32_t cpu) {
+    return (task->affinity & cpu_online_mask & (1ULL << cpu)) != 0;
+}
+
+static inline uint64_t task_weight(struct task* task) {
+    return task->priority + 1;
+}
 
 static void idle_loop(void) {
     while(1) {
@@ -41,31 +131,285 @@ static void idle_loop(void) {
     }
 }
 
-static void enqueue_task(struct task* task) {
-    if (!ready_head) {
-        ready_head = task;
+// rq->lock must be held for all run queue list operations
+static void enqueue_task(struct runqueue* rq, struct task* task) {
+    task->cpu = rq->cpu;
+    if (!rq->ready_head) {
+        rq->ready_head = task;
         task->next = task;
     } else {
-        task->next = ready_head->next;
-        ready_head->next = task;
+        task->next = rq->ready_head->next;
+        rq->ready_head->next = task;
     }
+    rq->nr_ready++;
+    rq->ready_load += task_weight(task);
 }
 
-static struct task* dequeue_task(void) {
-    if (!ready_head) return NULL;
+static void remove_ready(struct runqueue* rq, struct task* task) {
+    if (!rq->ready_head) return;
+    
+    struct task* prev = rq->ready_head;
+    while (prev->next != task) {
+        prev = prev->next;
+        if (prev == rq->ready_head) return;
+    }
     
-    struct task* task = ready_head->next;
-    if (task == ready_head) {
-        ready_head = NULL;
+    if (prev == task) {
+        rq->ready_head = NULL;
     } else {
-        ready_head->next = task->next;
+        prev->next = task->next;
+        if (rq->ready_head == task) {
+            rq->ready_head = prev->next;
+        }
     }
     task->next = NULL;
-    return task;
+    rq->nr_ready--;
+    rq->ready_load -= task_weight(task);
 }
 
-static struct task* alloc_task(void) {
+static uint64_t rq_load(struct runqueue* rq) {
+#if BALANCE_WEIGHTED
+    uint64_t load = rq->ready_load;
+    if (rq->curr != rq->idle) load += task_weight(rq->curr);
+#else
+    uint64_t load = rq->nr_ready;
+    if (rq->curr != rq->idle) load++;
+#endif
+    return load;
+}
+
+static struct task* find_task(uint32_t tid) {
     for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].state != TASK_DEAD && tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    return NULL;
+}
+
+// least loaded allowed cpu, staying put on a tie since the cache is warm there
+static uint32_t select_task_cpu(struct task* task) {
+    uint32_t best = task->cpu;
+    uint64_t best_load = ~0ULL;
+    
+    if (cpu_allowed(task, best)) {
+        best_load = cpu_rq(best)->avg_load;
+    }
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpu_allowed(task, cpu)) continue;
+        uint64_t load = cpu_rq(cpu)->avg_load;
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    
+    if (best_load == ~0ULL) return 0;
+    return best;
+}
+
+// put a runnable task that is on no list onto a run queue. no rq lock held
+static void activate_task(struct task* task) {
+    uint32_t cpu = task->cpu;
+    if (!cpu_allowed(task, cpu)) {
+        cpu = select_task_cpu(task);
+    }
+    
+    struct runqueue* rq = cpu_rq(cpu);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    enqueue_task(rq, task);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// requeue the task that was running on rq, rq->lock held
+static void put_prev_task(struct runqueue* rq, struct task* task) {
+    task->state = TASK_READY;
+    if (cpu_allowed(task, rq->cpu)) {
+        enqueue_task(rq, task);
+    } else {
+        // affinity moved it away, push it once we are off its stack
+        rq->push_task = task;
+    }
+}
+
+static bool should_preempt(struct runqueue* rq, struct task* task) {
+    struct task* curr = rq->curr;
+    if (curr == rq->idle) return true;
+    if (task->policy != SCHED_DEADLINE) return false;
+    if (curr->policy != SCHED_DEADLINE) return true;
+    return task->dl_abs_deadline < curr->dl_abs_deadline;
+}
+
+static bool dl_params_valid(uint64_t runtime, uint64_t deadline, uint64_t period) {
+    if (runtime == 0 || period == 0) return false;
+    if (runtime > deadline || deadline > period) return false;
+    return true;
+}
+
+static uint64_t dl_bandwidth(uint64_t runtime, uint64_t period) {
+    return (runtime << DL_BW_SHIFT) / period;
+}
+
+// admission is global, trade old_bw for new_bw if the total stays in bounds.
+// dl_bw_lock nests inside rq->lock
+static bool dl_bw_update(uint64_t old_bw, uint64_t new_bw) {
+    uint64_t flags = spin_lock_irqsave(&dl_bw_lock);
+    bool ok = dl_total_bw - old_bw + new_bw <= DL_BW_LIMIT;
+    if (ok) dl_total_bw = dl_total_bw - old_bw + new_bw;
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+    return ok;
+}
+
+static void dl_start_job(struct task* task) {
+    // keep releases on the period grid unless we fell a whole period behind
+    if (task->dl_next_period == 0 || tick_count >= task->dl_next_period + task->dl_period) {
+        task->dl_next_period = tick_count;
+    }
+    task->dl_abs_deadline = task->dl_next_period + task->dl_deadline;
+    task->dl_next_period += task->dl_period;
+    task->dl_budget = task->dl_runtime;
+    task->dl_job_done = 0;
+    task->dl_jobs++;
+}
+
+static void dl_job_complete(struct task* task) {
+    if (tick_count > task->dl_abs_deadline) {
+        task->dl_misses++;
+    }
+    task->dl_job_done = 1;
+    task->state = TASK_THROTTLED;
+}
+
+// wake sleepers and replenish deadline tasks that belong to this cpu.
+// returns true if one of them should preempt the running task
+static bool wake_due_tasks(struct runqueue* rq) {
+    struct task* remote[MAX_TASKS];
+    int nr_remote = 0;
+    bool preempt = false;
+    
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    for (int i = 0; i < MAX_TASKS; i++) {
+        struct task* task = &tasks[i];
+        if (task->cpu != rq->cpu) continue;
+        
+        if (task->state == TASK_SLEEPING && task->sleep_until <= tick_count) {
+            if (task->policy == SCHED_DEADLINE && tick_count >= task->dl_next_period) {
+                dl_start_job(task);
+            }
+        } else if (task->state == TASK_THROTTLED && task->dl_next_period <= tick_count) {
+            // a job still holding the cpu at its next release ran past its deadline
+            if (!task->dl_job_done) {
+                task->dl_misses++;
+            }
+            dl_start_job(task);
+        } else {
+            continue;
+        }
+        
+        task->state = TASK_READY;
+        if (cpu_allowed(task, rq->cpu)) {
+            enqueue_task(rq, task);
+            if (should_preempt(rq, task)) preempt = true;
+        } else {
+            remote[nr_remote++] = task;
+        }
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    for (int i = 0; i < nr_remote; i++) {
+        activate_task(remote[i]);
+    }
+    return preempt;
+}
+
+static void double_lock(struct runqueue* a, struct runqueue* b) {
+    if (a->cpu < b->cpu) {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    } else {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
+}
+
+static bool can_migrate(struct runqueue* src, struct task* task, uint32_t dst_cpu) {
+    if (task == src->curr || task->on_cpu) return false;
+    if (!cpu_allowed(task, dst_cpu)) return false;
+    // deadline tasks are partitioned, they stay where they were placed
+    if (task->policy == SCHED_DEADLINE) return false;
+    
+    // cache-hot tasks stay unless balancing keeps failing without them
+    if (tick_count - task->last_ran < MIGRATION_COST_TICKS &&
+        src->balance_failed < BALANCE_HOT_RETRIES) {
+        return false;
+    }
+    return true;
+}
+
+// pull work from the busiest cpu towards this one
+static void load_balance(struct runqueue* rq) {
+    struct runqueue* busiest = NULL;
+    uint64_t busiest_load = 0;
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu == rq->cpu || !(cpu_online_mask & (1ULL << cpu))) continue;
+        struct runqueue* other = cpu_rq(cpu);
+        if (other->nr_ready == 0) continue;
+        if (other->avg_load > busiest_load) {
+            busiest = other;
+            busiest_load = other->avg_load;
+        }
+    }
+    
+    if (!busiest) return;
+    if (busiest_load * 100 <= rq->avg_load * BALANCE_IMBALANCE_PCT) return;
+    
+    uint64_t to_move = ((busiest_load - rq->avg_load) / 2) >> LOAD_SHIFT;
+    if (to_move == 0) to_move = 1;
+    
+    uint64_t flags = local_irq_save();
+    double_lock(rq, busiest);
+    
+    struct task* pull[BALANCE_MAX_PULL];
+    int nr_pull = 0;
+    uint64_t moved = 0;
+    
+    if (busiest->ready_head) {
+        struct task* curr = busiest->ready_head;
+        do {
+            if (can_migrate(busiest, curr, rq->cpu)) {
+                pull[nr_pull++] = curr;
+#if BALANCE_WEIGHTED
+                moved += task_weight(curr);
+#else
+                moved++;
+#endif
+            }
+            curr = curr->next;
+        } while (curr != busiest->ready_head && nr_pull < BALANCE_MAX_PULL && moved < to_move);
+    }
+    
+    for (int i = 0; i < nr_pull; i++) {
+        remove_ready(busiest, pull[i]);
+        enqueue_task(rq, pull[i]);
+        pull[i]->migrations++;
+    }
+    
+    if (nr_pull == 0) {
+        busiest->balance_failed++;
+    } else {
+        busiest->balance_failed = 0;
+        rq->nr_pulled += nr_pull;
+    }
+    
+    spin_unlock(&busiest->lock);
+    spin_unlock(&rq->lock);
+    local_irq_restore(flags);
+}
+
+static struct task* alloc_task(void) {
+    for (int i = MAX_CPUS; i < MAX_TASKS; i++) {
         if (tasks[i].state == TASK_DEAD) {
             return &tasks[i];
         }
@@ -73,154 +417,732 @@ static struct task* alloc_task(void) {
     return NULL;
 }
 
+static void init_runqueue(uint32_t cpu) {
+    struct runqueue* rq = cpu_rq(cpu);
+    struct task* idle = &tasks[cpu];
+    
+    idle->tid = 0;
+    idle->state = TASK_READY;
+    idle->priority = IDLE_TASK_PRIORITY;
+    idle->time_slice = 1;
+    idle->cpu = cpu;
+    idle->affinity = 1ULL << cpu;
+    idle->on_cpu = 1;
+    idle->stack_base = alloc_pages(STACK_PAGES);
+    if (!idle->stack_base) {
+        kernel_panic("failed to alloc idle stack");
+    }
+    
+    // the boot context becomes the idle task the first time it switches out
+    idle->ctx.sp = idle->stack_base + STACK_SIZE - 16;
+    idle->ctx.x30 = (uint64_t)idle_loop;
+    
+    rq->lock.locked = 0;
+    rq->cpu = cpu;
+    rq->idle = idle;
+    rq->curr = idle;
+    rq->ready_head = NULL;
+    rq->prev = NULL;
+    rq->push_task = NULL;
+    rq->nr_ready = 0;
+    rq->ready_load = 0;
+    rq->avg_load = 0;
+    rq->next_balance = tick_count + BALANCE_INTERVAL;
+    rq->balance_failed = 0;
+    rq->busy_ticks = 0;
+    rq->total_ticks = 0;
+    rq->nr_switches = 0;
+    rq->nr_pulled = 0;
+    rq->need_resched = false;
+}
+
 void sched_init(void) {
     for (int i = 0; i < MAX_TASKS; i++) {
         tasks[i].state = TASK_DEAD;
         tasks[i].tid = 0;
+        tasks[i].cpu = 0;
         tasks[i].next = NULL;
     }
     
-    idle_task = &tasks[0];
-    idle_task->tid = 0;
-    idle_task->state = TASK_READY;
-    idle_task->priority = IDLE_TASK_PRIORITY;
-    idle_task->time_slice = 1;
-    idle_task->stack_base = alloc_page();
-    if (!idle_task->stack_base) {
-        kernel_panic("failed to alloc idle stack");
-    }
+    tick_count = 0;
+    cpu_online_mask = 0;
     
-    idle_task->ctx.sp = idle_task->stack_base + STACK_SIZE - 16;
-    idle_task->ctx.x30 = (uint64_t)idle_loop;
+    init_runqueue(smp_processor_id());
+    __atomic_fetch_or(&cpu_online_mask, 1ULL << smp_processor_id(), __ATOMIC_RELEASE);
+}
+
+void sched_init_cpu(void) {
+    uint32_t cpu = smp_processor_id();
+    init_runqueue(cpu);
+    __atomic_fetch_or(&cpu_online_mask, 1ULL << cpu, __ATOMIC_RELEASE);
+}
+
+// runs on the new task's stack right after every switch
+void schedule_tail(void) {
+    struct runqueue* rq = this_rq();
     
-    current_task = idle_task;
-    tick_count = 0;
+    if (rq->prev) {
+        struct task* prev = rq->prev;
+        rq->prev = NULL;
+        
+        if (prev->state == TASK_ZOMBIE) {
+            free_pages(prev->stack_base, STACK_PAGES);
+            __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+            prev->state = TASK_DEAD;
+        } else {
+            __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+        }
+    }
+    
+    if (rq->push_task) {
+        struct task* task = rq->push_task;
+        rq->push_task = NULL;
+        activate_task(task);
+    }
 }
 
-uint32_t task_create(void (*entry)(void), uint32_t priority) {
+// a ready task that is on no run queue yet, NULL when out of tasks or memory
+static struct task* new_task(void (*entry)(void), uint32_t priority) {
+    uint64_t flags = spin_lock_irqsave(&task_lock);
     struct task* task = alloc_task();
-    if (!task) return 0;
-    
+    if (!task) {
+        spin_unlock_irqrestore(&task_lock, flags);
+        return NULL;
+    }
     task->tid = next_tid++;
     task->state = TASK_READY;
+    spin_unlock_irqrestore(&task_lock, flags);
+    
     task->priority = priority;
     task->time_slice = priority + 1;
     task->sleep_until = 0;
-    task->stack_base = alloc_page();
+    task->wake_pending = 0;
+    task->cpu = smp_processor_id();
+    task->affinity = ~0ULL;
+    task->last_ran = 0;
+    task->migrations = 0;
+    task->on_cpu = 0;
+    task->policy = SCHED_NORMAL;
+    task->dl_bw = 0;
+    task->dl_next_period = 0;
+    task->dl_jobs = 0;
+    task->dl_misses = 0;
+    task->dl_throttled = 0;
+    task->stack_base = alloc_pages(STACK_PAGES);
     
     if (!task->stack_base) {
         task->state = TASK_DEAD;
-        return 0;
+        return NULL;
     }
     
     task->ctx.sp = task->stack_base + STACK_SIZE - 16;
-    task->ctx.x30 = (uint64_t)entry;
+    task->ctx.x19 = (uint64_t)entry;
+    task->ctx.x30 = (uint64_t)task_trampoline;
+    return task;
+}
+
+uint32_t task_create(void (*entry)(void), uint32_t priority) {
+    struct task* task = new_task(entry, priority);
+    if (!task) return 0;
     
-    enqueue_task(task);
+    task->cpu = select_task_cpu(task);
+    activate_task(task);
     return task->tid;
 }
 
+// admitted before it is ever queued, so a failed admission leaves nothing
+// running in the normal class
+uint32_t task_create_deadline(void (*entry)(void), uint64_t runtime, uint64_t deadline, uint64_t period) {
+    if (!dl_params_valid(runtime, deadline, period)) return 0;
+    
+    uint64_t bw = dl_bandwidth(runtime, period);
+    if (!dl_bw_update(0, bw)) return 0;
+    
+    struct task* task = new_task(entry, 0);
+    if (!task) {
+        dl_bw_update(bw, 0);
+        return 0;
+    }
+    
+    task->dl_bw = bw;
+    task->dl_runtime = runtime;
+    task->dl_deadline = deadline;
+    task->dl_period = period;
+    task->policy = SCHED_DEADLINE;
+    dl_start_job(task);
+    
+    task->cpu = select_task_cpu(task);
+    activate_task(task);
+    return task->tid;
+}
+
+int task_set_deadline(uint32_t tid, uint64_t runtime, uint64_t deadline, uint64_t period) {
+    struct task* task = find_task(tid);
+    if (!task || task->tid == 0) return -1;
+    
+    struct runqueue* rq = cpu_rq(task->cpu);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    
+    // runtime of zero drops the task back to the normal class
+    if (runtime == 0) {
+        if (task->policy == SCHED_DEADLINE) {
+            dl_bw_update(task->dl_bw, 0);
+            task->dl_bw = 0;
+            task->policy = SCHED_NORMAL;
+            if (task->state == TASK_THROTTLED) {
+                task->state = TASK_READY;
+                enqueue_task(rq, task);
+            }
+        }
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return 0;
+    }
+    
+    if (!dl_params_valid(runtime, deadline, period)) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return -1;
+    }
+    
+    uint64_t bw = dl_bandwidth(runtime, period);
+    if (!dl_bw_update(task->dl_bw, bw)) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return -1;
+    }
+    
+    task->dl_bw = bw;
+    task->dl_runtime = runtime;
+    task->dl_deadline = deadline;
+    task->dl_period = period;
+    task->dl_next_period = 0;
+    task->policy = SCHED_DEADLINE;
+    dl_start_job(task);
+    
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return 0;
+}
+
+int task_get_dl_stats(uint32_t tid, struct sched_dl_stats* stats) {
+    struct task* task = find_task(tid);
+    if (!task || !stats || task->policy != SCHED_DEADLINE) return -1;
+    
+    stats->runtime = task->dl_runtime;
+    stats->deadline = task->dl_deadline;
+    stats->period = task->dl_period;
+    stats->abs_deadline = task->dl_abs_deadline;
+    stats->jobs = task->dl_jobs;
+    stats->misses = task->dl_misses;
+    stats->throttled = task->dl_throttled;
+    return 0;
+}
+
+int task_set_affinity(uint32_t tid, uint64_t mask) {
+    struct task* task = find_task(tid);
+    if (!task || task->tid == 0) return -1;
+    if (!(mask & cpu_online_mask)) return -1;
+    
+    struct runqueue* rq = cpu_rq(task->cpu);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    task->affinity = mask;
+    
+    if (cpu_allowed(task, rq->cpu)) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return 0;
+    }
+    
+    // sitting on a run queue it may no longer use, move it now.
+    // running or sleeping tasks move the next time they are queued
+    bool move = task->state == TASK_READY && task != rq->curr && !task->on_cpu;
+    if (move) {
+        remove_ready(rq, task);
+        task->migrations++;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    if (move) {
+        activate_task(task);
+    } else if (task == this_rq()->curr) {
+        task_yield();
+    }
+    return 0;
+}
+
+uint64_t task_get_affinity(uint32_t tid) {
+    struct task* task = find_task(tid);
+    return task ? task->affinity : 0;
+}
+
+// these pick the rq only once interrupts are off, before that a tick can
+// preempt the task and the balancer can move it to another cpu
 void task_exit(void) {
-    if (current_task == idle_task) return;
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq = this_rq();
+    struct task* task = rq->curr;
+    if (task == rq->idle) {
+        local_irq_restore(flags);
+        return;
+    }
     
-    current_task->state = TASK_DEAD;
-    free_page(current_task->stack_base);
-    current_task = NULL;
+    if (task->policy == SCHED_DEADLINE) {
+        dl_bw_update(task->dl_bw, 0);
+        task->dl_bw = 0;
+        task->policy = SCHED_NORMAL;
+    }
     
+    // the stack is freed by whoever runs next, we are still on it
+    task->state = TASK_ZOMBIE;
     schedule();
 }
 
 void task_yield(void) {
-    if (current_task->state == TASK_RUNNING) {
-        current_task->state = TASK_READY;
-        enqueue_task(current_task);
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq = this_rq();
+    spin_lock(&rq->lock);
+    struct task* task = rq->curr;
+    
+    // a deadline task yielding has finished its job for this period
+    if (task->policy == SCHED_DEADLINE && task->state == TASK_RUNNING) {
+        dl_job_complete(task);
+    } else if (task->state == TASK_RUNNING) {
+        put_prev_task(rq, task);
     }
+    spin_unlock(&rq->lock);
     schedule();
+    local_irq_restore(flags);
 }
 
 void task_sleep(uint64_t ms) {
-    if (current_task == idle_task) return;
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq = this_rq();
+    if (rq->curr == rq->idle) {
+        local_irq_restore(flags);
+        return;
+    }
     
-    current_task->state = TASK_SLEEPING;
-    current_task->sleep_until = tick_count + ms;
+    spin_lock(&rq->lock);
+    rq->curr->sleep_until = tick_count + ms;
+    rq->curr->state = TASK_SLEEPING;
+    spin_unlock(&rq->lock);
     schedule();
+    local_irq_restore(flags);
 }
 
-void schedule(void) {
-    struct task* next = NULL;
+void task_block(void) {
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq = this_rq();
+    if (rq->curr == rq->idle) {
+        local_irq_restore(flags);
+        return;
+    }
     
+    spin_lock(&rq->lock);
+    // a wake that raced ahead of us cancels the block
+    if (rq->curr->wake_pending) {
+        rq->curr->wake_pending = 0;
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    rq->curr->state = TASK_BLOCKED;
+    spin_unlock(&rq->lock);
+    schedule();
+    local_irq_restore(flags);
+}
+
+int task_wake(uint32_t tid) {
+    struct task* task = find_task(tid);
+    if (!task) return -1;
     
-    tick_count = get_timer_ticks();
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_SLEEPING && 
-            tasks[i].sleep_until <= tick_count) {
-            tasks[i].state = TASK_READY;
-            enqueue_task(&tasks[i]);
+    struct runqueue* rq = cpu_rq(task->cpu);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    bool wake = task->state == TASK_BLOCKED;
+    TRACE(sched_wakeup, tid, task->state, task->cpu);
+    if (wake) {
+        task->state = TASK_READY;
+        if (cpu_allowed(task, rq->cpu)) {
+            enqueue_task(rq, task);
+            wake = false;
         }
+    } else {
+        task->wake_pending = 1;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    if (wake) {
+        activate_task(task);
+    }
+    return 0;
+}
+
+void schedule(void) {
+    struct runqueue* rq = this_rq();
+    struct task* next = NULL;
+    
+    if (rq->cpu == 0) {
+        tick_count = get_timer_ticks();
     }
+    wake_due_tasks(rq);
+    
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
     
+    // earliest deadline first among deadline tasks, which always beat
+    // the normal priority classes
     struct task* best = NULL;
+    struct task* best_dl = NULL;
     uint32_t best_priority = 0;
     
-    if (ready_head) {
-        struct task* curr = ready_head;
+    if (rq->ready_head) {
+        struct task* curr = rq->ready_head;
         do {
-            if (curr->priority > best_priority) {
+            if (curr->policy == SCHED_DEADLINE) {
+                if (!best_dl || curr->dl_abs_deadline < best_dl->dl_abs_deadline) {
+                    best_dl = curr;
+                }
+            } else if (curr->priority > best_priority) {
                 best = curr;
                 best_priority = curr->priority;
             }
             curr = curr->next;
-        } while (curr != ready_head);
+        } while (curr != rq->ready_head);
     }
     
-    next = best ? best : idle_task;
+    if (best_dl) {
+        next = best_dl;
+    } else {
+        next = best ? best : rq->idle;
+    }
     
-    if (next != current_task) {
-        struct task* prev = current_task;
-        current_task = next;
-        
-        if (next != idle_task) {
-            if (ready_head == next) {
-                if (next->next == next) {
-                    ready_head = NULL;
-                } else {
-                    struct task* curr = ready_head;
-                    while (curr->next != next) curr = curr->next;
-                    curr->next = next->next;
-                    ready_head = next->next;
-                }
-            } else {
-                struct task* curr = ready_head;
-                while (curr->next != next) curr = curr->next;
-                curr->next = next->next;
-            }
-            next->next = NULL;
-            next->state = TASK_RUNNING;
-        }
-        
-        context_switch(&prev->ctx, &next->ctx);
+    if (next != rq->idle) {
+        remove_ready(rq, next);
+        next->state = TASK_RUNNING;
+    }
+    
+    struct task* prev = rq->curr;
+    if (next == prev) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    
+    prev->last_ran = tick_count;
+    rq->curr = next;
+    rq->prev = prev;
+    rq->nr_switches++;
+    spin_unlock(&rq->lock);
+    
+    // next may still be saving its registers on the cpu it just left
+    while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
     }
+    next->on_cpu = 1;
+    TRACE(sched_switch, prev->tid, next->tid, prev->state);
+    
+    context_switch(&prev->ctx, &next->ctx);
+    schedule_tail();
+    local_irq_restore(flags);
 }
 
 void timer_tick(void) {
-    tick_count++;
-    
-    if (current_task != idle_task) {
-        current_task->time_slice--;
-        if (current_task->time_slice == 0) {
-            current_task->time_slice = current_task->priority + 1;
-            if (current_task->state == TASK_RUNNING) {
-                current_task->state = TASK_READY;
-                enqueue_task(current_task);
+    struct runqueue* rq = this_rq();
+    
+    if (rq->cpu == 0) {
+        tick_count = get_timer_ticks();
+        raise_softirq(SOFTIRQ_TIMER);
+    }
+    
+    bool preempt = wake_due_tasks(rq);
+    bool resched = false;
+    
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    struct task* curr = rq->curr;
+    
+    rq->total_ticks++;
+    if (curr != rq->idle) rq->busy_ticks++;
+    
+    // exponentially decayed load, 1/8 of the instantaneous value per tick
+    uint64_t inst = rq_load(rq) << LOAD_SHIFT;
+    rq->avg_load = rq->avg_load - (rq->avg_load >> 3) + (inst >> 3);
+    
+    if (curr != rq->idle && curr->policy == SCHED_DEADLINE) {
+        if (curr->dl_budget > 0) {
+            curr->dl_budget--;
+        }
+        // a task that just slept, blocked or finished its job is already on
+        // its way into schedule() and must keep that state
+        if (curr->state != TASK_RUNNING) {
+            resched = preempt;
+        } else if (curr->dl_budget == 0) {
+            // runtime used up, sit out until the next period
+            curr->dl_throttled++;
+            curr->state = TASK_THROTTLED;
+            resched = true;
+        } else if (preempt) {
+            put_prev_task(rq, curr);
+            resched = true;
+        }
+    } else if (preempt) {
+        if (curr != rq->idle && curr->state == TASK_RUNNING) {
+            put_prev_task(rq, curr);
+        }
+        resched = true;
+    } else if (curr != rq->idle) {
+        curr->time_slice--;
+        if (curr->time_slice == 0) {
+            curr->time_slice = curr->priority + 1;
+            if (curr->state == TASK_RUNNING) {
+                put_prev_task(rq, curr);
             }
-            schedule();
+            resched = true;
         }
     }
+    
+    bool balance = tick_count >= rq->next_balance;
+    if (balance) {
+        rq->next_balance = tick_count + BALANCE_INTERVAL;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    if (balance && (cpu_online_mask & ~(1ULL << rq->cpu))) {
+        load_balance(rq);
+        if (rq->curr == rq->idle && rq->nr_ready) resched = true;
+    }
+    
+    // from the timer irq the switch waits until the interrupt has been retired
+    if (resched && in_interrupt()) {
+        rq->need_resched = true;
+    } else if (resched) {
+        schedule();
+    }
+}
+
+void sched_irq_exit(void) {
+    struct runqueue* rq = this_rq();
+    if (rq->need_resched) {
+        rq->need_resched = false;
+        schedule();
+    }
 }
 
 uint32_t get_current_tid(void) {
-    return current_task ? current_task->tid : 0;
+    struct task* curr = this_rq()->curr;
+    return curr ? curr->tid : 0;
+}
+
+uint64_t get_tick_count(void) {
+    return tick_count;
+}
+
+uint64_t sched_online_cpus(void) {
+    return cpu_online_mask;
+}
+
+int sched_get_cpu_stats(uint32_t cpu, struct sched_cpu_stats* stats) {
+    if (cpu >= MAX_CPUS || !stats) return -1;
+    if (!(cpu_online_mask & (1ULL << cpu))) return -1;
+    
+    struct runqueue* rq = cpu_rq(cpu);
+    stats->nr_running = rq->nr_ready + (rq->curr != rq->idle ? 1 : 0);
+    stats->load = rq_load(rq);
+    stats->avg_load = rq->avg_load >> LOAD_SHIFT;
+    stats->busy_ticks = rq->busy_ticks;
+    stats->total_ticks = rq->total_ticks;
+    stats->nr_switches = rq->nr_switches;
+    stats->nr_pulled = rq->nr_pulled;
+    return 0;
+}
+
+// every worker starts pinned to one cpu and is let go at once, so spreading
+// them is left entirely to load_balance
+static volatile bool bench_stop;
+static volatile uint32_t bench_active;
+static uint32_t bench_next_slot;
+static volatile uint64_t bench_work[BENCH_MAX_TASKS];
+static uint32_t bench_waiter;
+
+static void bench_worker(void) {
+    uint32_t slot = __atomic_fetch_add(&bench_next_slot, 1, __ATOMIC_RELAXED);
+    while (!bench_stop) {
+        for (volatile uint32_t i = 0; i < 1000; i++) {}
+        bench_work[slot]++;
+    }
+    if (__atomic_sub_fetch(&bench_active, 1, __ATOMIC_ACQ_REL) == 0) {
+        task_wake(bench_waiter);
+    }
+}
+
+// bench workers per online cpu, the spread is even once max - min <= 1
+static bool bench_spread(struct task** workers, uint32_t n, uint32_t* min, uint32_t* max) {
+    uint32_t count[MAX_CPUS] = { 0 };
+    for (uint32_t i = 0; i < n; i++) {
+        count[workers[i]->cpu]++;
+    }
+    
+    *min = ~0U;
+    *max = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(cpu_online_mask & (1ULL << cpu))) continue;
+        if (count[cpu] < *min) *min = count[cpu];
+        if (count[cpu] > *max) *max = count[cpu];
+    }
+    return *max - *min <= 1;
+}
+
+int sched_bench_balance(uint32_t nr_tasks, uint32_t ms, struct sched_bench_result* result) {
+    if (!result || nr_tasks == 0) return -1;
+    if (nr_tasks > BENCH_MAX_TASKS) nr_tasks = BENCH_MAX_TASKS;
+    
+    bench_stop = false;
+    bench_next_slot = 0;
+    bench_waiter = get_current_tid();
+    for (uint32_t i = 0; i < BENCH_MAX_TASKS; i++) {
+        bench_work[i] = 0;
+    }
+    
+    uint64_t pulled_before = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        pulled_before += cpu_rq(cpu)->nr_pulled;
+    }
+    
+    struct task* workers[BENCH_MAX_TASKS];
+    uint32_t home = smp_processor_id();
+    uint32_t n = 0;
+    while (n < nr_tasks) {
+        struct task* task = new_task(bench_worker, BENCH_PRIORITY);
+        if (!task) break;
+        task->affinity = 1ULL << home;
+        task->cpu = home;
+        workers[n++] = task;
+    }
+    if (n == 0) return -1;
+    bench_active = n;
+    
+    uint64_t start = ktime_get_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        activate_task(workers[i]);
+        task_set_affinity(workers[i]->tid, ~0ULL);
+    }
+    
+    result->balanced = false;
+    result->spread_ms = 0;
+    for (uint32_t t = 0; t < ms; t++) {
+        task_sleep(1);
+        if (!result->balanced && bench_spread(workers, n, &result->min_per_cpu, &result->max_per_cpu)) {
+            result->balanced = true;
+            result->spread_ms = (ktime_get_ns() - start) / 1000000;
+        }
+    }
+    bench_spread(workers, n, &result->min_per_cpu, &result->max_per_cpu);
+    
+    result->migrations = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        result->migrations += workers[i]->migrations;
+    }
+    bench_stop = true;
+    while (__atomic_load_n(&bench_active, __ATOMIC_ACQUIRE)) {
+        task_block();
+    }
+    result->elapsed_ns = ktime_get_ns() - start;
+    
+    result->pulled = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        result->pulled += cpu_rq(cpu)->nr_pulled;
+    }
+    result->pulled -= pulled_before;
+    
+    result->min_work = ~0ULL;
+    result->max_work = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (bench_work[i] < result->min_work) result->min_work = bench_work[i];
+        if (bench_work[i] > result->max_work) result->max_work = bench_work[i];
+    }
+    result->nr_tasks = n;
+    result->nr_cpus = __builtin_popcountll(cpu_online_mask);
+    return 0;
+}
+
+// each job burns about half its runtime and yields, so misses and throttles
+// only come from the hogs or the other deadline tasks getting in the way
+static void bench_dl_worker(void) {
+    while (!bench_stop) {
+        uint64_t start = ktime_get_ns();
+        while (ktime_get_ns() - start < DL_BENCH_WORK_NS) {
+            cpu_relax();
+        }
+        task_yield();
+    }
+    if (__atomic_sub_fetch(&bench_active, 1, __ATOMIC_ACQ_REL) == 0) {
+        task_wake(bench_waiter);
+    }
+}
+
+int sched_bench_deadline(uint32_t nr_dl, uint32_t nr_hogs, uint32_t ms, struct sched_dl_bench_result* result) {
+    if (!result || nr_dl == 0) return -1;
+    if (nr_dl > DL_BENCH_MAX_TASKS) nr_dl = DL_BENCH_MAX_TASKS;
+    if (nr_hogs > BENCH_MAX_TASKS) nr_hogs = BENCH_MAX_TASKS;
+    
+    bench_stop = false;
+    bench_next_slot = 0;
+    bench_waiter = get_current_tid();
+    bench_active = 0;
+    
+    uint64_t start = ktime_get_ns();
+    uint32_t hogs = 0;
+    while (hogs < nr_hogs) {
+        __atomic_add_fetch(&bench_active, 1, __ATOMIC_RELAXED);
+        if (task_create(bench_worker, BENCH_PRIORITY) == 0) {
+            __atomic_sub_fetch(&bench_active, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        hogs++;
+    }
+    
+    // admission can refuse some if other deadline tasks already hold bandwidth
+    uint32_t tids[DL_BENCH_MAX_TASKS];
+    uint32_t n = 0;
+    while (n < nr_dl) {
+        __atomic_add_fetch(&bench_active, 1, __ATOMIC_RELAXED);
+        tids[n] = task_create_deadline(bench_dl_worker, DL_BENCH_RUNTIME, DL_BENCH_PERIOD, DL_BENCH_PERIOD);
+        if (tids[n] == 0) {
+            __atomic_sub_fetch(&bench_active, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        n++;
+    }
+    
+    if (n > 0) {
+        task_sleep(ms);
+    }
+    
+    // task_exit drops the deadline class, read the stats while they still run
+    result->jobs = 0;
+    result->misses = 0;
+    result->throttled = 0;
+    result->worst_misses = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        struct sched_dl_stats stats;
+        if (task_get_dl_stats(tids[i], &stats) != 0) continue;
+        result->jobs += stats.jobs;
+        result->misses += stats.misses;
+        result->throttled += stats.throttled;
+        if (stats.misses > result->worst_misses) result->worst_misses = stats.misses;
+    }
+    
+    bench_stop = true;
+    while (__atomic_load_n(&bench_active, __ATOMIC_ACQUIRE)) {
+        task_block();
+    }
+    result->elapsed_ns = ktime_get_ns() - start;
+    result->nr_dl_tasks = n;
+    result->nr_hogs = hogs;
+    return n > 0 ? 0 : -1;
 }
 
 void debug_sched_state(void) {
+    kprintf("cpu  running  load  avg  util  switches  pulled\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct sched_cpu_stats stats;
+        if (sched_get_cpu_stats(cpu, &stats) != 0) continue;
+        
+        uint64_t util = stats.total_ticks ? (stats.busy_ticks * 100) / stats.total_ticks : 0;
+        kprintf("%-4u %-8u %-5lu %-4lu %3lu%%  %-9lu %lu\n",
+                cpu, stats.nr_running, stats.load, stats.avg_load,
+                util, stats.nr_switches, stats.nr_pulled);
+    }
 }
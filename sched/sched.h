@@ -1,17 +1,83 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 
 #define TASK_DEAD     0
 #define TASK_READY    1
 #define TASK_RUNNING  2
 #define TASK_SLEEPING 3
+#define TASK_THROTTLED 4
+#define TASK_BLOCKED  5
+#define TASK_ZOMBIE   6
+
+#define SCHED_NORMAL   0
+#define SCHED_DEADLINE 1
+
+struct sched_dl_stats {
+    uint64_t runtime;
+    uint64_t deadline;
+    uint64_t period;
+    uint64_t abs_deadline;
+    uint32_t jobs;
+    uint32_t misses;
+    uint32_t throttled;
+};
+
+struct sched_cpu_stats {
+    uint32_t nr_running;
+    uint64_t load;
+    uint64_t avg_load;
+    uint64_t busy_ticks;
+    uint64_t total_ticks;
+    uint64_t nr_switches;
+    uint64_t nr_pulled;
+};
+
+struct sched_bench_result {
+    uint32_t nr_tasks;
+    uint32_t nr_cpus;
+    uint64_t elapsed_ns;
+    uint64_t spread_ms;
+    uint64_t pulled;
+    uint64_t migrations;
+    uint64_t min_work;
+    uint64_t max_work;
+    uint32_t max_per_cpu;
+    uint32_t min_per_cpu;
+    bool balanced;
+};
+
+struct sched_dl_bench_result {
+    uint32_t nr_dl_tasks;
+    uint32_t nr_hogs;
+    uint64_t elapsed_ns;
+    uint32_t jobs;
+    uint32_t misses;
+    uint32_t throttled;
+    uint32_t worst_misses;
+};
 
 void sched_init(void);
+void sched_init_cpu(void);
+void schedule_tail(void);
 uint32_t task_create(void (*entry)(void), uint32_t priority);
+uint32_t task_create_deadline(void (*entry)(void), uint64_t runtime, uint64_t deadline, uint64_t period);
+int task_set_deadline(uint32_t tid, uint64_t runtime, uint64_t deadline, uint64_t period);
+int task_get_dl_stats(uint32_t tid, struct sched_dl_stats* stats);
+int task_set_affinity(uint32_t tid, uint64_t mask);
+uint64_t task_get_affinity(uint32_t tid);
 void task_exit(void);
 void task_yield(void);
 void task_sleep(uint64_t ms);
+void task_block(void);
+int task_wake(uint32_t tid);
 void schedule(void);
 void timer_tick(void);
+void sched_irq_exit(void);
 uint32_t get_current_tid(void);
+uint64_t get_tick_count(void);
+uint64_t sched_online_cpus(void);
+int sched_get_cpu_stats(uint32_t cpu, struct sched_cpu_stats* stats);
+int sched_bench_balance(uint32_t nr_tasks, uint32_t ms, struct sched_bench_result* result);
+int sched_bench_deadline(uint32_t nr_dl, uint32_t nr_hogs, uint32_t ms, struct sched_dl_bench_result* result);
 void debug_sched_state(void);
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <softirq.h>
+#include <../cpu.h>
+#include <../irq.h>
+
+// bound the work done per irq exit so a flood can't starve tasks
+#define MAX_SOFTIRQ_RESTART 10
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+static volatile uint32_t pending_mask[MAX_CPUS];
+static volatile uint32_t softirq_active[MAX_CPUS];
+
+static struct tasklet* tasklet_head[MAX_CPUS];
+static struct tasklet** tasklet_tail[MAX_CPUS];
+
+// the cpu id is only stable once interrupts are off, before that the task
+// can be preempted and moved
+static void tasklet_enqueue(struct tasklet* t) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    t->next = NULL;
+    *tasklet_tail[cpu] = t;
+    tasklet_tail[cpu] = &t->next;
+    local_irq_restore(flags);
+    
+    raise_softirq(SOFTIRQ_TASKLET);
+}
+
+static void tasklet_action(void) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    struct tasklet* list = tasklet_head[cpu];
+    tasklet_head[cpu] = NULL;
+    tasklet_tail[cpu] = &tasklet_head[cpu];
+    local_irq_restore(flags);
+    
+    while (list) {
+        struct tasklet* t = list;
+        list = list->next;
+        
+        // rescheduled while running elsewhere, try again next round
+        if (__atomic_fetch_or(&t->state, TASKLET_RUNNING, __ATOMIC_ACQUIRE) & TASKLET_RUNNING) {
+            tasklet_enqueue(t);
+            continue;
+        }
+        
+        __atomic_fetch_and(&t->state, ~TASKLET_SCHED, __ATOMIC_RELEASE);
+        t->func(t->data);
+        __atomic_fetch_and(&t->state, ~TASKLET_RUNNING, __ATOMIC_RELEASE);
+    }
+}
+
+void softirq_init(void) {
+    for (int i = 0; i < NR_SOFTIRQS; i++) {
+        softirq_vec[i] = NULL;
+    }
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        pending_mask[cpu] = 0;
+        softirq_active[cpu] = 0;
+        tasklet_head[cpu] = NULL;
+        tasklet_tail[cpu] = &tasklet_head[cpu];
+    }
+    
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+}
+
+void open_softirq(uint32_t nr, void (*action)(void)) {
+    if (nr >= NR_SOFTIRQS) return;
+    softirq_vec[nr] = action;
+}
+
+void raise_softirq(uint32_t nr) {
+    if (nr >= NR_SOFTIRQS) return;
+    
+    uint64_t flags = local_irq_save();
+    pending_mask[smp_processor_id()] |= 1U << nr;
+    local_irq_restore(flags);
+    
+    // outside irq context nobody else will get to it soon, run it now.
+    // do_softirq turns interrupts on, so a caller that has them off (or
+    // holds an irqsave lock) leaves it for the next irq exit
+    if (!in_interrupt() && !irqs_disabled_flags(flags)) {
+        do_softirq();
+    }
+}
+
+bool softirq_pending(void) {
+    return pending_mask[smp_processor_id()] != 0;
+}
+
+// only meaningful with interrupts off, otherwise the cpu can change under us
+bool in_softirq(void) {
+    return softirq_active[smp_processor_id()] != 0;
+}
+
+void do_softirq(void) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    
+    if (softirq_active[cpu]) {
+        local_irq_restore(flags);
+        return;
+    }
+    softirq_active[cpu] = 1;
+    
+    for (int restart = 0; restart < MAX_SOFTIRQ_RESTART; restart++) {
+        uint32_t pending = pending_mask[cpu];
+        if (!pending) break;
+        pending_mask[cpu] = 0;
+        
+        // handlers run with interrupts on so top halves stay short
+        local_irq_enable();
+        for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+            if ((pending & (1U << nr)) && softirq_vec[nr]) {
+                softirq_vec[nr]();
+            }
+        }
+        local_irq_disable();
+    }
+    
+    softirq_active[cpu] = 0;
+    local_irq_restore(flags);
+}
+
+void tasklet_init(struct tasklet* t, void (*func)(uint64_t data), uint64_t data) {
+    t->next = NULL;
+    t->state = 0;
+    t->func = func;
+    t->data = data;
+}
+
+void tasklet_schedule(struct tasklet* t) {
+    // already queued, it will run once for all the schedules
+    if (__atomic_fetch_or(&t->state, TASKLET_SCHED, __ATOMIC_ACQ_REL) & TASKLET_SCHED) {
+        return;
+    }
+    
+    tasklet_enqueue(t);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SOFTIRQ_HI      0
+#define SOFTIRQ_TIMER   1
+#define SOFTIRQ_NET_TX  2
+#define SOFTIRQ_NET_RX  3
+#define SOFTIRQ_BLOCK   4
+#define SOFTIRQ_TASKLET 5
+#define NR_SOFTIRQS     6
+
+#define TASKLET_SCHED   (1 << 0)
+#define TASKLET_RUNNING (1 << 1)
+
+struct tasklet {
+    struct tasklet* next;
+    volatile uint32_t state;
+    void (*func)(uint64_t data);
+    uint64_t data;
+};
+
+void softirq_init(void);
+void open_softirq(uint32_t nr, void (*action)(void));
+void raise_softirq(uint32_t nr);
+bool softirq_pending(void);
+bool in_softirq(void);
+void do_softirq(void);
+
+void tasklet_init(struct tasklet* t, void (*func)(uint64_t data), uint64_t data);
+void tasklet_schedule(struct tasklet* t);
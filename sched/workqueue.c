@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <softirq.h>
+#include <workqueue.h>
+#include <../spinlock.h>
+
+// items a worker takes per wakeup before it looks at the scheduler again
+#define WORK_BATCH 8
+
+static struct work* work_head = NULL;
+static struct work* work_tail = NULL;
+static struct work* delayed_head = NULL;
+static spinlock_t work_lock = SPINLOCK_INIT;
+
+static uint32_t worker_tids[WORKQUEUE_WORKERS];
+static volatile uint32_t worker_idle[WORKQUEUE_WORKERS];
+static uint32_t nr_workers = 0;
+
+static void wake_idle_worker(void) {
+    for (uint32_t i = 0; i < nr_workers; i++) {
+        if (worker_idle[i]) {
+            worker_idle[i] = 0;
+            task_wake(worker_tids[i]);
+            return;
+        }
+    }
+}
+
+static void append_work(struct work* work) {
+    work->next = NULL;
+    if (work_tail) {
+        work_tail->next = work;
+    } else {
+        work_head = work;
+    }
+    work_tail = work;
+}
+
+static uint32_t worker_index(void) {
+    uint32_t tid = get_current_tid();
+    for (uint32_t i = 0; i < nr_workers; i++) {
+        if (worker_tids[i] == tid) return i;
+    }
+    return 0;
+}
+
+static void worker_loop(void) {
+    uint32_t self = worker_index();
+    
+    while (1) {
+        struct work* batch[WORK_BATCH];
+        int count = 0;
+        
+        uint64_t flags = spin_lock_irqsave(&work_lock);
+        while (work_head && count < WORK_BATCH) {
+            struct work* work = work_head;
+            work_head = work->next;
+            if (!work_head) work_tail = NULL;
+            work->next = NULL;
+            work->pending = 0;
+            batch[count++] = work;
+        }
+        if (count == 0) {
+            worker_idle[self] = 1;
+        }
+        spin_unlock_irqrestore(&work_lock, flags);
+        
+        if (count == 0) {
+            task_block();
+            continue;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            batch[i]->func(batch[i]);
+        }
+    }
+}
+
+static void run_delayed_work(void) {
+    uint64_t now = get_tick_count();
+    bool queued = false;
+    
+    uint64_t flags = spin_lock_irqsave(&work_lock);
+    struct work** link = &delayed_head;
+    while (*link) {
+        struct work* work = *link;
+        if (work->expires <= now) {
+            *link = work->next;
+            append_work(work);
+            queued = true;
+        } else {
+            link = &work->next;
+        }
+    }
+    if (queued) {
+        wake_idle_worker();
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+}
+
+void workqueue_init(void) {
+    work_head = NULL;
+    work_tail = NULL;
+    delayed_head = NULL;
+    nr_workers = 0;
+    
+    for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+        worker_idle[i] = 0;
+        uint32_t tid = task_create(worker_loop, WORKER_PRIORITY);
+        if (!tid) break;
+        worker_tids[nr_workers++] = tid;
+    }
+    
+    open_softirq(SOFTIRQ_TIMER, run_delayed_work);
+}
+
+void init_work(struct work* work, void (*func)(struct work* work), void* data) {
+    work->func = func;
+    work->data = data;
+    work->expires = 0;
+    work->pending = 0;
+    work->next = NULL;
+}
+
+bool queue_work(struct work* work) {
+    uint64_t flags = spin_lock_irqsave(&work_lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return false;
+    }
+    
+    work->pending = 1;
+    append_work(work);
+    wake_idle_worker();
+    spin_unlock_irqrestore(&work_lock, flags);
+    return true;
+}
+
+bool queue_delayed_work(struct work* work, uint64_t delay_ms) {
+    if (delay_ms == 0) return queue_work(work);
+    
+    uint64_t flags = spin_lock_irqsave(&work_lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return false;
+    }
+    
+    work->pending = 1;
+    work->expires = get_tick_count() + delay_ms;
+    work->next = delayed_head;
+    delayed_head = work;
+    spin_unlock_irqrestore(&work_lock, flags);
+    return true;
+}
+
+bool cancel_work(struct work* work) {
+    bool found = false;
+    
+    uint64_t flags = spin_lock_irqsave(&work_lock);
+    struct work** link = &delayed_head;
+    while (*link && !found) {
+        if (*link == work) {
+            *link = work->next;
+            found = true;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    
+    struct work* prev = NULL;
+    struct work* curr = work_head;
+    while (curr && !found) {
+        if (curr == work) {
+            if (prev) {
+                prev->next = curr->next;
+            } else {
+                work_head = curr->next;
+            }
+            if (work_tail == curr) work_tail = prev;
+            found = true;
+        } else {
+            prev = curr;
+            curr = curr->next;
+        }
+    }
+    
+    if (found) {
+        work->next = NULL;
+        work->pending = 0;
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+    return found;
+}
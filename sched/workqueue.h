@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WORKQUEUE_WORKERS 4
+#define WORKER_PRIORITY   2
+
+struct work {
+    void (*func)(struct work* work);
+    void* data;
+    uint64_t expires;
+    volatile uint32_t pending;
+    struct work* next;
+};
+
+void workqueue_init(void);
+void init_work(struct work* work, void (*func)(struct work* work), void* data);
+bool queue_work(struct work* work);
+bool queue_delayed_work(struct work* work, uint64_t delay_ms);
+bool cancel_work(struct work* work);
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <cpu.h>
+#include <irq.h>
+#include <smp.h>
+#include <prof.h>
+#include <timer.h>
+#include <sched/sched.h>
+
+extern void secondary_entry(void);
+extern void mmu_enable(void);
+
+static volatile uint32_t cpus_started = 1;
+
+// qemu virt without el2 firmware takes psci calls over hvc
+static int64_t psci_cpu_on(uint64_t mpidr, uint64_t entry, uint64_t context) {
+    register uint64_t x0 __asm__("x0") = PSCI_CPU_ON;
+    register uint64_t x1 __asm__("x1") = mpidr;
+    register uint64_t x2 __asm__("x2") = entry;
+    register uint64_t x3 __asm__("x3") = context;
+    __asm__ volatile("hvc #0" : "+r"(x0) : "r"(x1), "r"(x2), "r"(x3) : "memory");
+    return (int64_t)x0;
+}
+
+void smp_boot_secondaries(void) {
+    for (uint64_t cpu = 1; cpu < MAX_CPUS; cpu++) {
+        uint32_t before = cpus_started;
+        if (psci_cpu_on(cpu, (uint64_t)secondary_entry, cpu) != 0) continue;
+        
+        // bring cores up one at a time, they share early init state
+        while (cpus_started == before) {
+            cpu_relax();
+        }
+    }
+}
+
+void secondary_main(uint64_t cpu) {
+    (void)cpu;
+    
+    mmu_enable();
+    irq_init_cpu();
+    prof_init_cpu();
+    sched_init_cpu();
+    timer_init_cpu();
+    __atomic_fetch_add(&cpus_started, 1, __ATOMIC_RELEASE);
+    
+    local_irq_enable();
+    while(1) {
+        asm volatile("wfi");
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PSCI_CPU_ON 0xC4000003
+#define SMP_STACK_SIZE 16384
+
+void smp_boot_secondaries(void);
+void secondary_main(uint64_t cpu);
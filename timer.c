@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <cpu.h>
+#include <irq.h>
+#include <timer.h>
+#include <sched/sched.h>
+
+static uint64_t cntfrq = 0;
+static uint64_t tick_period = 0;
+static uint64_t boot_count = 0;
+static uint64_t event_period = 0;
+
+// split so ticks * NSEC_PER_SEC can't overflow over long uptimes
+uint64_t timer_counter_to_ns(uint64_t ticks) {
+    if (!cntfrq) return 0;
+    return (ticks / cntfrq) * NSEC_PER_SEC + (ticks % cntfrq) * NSEC_PER_SEC / cntfrq;
+}
+
+static void timer_irq(uint32_t irq, void* data) {
+    (void)irq;
+    (void)data;
+    
+    // program absolute deadlines so handler latency doesn't accumulate as drift
+    uint64_t cval;
+    __asm__ volatile("mrs %0, cntv_cval_el0" : "=r"(cval));
+    cval += tick_period;
+    uint64_t now = timer_counter();
+    if (cval <= now) {
+        cval = now + tick_period;
+    }
+    __asm__ volatile("msr cntv_cval_el0, %0" :: "r"(cval));
+    
+    timer_tick();
+}
+
+void timer_init_cpu(void) {
+    // wfe wakes on the event stream, about every event_period counter ticks
+    uint64_t evnti = 0;
+    while (evnti < 15 && (2ULL << evnti) < event_period) {
+        evnti++;
+    }
+    uint64_t kctl;
+    __asm__ volatile("mrs %0, cntkctl_el1" : "=r"(kctl));
+    kctl = (kctl & ~(0xFULL << 4)) | (evnti << 4) | (1 << 2);
+    __asm__ volatile("msr cntkctl_el1, %0" :: "r"(kctl));
+    
+    __asm__ volatile("msr cntv_cval_el0, %0" :: "r"(timer_counter() + tick_period));
+    __asm__ volatile("msr cntv_ctl_el0, %0" :: "r"((uint64_t)1));
+    irq_enable(TIMER_IRQ);
+}
+
+void timer_init(void) {
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(cntfrq));
+    tick_period = cntfrq / HZ;
+    event_period = cntfrq / 100000;
+    boot_count = timer_counter();
+    
+    irq_register(TIMER_IRQ, timer_irq, NULL);
+    timer_init_cpu();
+}
+
+uint64_t timer_freq(void) {
+    if (cntfrq) return cntfrq;
+    // prof calibrates before timer_init
+    uint64_t freq;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
+uint64_t ktime_get_ns(void) {
+    return timer_counter_to_ns(timer_counter() - boot_count);
+}
+
+uint64_t ktime_get_us(void) {
+    return ktime_get_ns() / NSEC_PER_USEC;
+}
+
+// jiffies since boot, derived from the counter rather than counted interrupts
+uint64_t get_timer_ticks(void) {
+    if (!tick_period) return 0;
+    return (timer_counter() - boot_count) / tick_period;
+}
+
+void udelay(uint64_t us) {
+    uint64_t start = timer_counter();
+    uint64_t wait = (us / 1000000) * cntfrq + (us % 1000000) * cntfrq / 1000000;
+    
+    // the event stream guarantees a wakeup, waits shorter than it just spin
+    while (timer_counter() - start < wait) {
+        if (wait - (timer_counter() - start) > event_period * 2) {
+            __asm__ volatile("wfe");
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
+void mdelay(uint64_t ms) {
+    udelay(ms * 1000);
+}
+
+// sleeps through the scheduler when there is a task to put to sleep
+void msleep(uint64_t ms) {
+    if (!in_interrupt() && get_current_tid() != 0) {
+        task_sleep(ms * HZ / 1000);
+    } else {
+        mdelay(ms);
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// scheduler tick rate, one jiffy is one millisecond
+#define HZ 1000
+
+// el1 virtual timer ppi on qemu virt
+#define TIMER_IRQ 27
+
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+void timer_init(void);
+void timer_init_cpu(void);
+uint64_t timer_freq(void);
+
+// the raw virtual counter, timer_freq() ticks a second. for hot paths and
+// benches that want counter units, everything else uses ktime_get_ns
+static inline uint64_t timer_counter(void) {
+    uint64_t val;
+    __asm__ volatile("isb\nmrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+uint64_t timer_counter_to_ns(uint64_t ticks);
+uint64_t ktime_get_ns(void);
+uint64_t ktime_get_us(void);
+uint64_t get_timer_ticks(void);
+void udelay(uint64_t us);
+void mdelay(uint64_t ms);
+void msleep(uint64_t ms);
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+# turns `nm -n kernel.elf` into the sorted text symbol table prof.c resolves against
+#
+#   aarch64-linux-gnu-nm -n build/kernel0.elf | tools/gensyms.py > build/ksyms.s
+#
+# with no input it emits an empty table, used for the first link pass
+
+import sys
+
+
+def main():
+    syms = []
+    for line in sys.stdin:
+        fields = line.split()
+        if len(fields) != 3:
+            continue
+        addr, kind, name = fields
+        if kind not in "Tt" or name.startswith("$"):
+            continue
+        syms.append((int(addr, 16), name))
+    syms.sort()
+
+    out = sys.stdout
+    out.write(".section .rodata\n.balign 8\n")
+    out.write(".globl ksym_count\nksym_count:\n    .quad %d\n" % len(syms))
+    out.write(".globl ksym_addrs\nksym_addrs:\n")
+    for addr, _ in syms:
+        out.write("    .quad 0x%x\n" % addr)
+    out.write(".globl ksym_offsets\nksym_offsets:\n")
+    offset = 0
+    for _, name in syms:
+        out.write("    .word %d\n" % offset)
+        offset += len(name) + 1
+    out.write(".globl ksym_names\nksym_names:\n")
+    for _, name in syms:
+        out.write('    .asciz "%s"\n' % name)
+    if not syms:
+        out.write("    .byte 0\n")
+
+
+if __name__ == "__main__":
+    main()
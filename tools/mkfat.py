@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+# builds a FAT32 image for the virtio-blk disk, no mtools needed
+#
+#   tools/mkfat.py OUT [--size MB] [--cluster BYTES] [--bench MB]
+#                      [--fragment N] [SRC[:DEST] ...]
+#
+# SRC is a host file or directory, copied to DEST (default its basename).
+# --bench adds /bench.bin, every 32-bit word holding its own byte offset,
+# for fat_bench_read(). --fragment N lays files out in runs of N clusters
+# with a free cluster between runs, so chains turn into many extents.
+#
+#   make fat-image && make run DISK=build/fat.img
+
+import argparse
+import array
+import os
+import struct
+import sys
+
+SECTOR = 512
+RESERVED = 32
+NR_FATS = 2
+ROOT_CLUSTER = 2
+EOC = 0x0FFFFFFF
+ATTR_DIR = 0x10
+ATTR_ARCHIVE = 0x20
+ATTR_LFN = 0x0F
+SHORT_CHARS = set(b"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789$%'-_@~`!(){}^#&")
+
+
+class Node:
+    def __init__(self, name, data=None):
+        self.name = name
+        self.data = data
+        self.children = [] if data is None else None
+        self.cluster = 0
+        self.short = None
+
+    def is_dir(self):
+        return self.children is not None
+
+
+def short_name(name, taken):
+    """8.3 name for name, and whether a long name entry is needed"""
+    base, _, ext = name.rpartition(".") if "." in name[1:] else (name, "", "")
+    if (0 < len(base) <= 8 and len(ext) <= 3 and name == name.upper()
+            and all(c in SHORT_CHARS for c in (base + ext).encode("ascii", "replace"))):
+        short = base.encode().ljust(8) + ext.encode().ljust(3)
+        if short not in taken:
+            return short, False
+
+    def clean(s):
+        out = bytearray()
+        for c in s.upper().encode("ascii", "replace"):
+            if c in SHORT_CHARS:
+                out.append(c)
+            elif c not in b" .":
+                out.append(ord("_"))
+        return bytes(out)
+
+    b, e = clean(base), clean(ext)[:3]
+    for n in range(1, 1000000):
+        tail = b"~%d" % n
+        short = (b[:8 - len(tail)] + tail).ljust(8) + e.ljust(3)
+        if short not in taken:
+            return short, True
+    sys.exit(f"mkfat: no short name left for {name}")
+
+
+def lfn_checksum(short):
+    s = 0
+    for c in short:
+        s = (((s & 1) << 7) + (s >> 1) + c) & 0xFF
+    return s
+
+
+def lfn_entries(name, short):
+    chars = [ord(c) for c in name]
+    count = (len(chars) + 12) // 13
+    chars += [0] if len(chars) % 13 else []
+    chars += [0xFFFF] * (count * 13 - len(chars))
+    csum = lfn_checksum(short)
+    out = []
+    for i in range(count, 0, -1):
+        part = chars[(i - 1) * 13:i * 13]
+        order = i | (0x40 if i == count else 0)
+        out.append(struct.pack("<B5HBBB6HH2H", order, *part[:5], ATTR_LFN, 0, csum,
+                               *part[5:11], 0, *part[11:13]))
+    return out
+
+
+def dir_entry(short, attr, cluster, size):
+    return struct.pack("<11sBBBHHHHHHHI", short, attr, 0, 0, 0, 0x21, 0x21,
+                       cluster >> 16, 0, 0x21, cluster & 0xFFFF, size)
+
+
+class Image:
+    def __init__(self, size, cluster, fragment):
+        self.spc = cluster // SECTOR
+        self.cluster = cluster
+        self.fragment = fragment
+        total = size // SECTOR
+
+        # the FAT has to cover the clusters left over once it is placed
+        fat_sectors = 1
+        while True:
+            clusters = (total - RESERVED - NR_FATS * fat_sectors) // self.spc
+            need = ((clusters + 2) * 4 + SECTOR - 1) // SECTOR
+            if need <= fat_sectors:
+                break
+            fat_sectors = need
+        if clusters < 65525:
+            print(f"mkfat: only {clusters} clusters, not a spec-compliant FAT32", file=sys.stderr)
+
+        self.total = total
+        self.fat_sectors = fat_sectors
+        self.clusters = clusters
+        self.data_start = RESERVED + NR_FATS * fat_sectors
+        self.fat = [0] * (clusters + 2)
+        self.fat[0] = 0x0FFFFFF8
+        self.fat[1] = EOC
+        self.next = ROOT_CLUSTER
+        self.writes = []
+
+    def alloc(self, nbytes):
+        count = max(1, (nbytes + self.cluster - 1) // self.cluster)
+        chain = []
+        while len(chain) < count:
+            if self.next >= self.clusters + 2:
+                sys.exit("mkfat: image full")
+            chain.append(self.next)
+            self.next += 1
+            if self.fragment and len(chain) % self.fragment == 0:
+                self.next += 1
+        for a, b in zip(chain, chain[1:]):
+            self.fat[a] = b
+        self.fat[chain[-1]] = EOC
+        return chain
+
+    def place(self, chain, data):
+        for i, c in enumerate(chain):
+            part = data[i * self.cluster:(i + 1) * self.cluster]
+            if part:
+                offset = (self.data_start + (c - 2) * self.spc) * SECTOR
+                self.writes.append((offset, part))
+
+    def layout(self, node, parent):
+        if not node.is_dir():
+            if node.data:
+                chain = self.alloc(len(node.data))
+                node.cluster = chain[0]
+                self.place(chain, node.data)
+            return
+
+        taken = set()
+        entries = []
+        for child in node.children:
+            child.short, needs_lfn = short_name(child.name, taken)
+            taken.add(child.short)
+            if needs_lfn:
+                entries += lfn_entries(child.name, child.short)
+            entries.append(child)
+        if parent is not None:
+            entries = [".", ".."] + entries
+
+        chain = self.alloc((len(entries) + 1) * 32)
+        node.cluster = chain[0]
+        for child in node.children:
+            self.layout(child, node)
+
+        raw = bytearray()
+        for e in entries:
+            if e == ".":
+                raw += dir_entry(b".".ljust(11), ATTR_DIR, node.cluster, 0)
+            elif e == "..":
+                up = 0 if parent.cluster == ROOT_CLUSTER else parent.cluster
+                raw += dir_entry(b"..".ljust(11), ATTR_DIR, up, 0)
+            elif isinstance(e, bytes):
+                raw += e
+            elif e.is_dir():
+                raw += dir_entry(e.short, ATTR_DIR, e.cluster, 0)
+            else:
+                raw += dir_entry(e.short, ATTR_ARCHIVE, e.cluster, len(e.data))
+        self.place(chain, bytes(raw).ljust(len(chain) * self.cluster, b"\0"))
+
+    def boot_sector(self):
+        bpb = struct.pack("<3s8sHBHBHHBHHHIIIHHIHH12sBBBI11s8s",
+                          b"\xEB\x58\x90", b"COMETOS ", SECTOR, self.spc, RESERVED,
+                          NR_FATS, 0, 0, 0xF8, 0, 63, 255, 0, self.total,
+                          self.fat_sectors, 0, 0, ROOT_CLUSTER, 1, 6, b"\0" * 12,
+                          0x80, 0, 0x29, 0x434F4D54, b"COMET DISK ", b"FAT32   ")
+        return bpb.ljust(510, b"\0") + b"\x55\xAA"
+
+    def fsinfo(self):
+        free = self.clusters + 2 - self.next
+        return struct.pack("<I480sIII12sI", 0x41615252, b"", 0x61417272, free,
+                           self.next, b"", 0xAA550000)
+
+    def write(self, path):
+        with open(path, "wb") as f:
+            f.truncate(self.total * SECTOR)
+            boot = self.boot_sector()
+            for base in (0, 6):
+                f.seek(base * SECTOR)
+                f.write(boot)
+                f.seek((base + 1) * SECTOR)
+                f.write(self.fsinfo())
+            fat = words(self.fat)
+            for i in range(NR_FATS):
+                f.seek((RESERVED + i * self.fat_sectors) * SECTOR)
+                f.write(fat)
+            for offset, data in self.writes:
+                f.seek(offset)
+                f.write(data)
+
+
+def add(root, src, dest):
+    parts = [p for p in dest.split("/") if p]
+    node = root
+    for p in parts[:-1]:
+        match = [c for c in node.children if c.name.upper() == p.upper()]
+        if match:
+            node = match[0]
+        else:
+            child = Node(p)
+            node.children.append(child)
+            node = child
+
+    if os.path.isdir(src):
+        d = Node(parts[-1])
+        node.children.append(d)
+        for name in sorted(os.listdir(src)):
+            add(d, os.path.join(src, name), name)
+    else:
+        with open(src, "rb") as f:
+            node.children.append(Node(parts[-1], f.read()))
+
+
+def words(values):
+    a = array.array("I", values)
+    if sys.byteorder == "big":
+        a.byteswap()
+    return a.tobytes()
+
+
+def bench_file(mb):
+    return words(range(0, mb * 1024 * 1024, 4))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="build a FAT32 disk image")
+    ap.add_argument("out")
+    ap.add_argument("--size", type=int, default=512, help="image size in MB")
+    ap.add_argument("--cluster", type=int, default=4096, help="cluster size in bytes")
+    ap.add_argument("--bench", type=int, default=0, help="size of /bench.bin in MB")
+    ap.add_argument("--fragment", type=int, default=0, help="clusters per run")
+    ap.add_argument("files", nargs="*", help="SRC[:DEST]")
+    args = ap.parse_intermixed_args()
+
+    if args.cluster < SECTOR or args.cluster > 65536 or args.cluster & (args.cluster - 1):
+        sys.exit("mkfat: cluster size must be a power of two from 512 to 65536")
+
+    root = Node("")
+    for spec in args.files:
+        src, _, dest = spec.partition(":")
+        add(root, src, dest or os.path.basename(os.path.normpath(src)))
+    if args.bench:
+        root.children.append(Node("bench.bin", bench_file(args.bench)))
+
+    img = Image(args.size * 1024 * 1024, args.cluster, args.fragment)
+    img.layout(root, None)
+    img.write(args.out)
+    used = img.next - ROOT_CLUSTER
+    print(f"{args.out}: {img.clusters} clusters of {args.cluster} bytes, {used} used")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# decodes a trace_dump_uart() capture into a merged timeline
+#
+#   qemu ... -serial file:serial.log
+#   tools/trace_decode.py serial.log            text timeline
+#   tools/trace_decode.py --chrome serial.log   chrome://tracing / perfetto json
+
+import json
+import sys
+
+
+def parse(lines):
+    freq = 1
+    names = {}
+    events = []
+    inside = False
+    for raw in lines:
+        line = raw.strip()
+        if line.startswith("#TRACE-BEGIN"):
+            inside = True
+            events = []
+            for field in line.split()[1:]:
+                key, _, value = field.partition("=")
+                if key == "freq":
+                    freq = int(value) or 1
+        elif line.startswith("#TRACE-END"):
+            inside = False
+        elif not inside:
+            continue
+        elif line.startswith("#EVENT"):
+            _, idx, name = line.split()
+            names[int(idx)] = name
+        elif line.startswith("E "):
+            f = line.split()
+            events.append({
+                "cpu": int(f[1]),
+                "seq": int(f[2]),
+                "ts": int(f[3], 16),
+                "id": int(f[4]),
+                "args": [int(a, 16) for a in f[5:9]],
+            })
+    events.sort(key=lambda e: (e["ts"], e["cpu"], e["seq"]))
+    return freq, names, events
+
+
+def text(freq, names, events):
+    if not events:
+        return
+    base = events[0]["ts"]
+    prev = base
+    for e in events:
+        us = (e["ts"] - base) * 1e6 / freq
+        delta = (e["ts"] - prev) * 1e6 / freq
+        prev = e["ts"]
+        name = names.get(e["id"], "event%d" % e["id"])
+        args = " ".join("0x%x" % a for a in e["args"])
+        print("%14.3f us  +%10.3f  cpu%d  %-14s %s" % (us, delta, e["cpu"], name, args))
+
+
+def chrome(freq, names, events):
+    base = events[0]["ts"] if events else 0
+    out = []
+    for e in events:
+        out.append({
+            "name": names.get(e["id"], "event%d" % e["id"]),
+            "ph": "i",
+            "s": "t",
+            "ts": (e["ts"] - base) * 1e6 / freq,
+            "pid": 0,
+            "tid": e["cpu"],
+            "args": {"a%d" % i: hex(a) for i, a in enumerate(e["args"])},
+        })
+    json.dump({"traceEvents": out}, sys.stdout)
+
+
+def main():
+    args = sys.argv[1:]
+    want_chrome = "--chrome" in args
+    args = [a for a in args if a != "--chrome"]
+    src = open(args[0], errors="replace") if args else sys.stdin
+    freq, names, events = parse(src)
+    if want_chrome:
+        chrome(freq, names, events)
+    else:
+        text(freq, names, events)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# udp echo peer for udp_bench_echo()
+#
+#   tools/udp_echo.py [port]                    defaults to 7777
+#
+# with qemu user networking the guest reaches the host's loopback as
+# 10.0.2.2, so udp_bench_echo(NET_IP(10, 0, 2, 2), 7777, ...) talks to this.
+# with NETDEV=socket,... run it on whichever side owns the other end.
+
+import socket
+import sys
+import time
+
+
+def main():
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 7777
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+    sock.bind(("0.0.0.0", port))
+    print(f"echoing udp on :{port}", file=sys.stderr)
+
+    count = 0
+    last = time.monotonic()
+    while True:
+        data, addr = sock.recvfrom(2048)
+        sock.sendto(data, addr)
+        count += 1
+
+        now = time.monotonic()
+        if now - last >= 1.0:
+            print(f"{count / (now - last):.0f} datagrams/s", file=sys.stderr)
+            count = 0
+            last = now
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
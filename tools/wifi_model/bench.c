@@ -0,0 +1,229 @@
+// connect-latency benchmark for internet/wifi.c against the software chip in model.c.
+// builds on the host (make wifi-bench) with the kernel services the driver uses
+// stubbed onto a virtual millisecond clock, so results are the driver's own
+// latency: poll granularity, sleeps and retries, not host speed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <wifi.h>
+#include <wifi_model.h>
+#include <workqueue.h>
+#include <sched.h>
+#include <async.h>
+
+#define RUNS 1000
+#define MAX_ATTEMPTS 3
+
+static uint64_t now_ms = 0;
+
+uint64_t sim_now_ms(void) {
+    return now_ms;
+}
+
+// kernel services the driver and the async executor pull in
+
+uint64_t get_tick_count(void) { return now_ms; }
+uint64_t ktime_get_ns(void) { return now_ms * 1000000; }
+void msleep(uint64_t ms) { now_ms += ms; }
+int vm_map(uint64_t virt, uint64_t phys, uint32_t prot) { (void)virt; (void)phys; (void)prot; return 0; }
+uint32_t get_current_tid(void) { return 1; }
+int task_wake(uint32_t tid) { (void)tid; return 0; }
+
+void task_block(void) {
+    fprintf(stderr, "task_block() is not simulated, use wifi_connect_async()\n");
+    exit(1);
+}
+
+void task_yield(void) {
+    fprintf(stderr, "task_yield() is not simulated, use wifi_connect_async()\n");
+    exit(1);
+}
+
+static struct work* run_queue[16];
+static int nr_run = 0;
+static struct work* timers[16];
+static int nr_timers = 0;
+
+void init_work(struct work* work, void (*func)(struct work* work), void* data) {
+    work->func = func;
+    work->data = data;
+    work->pending = 0;
+    work->expires = 0;
+    work->next = NULL;
+}
+
+bool queue_work(struct work* work) {
+    if (work->pending) return false;
+    work->pending = 1;
+    run_queue[nr_run++] = work;
+    return true;
+}
+
+bool queue_delayed_work(struct work* work, uint64_t delay_ms) {
+    if (work->pending) return false;
+    work->pending = 1;
+    work->expires = now_ms + delay_ms;
+    timers[nr_timers++] = work;
+    return true;
+}
+
+bool cancel_work(struct work* work) {
+    for (int i = 0; i < nr_timers; i++) {
+        if (timers[i] == work) {
+            timers[i] = timers[--nr_timers];
+            work->pending = 0;
+            return true;
+        }
+    }
+    for (int i = 0; i < nr_run; i++) {
+        if (run_queue[i] == work) {
+            memmove(&run_queue[i], &run_queue[i + 1], (nr_run - i - 1) * sizeof(run_queue[0]));
+            nr_run--;
+            work->pending = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// run queued work, and when nothing is runnable jump the clock to the next timer
+static bool run_until(volatile bool* done) {
+    while (!*done) {
+        if (nr_run) {
+            struct work* w = run_queue[0];
+            memmove(&run_queue[0], &run_queue[1], (nr_run - 1) * sizeof(run_queue[0]));
+            nr_run--;
+            w->pending = 0;
+            w->func(w);
+            continue;
+        }
+        if (!nr_timers) return false;
+        
+        int next = 0;
+        for (int i = 1; i < nr_timers; i++) {
+            if (timers[i]->expires < timers[next]->expires) next = i;
+        }
+        struct work* w = timers[next];
+        timers[next] = timers[--nr_timers];
+        if (w->expires > now_ms) now_ms = w->expires;
+        w->pending = 0;
+        queue_work(w);
+    }
+    return true;
+}
+
+struct result {
+    uint64_t latency[RUNS];
+    int runs;
+    int ok;
+    int attempts[MAX_ATTEMPTS + 1];
+    int errors[8];
+    int fallbacks;
+    int fast;
+};
+
+static struct wifi_connect_req req;
+
+static int connect_once(uint32_t flags, uint64_t* elapsed, struct result* r) {
+    uint64_t start = now_ms;
+    if (wifi_connect_async(&req, "comet-ap", "hunter22", flags, NULL) < 0) return WIFI_ERR_BUSY;
+    bool fast = req.fast;
+    if (!run_until(&req.complete)) {
+        fprintf(stderr, "simulation stalled at step %u\n", req.step);
+        exit(1);
+    }
+    *elapsed += now_ms - start;
+    r->fallbacks += req.fallbacks;
+    if (fast && req.result == 0 && !req.fallbacks) r->fast++;
+    return req.result;
+}
+
+// one logical connect, retried the way a caller would on failure
+static void connect_with_retry(uint32_t flags, struct result* r) {
+    uint64_t elapsed = 0;
+    int attempt = 0;
+    int ret;
+    do {
+        attempt++;
+        ret = connect_once(flags, &elapsed, r);
+    } while (ret != 0 && attempt < MAX_ATTEMPTS);
+    
+    r->latency[r->runs++] = elapsed;
+    r->attempts[attempt]++;
+    if (ret == 0) r->ok++;
+    else if (-ret < 8) r->errors[-ret]++;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(struct result* r, int pct) {
+    int idx = (r->runs - 1) * pct / 100;
+    return r->latency[idx];
+}
+
+static void report(const char* name, struct result* r) {
+    qsort(r->latency, r->runs, sizeof(r->latency[0]), cmp_u64);
+    printf("%-22s ok %4d/%d  p50 %6llu  p90 %6llu  p99 %6llu  max %6llu ms  fast %4d  fallback %3d  attempts",
+           name, r->ok, r->runs,
+           (unsigned long long)percentile(r, 50), (unsigned long long)percentile(r, 90),
+           (unsigned long long)percentile(r, 99), (unsigned long long)r->latency[r->runs - 1],
+           r->fast, r->fallbacks);
+    for (int i = 1; i <= MAX_ATTEMPTS; i++) {
+        printf(" %d:%d", i, r->attempts[i]);
+    }
+    printf("  errors");
+    for (int i = 1; i < 8; i++) {
+        if (r->errors[i]) printf(" %d:%d", -i, r->errors[i]);
+    }
+    printf("\n");
+}
+
+static const struct wifi_model_config base_cfg = {
+    .reset_ms = 50,
+    .scan_start_ms = 5,
+    .scan_ms = 800,
+    .auth_start_ms = 5,
+    .auth_ms = 300,
+    .dhcp_ms = 150,
+    .ping_ms = 100,
+    .disconnect_ms = 20,
+    .jitter_pct = 30,
+    .seed = 42,
+};
+
+static void scenario(const char* name, struct wifi_model_config cfg, uint32_t flags, bool blip) {
+    static struct result r;
+    memset(&r, 0, sizeof(r));
+    wifi_model_init(&cfg);
+    wifi_flush_cache();
+    
+    for (int i = 0; i < RUNS; i++) {
+        // cold runs forget everything, blip runs only lose the link
+        wifi_model_link_drop();
+        if (!blip) wifi_flush_cache();
+        connect_with_retry(flags, &r);
+    }
+    report(name, &r);
+}
+
+int main(void) {
+    struct wifi_model_config flaky = base_cfg;
+    flaky.scan_fail_pct = 5;
+    flaky.auth_fail_pct = 10;
+    flaky.dhcp_fail_pct = 5;
+    flaky.ping_drop_pct = 2;
+    
+    async_init();
+    scenario("cold", base_cfg, WIFI_CONNECT_FULL, false);
+    scenario("reconnect after blip", base_cfg, 0, true);
+    scenario("cold, flaky", flaky, WIFI_CONNECT_FULL, false);
+    scenario("reconnect, flaky", flaky, 0, true);
+    return 0;
+}
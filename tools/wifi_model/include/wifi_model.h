@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// per-state delays in ms and failure odds in percent for the simulated chip
+struct wifi_model_config {
+    uint32_t reset_ms;
+    uint32_t scan_start_ms;
+    uint32_t scan_ms;
+    uint32_t auth_start_ms;
+    uint32_t auth_ms;
+    uint32_t dhcp_ms;
+    uint32_t ping_ms;
+    uint32_t disconnect_ms;
+    uint32_t jitter_pct;
+    uint32_t scan_fail_pct;
+    uint32_t auth_fail_pct;
+    uint32_t dhcp_fail_pct;
+    uint32_t ping_drop_pct;
+    uint32_t seed;
+};
+
+void wifi_model_init(const struct wifi_model_config* cfg);
+void wifi_model_link_drop(void);
+uint64_t sim_now_ms(void);
@@ -0,0 +1,167 @@
+// software model of the wifi chip's register interface (see internet/wifi.h).
+// time is the benchmark's virtual clock, status changes are queued as
+// (time, state) transitions and applied lazily whenever STATUS is read.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <wifi.h>
+#include <wifi_model.h>
+
+#define MAX_TRANSITIONS 4
+
+struct transition {
+    uint64_t at;
+    uint32_t state;
+};
+
+static struct wifi_model_config cfg;
+static uint32_t rng;
+
+static uint32_t status;
+static bool in_reset;
+static struct transition pending[MAX_TRANSITIONS];
+static int nr_pending;
+
+static uint8_t regs[0x100];
+static uint32_t ip;
+static uint32_t ip_pending;
+static uint64_t ip_ready_at;
+static uint32_t leases;
+
+static uint32_t next_rand(void) {
+    rng = rng * 1103515245 + 12345;
+    return (rng >> 16) & 0x7FFF;
+}
+
+static bool roll(uint32_t pct) {
+    return pct && next_rand() % 100 < pct;
+}
+
+static uint64_t jitter(uint32_t ms) {
+    if (!cfg.jitter_pct || !ms) return ms;
+    int64_t span = (int64_t)ms * cfg.jitter_pct / 100;
+    int64_t offset = (int64_t)(next_rand() % (2 * span + 1)) - span;
+    return (uint64_t)((int64_t)ms + offset);
+}
+
+static void clear_transitions(void) {
+    nr_pending = 0;
+}
+
+// transitions chain off the previous one so a command's stages stay ordered
+static void push(uint32_t delay_ms, uint32_t state) {
+    uint64_t base = nr_pending ? pending[nr_pending - 1].at : sim_now_ms();
+    if (nr_pending == MAX_TRANSITIONS) return;
+    pending[nr_pending].at = base + jitter(delay_ms);
+    pending[nr_pending].state = state;
+    nr_pending++;
+}
+
+static void settle(void) {
+    uint64_t now = sim_now_ms();
+    int done = 0;
+    while (done < nr_pending && pending[done].at <= now) {
+        status = pending[done].state;
+        done++;
+    }
+    memmove(pending, pending + done, (nr_pending - done) * sizeof(pending[0]));
+    nr_pending -= done;
+    
+    if (ip_ready_at && now >= ip_ready_at) {
+        ip = ip_pending;
+        ip_ready_at = 0;
+    }
+}
+
+void wifi_model_init(const struct wifi_model_config* config) {
+    cfg = *config;
+    rng = cfg.seed ? cfg.seed : 1;
+    status = STATUS_IDLE;
+    in_reset = false;
+    clear_transitions();
+    memset(regs, 0, sizeof(regs));
+    ip = 0;
+    ip_ready_at = 0;
+    leases = 0;
+}
+
+void wifi_model_link_drop(void) {
+    settle();
+    clear_transitions();
+    status = STATUS_DISCONNECTED;
+}
+
+static void command(uint32_t cmd) {
+    settle();
+    
+    if (cmd == 0xFF) {
+        in_reset = true;
+        clear_transitions();
+        status = STATUS_DISCONNECTED;
+        ip = 0;
+        return;
+    }
+    if (cmd == 0x00) {
+        if (in_reset) {
+            in_reset = false;
+            push(cfg.reset_ms, STATUS_IDLE);
+        }
+        return;
+    }
+    if (in_reset) return;
+    
+    clear_transitions();
+    switch (cmd) {
+        case CMD_SCAN:
+            push(cfg.scan_start_ms, STATUS_SCANNING);
+            push(cfg.scan_ms, roll(cfg.scan_fail_pct) ? STATUS_FAILED : STATUS_IDLE);
+            if (!regs[0x94]) regs[0x94] = 40 + next_rand() % 50;
+            break;
+        case CMD_CONNECT:
+            push(cfg.auth_start_ms, STATUS_CONNECTING);
+            push(cfg.auth_ms, roll(cfg.auth_fail_pct) ? STATUS_FAILED : STATUS_CONNECTED);
+            break;
+        case CMD_GET_IP:
+            ip_pending = roll(cfg.dhcp_fail_pct) ? 0 : 0x0A000002 + (leases++ % 200);
+            ip_ready_at = sim_now_ms() + jitter(cfg.dhcp_ms);
+            break;
+        case CMD_PING:
+            if (roll(cfg.ping_drop_pct)) push(cfg.ping_ms, STATUS_DISCONNECTED);
+            break;
+        case CMD_DISCONNECT:
+            push(cfg.disconnect_ms, STATUS_IDLE);
+            break;
+    }
+}
+
+uint32_t wifi_model_read32(uint32_t offset) {
+    settle();
+    switch (offset) {
+        case 0x04: return status;
+        case 0x90: return ip;
+        case 0x94: return regs[0x94];
+    }
+    if (offset + 4 <= sizeof(regs)) {
+        uint32_t val;
+        memcpy(&val, &regs[offset], 4);
+        return val;
+    }
+    return 0;
+}
+
+void wifi_model_write32(uint32_t offset, uint32_t val) {
+    if (offset == 0x00) {
+        command(val);
+    } else if (offset == 0x90) {
+        settle();
+        ip = val;
+        ip_ready_at = 0;
+    } else if (offset + 4 <= sizeof(regs)) {
+        memcpy(&regs[offset], &val, 4);
+    }
+}
+
+void wifi_model_write8(uint32_t offset, uint8_t val) {
+    if (offset < sizeof(regs)) regs[offset] = val;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// host stand-in for the kernel's spinlock.h, the benchmark is single threaded
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t* lock) { lock->locked = 1; }
+static inline void spin_unlock(spinlock_t* lock) { lock->locked = 0; }
+
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    spin_lock(lock);
+    return 0;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    (void)flags;
+    spin_unlock(lock);
+}
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <cpu.h>
+#include <timer.h>
+#include <trace.h>
+#include <drivers/uart.h>
+#include <drivers/kprintf.h>
+
+static const char* trace_names[TRACE_NR_EVENTS] = {
+#define TRACE_NAME(name) #name,
+    TRACE_EVENTS(TRACE_NAME)
+#undef TRACE_NAME
+};
+
+#ifdef CONFIG_TRACE
+
+uint64_t trace_enabled_mask = 0;
+
+// one ring per cpu, only ever written by that cpu with interrupts off
+struct trace_ring {
+    struct trace_event events[TRACE_RING_EVENTS];
+    uint32_t head;
+} __attribute__((aligned(64)));
+
+static struct trace_ring rings[MAX_CPUS];
+
+void trace_record(uint32_t id, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3) {
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = smp_processor_id();
+    struct trace_ring* ring = &rings[cpu];
+    struct trace_event* ev = &ring->events[ring->head % TRACE_RING_EVENTS];
+    
+    ev->timestamp = timer_counter();
+    ev->id = id;
+    ev->cpu = cpu;
+    ev->seq = ring->head++;
+    ev->args[0] = a0;
+    ev->args[1] = a1;
+    ev->args[2] = a2;
+    ev->args[3] = a3;
+    local_irq_restore(flags);
+}
+
+static int name_equal(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+#endif
+
+int trace_enable(const char* name, int on) {
+#ifdef CONFIG_TRACE
+    for (uint32_t i = 0; i < TRACE_NR_EVENTS; i++) {
+        if (!name_equal(trace_names[i], name)) continue;
+        if (on) {
+            __atomic_fetch_or(&trace_enabled_mask, 1ULL << i, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_and(&trace_enabled_mask, ~(1ULL << i), __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+#else
+    (void)name;
+    (void)on;
+#endif
+    return -1;
+}
+
+void trace_enable_all(int on) {
+#ifdef CONFIG_TRACE
+    uint64_t all = (TRACE_NR_EVENTS >= 64) ? ~0ULL : (1ULL << TRACE_NR_EVENTS) - 1;
+    __atomic_store_n(&trace_enabled_mask, on ? all : 0, __ATOMIC_RELAXED);
+#else
+    (void)on;
+#endif
+}
+
+// text framing keeps it safe through a terminal, tools/trace_decode.py reads it back
+void trace_dump_uart(void) {
+    char line[160];
+    ksnprintf(line, sizeof(line), "#TRACE-BEGIN freq=%lu cpus=%u\r\n", timer_freq(), MAX_CPUS);
+    uart_puts(line);
+    for (uint32_t i = 0; i < TRACE_NR_EVENTS; i++) {
+        ksnprintf(line, sizeof(line), "#EVENT %u %s\r\n", i, trace_names[i]);
+        uart_puts(line);
+    }
+    
+#ifdef CONFIG_TRACE
+    uint64_t saved = trace_enabled_mask;
+    trace_enabled_mask = 0;
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct trace_ring* ring = &rings[cpu];
+        uint32_t head = ring->head;
+        uint32_t start = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        
+        for (uint32_t i = start; i < head; i++) {
+            struct trace_event* ev = &ring->events[i % TRACE_RING_EVENTS];
+            ksnprintf(line, sizeof(line), "E %u %u %lx %u %lx %lx %lx %lx\r\n",
+                      ev->cpu, ev->seq, ev->timestamp, ev->id,
+                      ev->args[0], ev->args[1], ev->args[2], ev->args[3]);
+            uart_puts(line);
+        }
+    }
+    
+    trace_enabled_mask = saved;
+#endif
+    uart_puts("#TRACE-END\r\n");
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// every tracepoint in the kernel, the position is the event id
+#define TRACE_EVENTS(X) \
+    X(vm_map)           \
+    X(vm_unmap)         \
+    X(alloc_page)       \
+    X(free_page)        \
+    X(sched_switch)     \
+    X(sched_wakeup)     \
+    X(wifi_cmd)         \
+    X(wifi_status)
+
+enum trace_event_id {
+#define TRACE_ENUM(name) TRACE_ID_##name,
+    TRACE_EVENTS(TRACE_ENUM)
+#undef TRACE_ENUM
+    TRACE_NR_EVENTS
+};
+
+#define TRACE_RING_EVENTS 512
+
+struct trace_event {
+    uint64_t timestamp;
+    uint16_t id;
+    uint16_t cpu;
+    uint32_t seq;
+    uint64_t args[4];
+};
+
+#ifdef CONFIG_TRACE
+
+extern uint64_t trace_enabled_mask;
+
+void trace_record(uint32_t id, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3);
+
+#define TRACE_ARGS4(a0, a1, a2, a3, ...) \
+    (uint64_t)(a0), (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3)
+
+// up to four arguments, missing ones are recorded as zero
+#define TRACE(name, ...)                                                   \
+    do {                                                                   \
+        if (__builtin_expect(trace_enabled_mask & (1ULL << TRACE_ID_##name), 0)) \
+            trace_record(TRACE_ID_##name, TRACE_ARGS4(__VA_ARGS__, 0, 0, 0, 0)); \
+    } while (0)
+
+#else
+
+#define TRACE(name, ...) do { } while (0)
+
+#endif
+
+int trace_enable(const char* name, int on);
+void trace_enable_all(int on);
+void trace_dump_uart(void);
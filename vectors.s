@@ -0,0 +1,138 @@
+.section .text
+.globl exception_vectors
+
+.macro save_regs
+    sub sp, sp, #192
+    stp x0, x1, [sp, #0]
+    stp x2, x3, [sp, #16]
+    stp x4, x5, [sp, #32]
+    stp x6, x7, [sp, #48]
+    stp x8, x9, [sp, #64]
+    stp x10, x11, [sp, #80]
+    stp x12, x13, [sp, #96]
+    stp x14, x15, [sp, #112]
+    stp x16, x17, [sp, #128]
+    stp x18, x29, [sp, #144]
+    mrs x0, elr_el1
+    mrs x1, spsr_el1
+    stp x30, x0, [sp, #160]
+    str x1, [sp, #176]
+.endm
+
+.macro restore_regs
+    ldr x1, [sp, #176]
+    ldp x30, x0, [sp, #160]
+    msr spsr_el1, x1
+    msr elr_el1, x0
+    ldp x18, x29, [sp, #144]
+    ldp x16, x17, [sp, #128]
+    ldp x14, x15, [sp, #112]
+    ldp x12, x13, [sp, #96]
+    ldp x10, x11, [sp, #80]
+    ldp x8, x9, [sp, #64]
+    ldp x6, x7, [sp, #48]
+    ldp x4, x5, [sp, #32]
+    ldp x2, x3, [sp, #16]
+    ldp x0, x1, [sp, #0]
+    add sp, sp, #192
+.endm
+
+.equ FP_FRAME, 528
+
+// fpsr/fpcr then q0-q31, kept below the general frame so handle_irq still
+// gets a struct irq_frame. x0/x1 are already saved by save_regs
+.macro save_fp_regs
+    sub sp, sp, #FP_FRAME
+    stp q0, q1, [sp, #16]
+    stp q2, q3, [sp, #48]
+    stp q4, q5, [sp, #80]
+    stp q6, q7, [sp, #112]
+    stp q8, q9, [sp, #144]
+    stp q10, q11, [sp, #176]
+    stp q12, q13, [sp, #208]
+    stp q14, q15, [sp, #240]
+    stp q16, q17, [sp, #272]
+    stp q18, q19, [sp, #304]
+    stp q20, q21, [sp, #336]
+    stp q22, q23, [sp, #368]
+    stp q24, q25, [sp, #400]
+    stp q26, q27, [sp, #432]
+    stp q28, q29, [sp, #464]
+    stp q30, q31, [sp, #496]
+    mrs x0, fpsr
+    mrs x1, fpcr
+    stp x0, x1, [sp, #0]
+.endm
+
+.macro restore_fp_regs
+    ldp x0, x1, [sp, #0]
+    msr fpsr, x0
+    msr fpcr, x1
+    ldp q30, q31, [sp, #496]
+    ldp q28, q29, [sp, #464]
+    ldp q26, q27, [sp, #432]
+    ldp q24, q25, [sp, #400]
+    ldp q22, q23, [sp, #368]
+    ldp q20, q21, [sp, #336]
+    ldp q18, q19, [sp, #304]
+    ldp q16, q17, [sp, #272]
+    ldp q14, q15, [sp, #240]
+    ldp q12, q13, [sp, #208]
+    ldp q10, q11, [sp, #176]
+    ldp q8, q9, [sp, #144]
+    ldp q6, q7, [sp, #112]
+    ldp q4, q5, [sp, #80]
+    ldp q2, q3, [sp, #48]
+    ldp q0, q1, [sp, #16]
+    add sp, sp, #FP_FRAME
+.endm
+
+.macro bad_vector type
+.align 7
+    save_regs
+    mov x0, #\type
+    mrs x1, esr_el1
+    mrs x2, elr_el1
+    bl handle_bad_exception
+    b .
+.endm
+
+.macro irq_vector
+.align 7
+    b irq_entry
+.endm
+
+.align 11
+exception_vectors:
+    // current el with sp_el0
+    bad_vector 0
+    bad_vector 1
+    bad_vector 2
+    bad_vector 3
+
+    // current el with sp_elx
+    bad_vector 4
+    irq_vector
+    bad_vector 6
+    bad_vector 7
+
+    // lower el aarch64
+    bad_vector 8
+    irq_vector
+    bad_vector 10
+    bad_vector 11
+
+    // lower el aarch32
+    bad_vector 12
+    bad_vector 13
+    bad_vector 14
+    bad_vector 15
+
+irq_entry:
+    save_regs
+    save_fp_regs
+    add x0, sp, #FP_FRAME
+    bl handle_irq
+    restore_fp_regs
+    restore_regs
+    eret
@@ -2,9 +2,9 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <vm_pages.h>
+#include <spinlock.h>
+#include <trace.h>
 
-#define PAGE_SIZE 4096
-#define PAGE_SHIFT 12
 #define VM_MAX_PAGES 262144
 #define VM_AREA_POOL_SIZE 1024
 #define RESERVED_PAGES 1024
@@ -20,6 +20,7 @@
 #define PTE_PXN         (1ULL << 53)
 #define PTE_UXN         (1ULL << 54)
 
+#define ATTR_INDEX_DEVICE_nGnRnE 0
 #define ATTR_INDEX_NORMAL_WB_WA  2
 #define PTE_ATTR_INDX(idx) ((uint64_t)(idx) << 2)
 #define PTE_ADDR_MASK 0x0000FFFFFFFFF000ULL
@@ -53,9 +54,16 @@ static struct vm_area* vm_areas = NULL;
 static struct vm_area* free_vm_areas = NULL;
 
 static uint64_t total_pages = 0;
-static uint64_t free_pages = 0;
+static uint64_t nr_free_pages = 0;
+// the bitmap, ref counts and nr_free_pages, from any cpu and from irq and
+// softirq context. zeroing and reclaim happen outside it
+static spinlock_t page_lock = SPINLOCK_INIT;
 static uint32_t next_free_area = 0;
 
+static vm_shrinker_t shrinkers[VM_MAX_SHRINKERS];
+static uint32_t nr_shrinkers = 0;
+static volatile uint32_t shrinking = 0;
+
 static uint64_t* page_table_base = (uint64_t*)0x1000;
 
 // external kernel_panic declaration
@@ -168,7 +176,7 @@ void vm_init(void) {
     }
     
     total_pages = VM_MAX_PAGES;
-    free_pages = VM_MAX_PAGES - RESERVED_PAGES;
+    nr_free_pages = VM_MAX_PAGES - RESERVED_PAGES;
     
     if (page_table_base) {
         for (int i = 0; i < 512; i++) {
@@ -178,8 +186,32 @@ void vm_init(void) {
     }
 }
 
+// caches hand pages back before an allocation would eat into the watermark.
+// a shrinker freeing pages never allocates, but guard against re-entry anyway
+static void reclaim(uint64_t count) {
+    if (nr_free_pages >= count + VM_LOW_WATERMARK || !nr_shrinkers) return;
+    if (__atomic_exchange_n(&shrinking, 1, __ATOMIC_ACQUIRE)) return;
+    
+    uint64_t want = count + VM_LOW_WATERMARK - nr_free_pages;
+    for (uint32_t i = 0; i < nr_shrinkers && want; i++) {
+        uint64_t got = shrinkers[i](want);
+        want = got < want ? want - got : 0;
+    }
+    __atomic_store_n(&shrinking, 0, __ATOMIC_RELEASE);
+}
+
+int vm_register_shrinker(vm_shrinker_t shrink) {
+    if (nr_shrinkers == VM_MAX_SHRINKERS) return -1;
+    shrinkers[nr_shrinkers++] = shrink;
+    return 0;
+}
+
 uint64_t alloc_page(void) {
-    if (free_pages == 0) {
+    reclaim(1);
+    
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    if (nr_free_pages == 0) {
+        spin_unlock_irqrestore(&page_lock, flags);
         return 0;
     }
     
@@ -188,19 +220,27 @@ uint64_t alloc_page(void) {
             set_bit(i);
             pages[i].ref_count = 1;
             pages[i].flags = 0;
-            free_pages--;
+            nr_free_pages--;
+            spin_unlock_irqrestore(&page_lock, flags);
             
             uint64_t phys_addr = pages[i].phys_addr;
             zero_page(phys_addr);
+            TRACE(alloc_page, phys_addr, i - RESERVED_PAGES);
             
             return phys_addr;
         }
     }
+    spin_unlock_irqrestore(&page_lock, flags);
     return 0;
 }
 
 uint64_t alloc_pages(int count) {
-    if (count <= 0 || count > free_pages) {
+    if (count <= 0) return 0;
+    reclaim(count);
+    
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    if ((uint64_t)count > nr_free_pages) {
+        spin_unlock_irqrestore(&page_lock, flags);
         return 0;
     }
     
@@ -219,13 +259,19 @@ uint64_t alloc_pages(int count) {
                 set_bit(i);
                 pages[i].ref_count = 1;
                 pages[i].flags = 0;
+            }
+            nr_free_pages -= count;
+            spin_unlock_irqrestore(&page_lock, flags);
+            
+            for (int i = start; i < start + count; i++) {
                 zero_page(pages[i].phys_addr);
             }
-            free_pages -= count;
+            TRACE(alloc_page, pages[start].phys_addr, start - RESERVED_PAGES, count);
             return pages[start].phys_addr;
         }
     }
     
+    spin_unlock_irqrestore(&page_lock, flags);
     return 0;
 }
 
@@ -234,16 +280,25 @@ void free_page(uint64_t phys_addr) {
     
     uint64_t pfn = PADDR_TO_PFN(phys_addr);
     if (pfn >= VM_MAX_PAGES || pfn < RESERVED_PAGES) return;
+    TRACE(free_page, phys_addr, pages[pfn].ref_count);
     
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    bool last = false;
     if (pages[pfn].ref_count > 0) {
         pages[pfn].ref_count--;
-        if (pages[pfn].ref_count == 0) {
-            clear_bit(pfn);
-            pages[pfn].flags = 0;
-            free_pages++;
-            zero_page(phys_addr);
-        }
+        last = pages[pfn].ref_count == 0;
     }
+    spin_unlock_irqrestore(&page_lock, flags);
+    if (!last) return;
+    
+    // still marked used while it is zeroed, nobody can be handed it yet
+    zero_page(phys_addr);
+    
+    flags = spin_lock_irqsave(&page_lock);
+    clear_bit(pfn);
+    pages[pfn].flags = 0;
+    nr_free_pages++;
+    spin_unlock_irqrestore(&page_lock, flags);
 }
 
 void free_pages(uint64_t phys_addr, int count) {
@@ -259,6 +314,7 @@ void set_page_table_base(uint64_t base) {
 int vm_map(uint64_t virt_addr, uint64_t phys_addr, uint32_t prot) {
     if (!page_table_base) return -1;
     if (virt_addr & 0xFFF || phys_addr & 0xFFF) return -1;
+    TRACE(vm_map, virt_addr, phys_addr, prot);
     
     struct vm_area* area = alloc_vm_area();
     if (!area) return -1;
@@ -305,6 +361,11 @@ int vm_map(uint64_t virt_addr, uint64_t phys_addr, uint32_t prot) {
     
     uint64_t pte_flags = PTE_VALID | PTE_AF | PTE_SH_INNER | PTE_ATTR_INDX(ATTR_INDEX_NORMAL_WB_WA);
     
+    // mmio must not be cached or speculatively accessed
+    if (prot & PROT_DEVICE) {
+        pte_flags = PTE_VALID | PTE_AF | PTE_ATTR_INDX(ATTR_INDEX_DEVICE_nGnRnE);
+    }
+    
     if (!(prot & PROT_EXEC)) {
         pte_flags |= PTE_UXN | PTE_PXN;
     }
@@ -332,6 +393,7 @@ int vm_map(uint64_t virt_addr, uint64_t phys_addr, uint32_t prot) {
 int vm_unmap(uint64_t virt_addr) {
     if (!page_table_base) return -1;
     if (virt_addr & 0xFFF) return -1;
+    TRACE(vm_unmap, virt_addr);
     
     uint64_t l0_idx = (virt_addr >> 39) & 0x1FF;
     uint64_t l1_idx = (virt_addr >> 30) & 0x1FF;
@@ -408,6 +470,11 @@ int vm_protect(uint64_t virt_addr, uint32_t prot) {
     uint64_t phys_addr = entry & PTE_ADDR_MASK;
     uint64_t pte_flags = PTE_VALID | PTE_AF | PTE_SH_INNER | PTE_ATTR_INDX(ATTR_INDEX_NORMAL_WB_WA);
     
+    // mmio must not be cached or speculatively accessed
+    if (prot & PROT_DEVICE) {
+        pte_flags = PTE_VALID | PTE_AF | PTE_ATTR_INDX(ATTR_INDEX_DEVICE_nGnRnE);
+    }
+    
     if (!(prot & PROT_EXEC)) {
         pte_flags |= PTE_UXN | PTE_PXN;
     }
@@ -442,7 +509,7 @@ int vm_protect(uint64_t virt_addr, uint32_t prot) {
 }
 
 uint64_t get_free_pages(void) {
-    return free_pages;
+    return nr_free_pages;
 }
 
 uint64_t get_total_pages(void) {
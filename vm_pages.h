@@ -2,17 +2,31 @@
 
 #include <stdint.h>
 
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
 #define PROT_USER  0x8
 #define PROT_NONE  0x0
 #define PROT_READ  0x1
 #define PROT_WRITE 0x2
 #define PROT_EXEC  0x4
+#define PROT_DEVICE 0x10
+
+// free pages kept back before caches are asked to shrink
+#define VM_LOW_WATERMARK 1024
+#define VM_MAX_SHRINKERS 4
+
+// gives back up to nr_pages, returns how many it actually freed
+typedef uint64_t (*vm_shrinker_t)(uint64_t nr_pages);
 
 void vm_init(void);
 uint64_t alloc_page(void);
+uint64_t alloc_pages(int count);
 void free_page(uint64_t phys_addr);
+void free_pages(uint64_t phys_addr, int count);
 int vm_map(uint64_t virt_addr, uint64_t phys_addr, uint32_t prot);
 int vm_unmap(uint64_t virt_addr);
 int vm_protect(uint64_t virt_addr, uint32_t prot);
 uint64_t get_free_pages(void);
 uint64_t get_total_pages(void);
+int vm_register_shrinker(vm_shrinker_t shrink);